@@ -7,31 +7,65 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
-#include <sys/mman.h>
+#include <signal.h>
 #include <time.h>
 #include <drm_fourcc.h>
 
-struct drm_object {
-    drmModeObjectProperties *props;
-    drmModePropertyRes **props_info;
-    uint32_t id;
-};
-
-struct modeset_buf {
-    uint32_t width;
-    uint32_t height;
-    uint32_t stride;
-    uint32_t size;
-    uint32_t handle;
-    uint8_t *map;
-    uint32_t fb;
+#include "modeset-assign.h"
+#include "modeset-bringup.h"
+#include "modeset-buf.h"
+#include "modeset-cache.h"
+#include "modeset-cursor.h"
+#include "modeset-damage.h"
+#include "modeset-fill.h"
+#include "modeset-loop.h"
+#include "modeset-props.h"
+#include "modeset-req.h"
+#include "modeset-sched.h"
+#include "modeset-shadow.h"
+#include "modeset-stats.h"
+#include "modeset-swapchain.h"
+#include "modeset-topo.h"
+#include "modeset-util.h"
+
+#define MODESET_MAX_CARDS 8
+/* modeset_open sets both before anything is probed */
+#define MODESET_CACHE_CAPS (MODESET_CACHE_CAP_UNIVERSAL_PLANES | MODESET_CACHE_CAP_ATOMIC)
+
+#ifndef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+#define DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP 0x15
+#endif
+
+struct modeset_card {
+    int fd;
+    char node[64];
+    struct modeset_pool pool;
+    bool async;
+    bool cached;
+    uint64_t cursor_used;
+
+    /* flip templates of a whole batch, concatenated every frame */
+    struct modeset_req batch_req;
+
+    struct modeset_topo topo;
+    struct modeset_assign assign;
 };
 
 struct modeset_output {
     struct modeset_output *next;
+    struct modeset_card *card;
 
-    unsigned int front_buf;
-    struct modeset_buf bufs[2];
+    struct modeset_swapchain sc;
+    struct modeset_shadow shadow;
+
+    /* damage not yet painted into a frame, each frame's own damage, and what each buffer still misses */
+    struct modeset_damage damage;
+    struct modeset_damage frame_damage[MODESET_SWAPCHAIN_MAX_BUFS];
+    struct modeset_damage stale[MODESET_SWAPCHAIN_MAX_BUFS];
+    /* mailbox only: everything painted since the last flip */
+    struct modeset_damage unflipped;
+    struct drm_mode_rect box;
+    uint32_t bg;
 
     struct drm_object connector;
     struct drm_object crtc;
@@ -39,16 +73,46 @@ struct modeset_output {
 
     drmModeModeInfo mode;
     uint32_t mode_blob_id;
+    uint32_t conn_index;
     uint32_t crtc_index;
+    uint32_t plane_index;
+
+    struct modeset_req flip_req;
+    int flip_fb_slot;
+    int flip_cursor;
+
+    /* async commits may only touch FB_ID, so they get a template of their own */
+    struct modeset_req async_req;
+    int async_fb_slot;
+    bool async;
+
+    struct modeset_stats stats;
+
+    /* paint timer of a deadline-scheduled output, -1 paints right after each flip */
+    struct modeset_sched sched;
+    int sched_timer;
+
+    struct modeset_cursor cursor;
+    int32_t cursor_dx, cursor_dy;
+
+    /* outputs of one card at the same refresh rate flip in one commit, -1 flips alone */
+    int batch;
+
+    /* the CRTC already runs our mode on this connector, the first commit only swaps the plane */
+    bool takeover;
 
     bool pflip_pending;
     bool cleanup;
+    bool stream;
 
     uint8_t r, g, b;
     bool r_up, g_up, b_up;
 };
 
 static struct modeset_output *output_list = NULL;
+static struct modeset_loop loop;
+static struct modeset_card cards[MODESET_MAX_CARDS];
+static unsigned int count_cards;
 
 static int modeset_open(int *out, const char *node)
 {
@@ -90,390 +154,259 @@ static int modeset_open(int *out, const char *node)
     return 0;
 }
 
-static int64_t get_property_value(int fd, drmModeObjectPropertiesPtr props, const char *name)
+static int modeset_find_crtc(struct modeset_card *card, struct modeset_output *out)
 {
-    drmModePropertyPtr prop;
-    uint64_t value;
-    bool found;
-    int j;
+    int crtc = card->assign.conn_crtc[out->conn_index];
 
-    found = false;
-    for (j = 0; j < props->count_props && !found; ++j) {
-        prop = drmModeGetProperty(fd, props->props[j]);
-        if (!strcmp(prop->name, name)) {
-            value = props->prop_values[j];
-            found = true;
-        }
-        drmModeFreeProperty(prop);
+    if (crtc < 0) {
+        fprintf(stderr, "cannot find suitable crtc for connector %u\n", out->connector.id);
+        return -ENOENT;
     }
 
-    if (!found)
-        return -1;
-    return value;
-}
+    if (crtc != card->topo.connectors[out->conn_index].crtc)
+        fprintf(stderr, "crtc %u found for connector %u, will need full modeset\n",
+                card->topo.crtcs[crtc].obj.id, out->connector.id);
 
-static void modeset_get_object_properties(int fd, struct drm_object *obj, uint32_t type)
-{
-    const char *type_str;
-    unsigned int i;
-
-    obj->props = drmModeObjectGetProperties(fd, obj->id, type);
-    if (!obj->props) {
-        switch (type) {
-            case DRM_MODE_OBJECT_CONNECTOR:
-                type_str = "connector";
-                break;
-            case DRM_MODE_OBJECT_PLANE:
-                type_str = "plane";
-                break;
-            case DRM_MODE_OBJECT_CRTC:
-                type_str = "CRTC";
-                break;
-            default:
-                type_str = "unknown type";
-                break;
-        }
-        fprintf(stderr, "cannot get %s %d properties: %s\n", type_str, obj->id, strerror(errno));
-        return;
-    }
-
-    obj->props_info = calloc(obj->props->count_props, sizeof(obj->props_info));
-    for (i = 0; i < obj->props->count_props; ++i)
-        obj->props_info[i] = drmModeGetProperty(fd, obj->props->props[i]);
+    out->crtc_index = crtc;
+    out->crtc = card->topo.crtcs[crtc].obj;
+    return 0;
 }
 
-static int set_drm_object_property(drmModeAtomicReq *req, struct drm_object *obj, const char *name, uint64_t value)
+static int modeset_find_plane(struct modeset_card *card, struct modeset_output *out)
 {
-    int i;
-    uint32_t prop_id = 0;
+    int plane = card->assign.crtc_primary[out->crtc_index];
 
-    for (i = 0; i < obj->props->count_props; ++i) {
-        if (!strcmp(obj->props_info[i]->name, name)) {
-            prop_id = obj->props_info[i]->prop_id;
-            break;
-        }
-    }
-
-    if (prop_id == 0) {
-        fprintf(stderr, "no object property: %s\n", name);
+    if (plane < 0) {
+        fprintf(stderr, "couldn't find a primary plane\n");
         return -EINVAL;
     }
 
-    return drmModeAtomicAddProperty(req, obj->id, prop_id, value);
-}
-
-static int modeset_find_crtc(int fd, drmModeRes *res, drmModeConnector *conn, struct modeset_output *out)
-{
-    drmModeEncoder *enc;
-    unsigned int i, j;
-    uint32_t crtc;
-    struct modeset_output *iter;
-
-    if (conn->encoder_id)
-        enc = drmModeGetEncoder(fd, conn->encoder_id);
-    else
-        enc = NULL;
-
-    if (enc) {
-        if (enc->crtc_id) {
-            crtc = enc->crtc_id;
-            for (iter = output_list; iter; iter = iter->next) {
-                if (iter->crtc.id == crtc) {
-                    crtc = 0;
-                    break;
-                }
-            }
-
-            if (crtc > 0) {
-                drmModeFreeEncoder(enc);
-                out->crtc.id = crtc;
-                for (i = 0; i < res->count_crtcs; ++i) {
-                    if (res->crtcs[i] == crtc) {
-                        out->crtc_index = i;
-                        break;
-                    }
-                }
-                return 0;
-            }
-        }
-        drmModeFreeEncoder(enc);
-    }
-
-    for (i = 0; i < conn->count_encoders; ++i) {
-        enc = drmModeGetEncoder(fd, conn->encoders[i]);
-        if (!enc) {
-            fprintf(stderr, "cannot retrieve encoder %u:%u (%d): %m\n", i, conn->encoders[i], errno);
-            continue;
-        }
-
-        for (j = 0; j < res->count_crtcs; ++j) {
-            if (!(enc->possible_crtcs & (1 << j)))
-                continue;
-
-            crtc = res->crtcs[j];
-            for (iter = output_list; iter; iter = iter->next) {
-                if (iter->crtc.id == crtc) {
-                    crtc = 0;
-                    break;
-                }
-            }
-
-            if (crtc > 0) {
-                fprintf(stderr, "crtc %u found for encoder %u, will need full modeset\n", crtc, conn->encoders[i]);
-                drmModeFreeEncoder(enc);
-                out->crtc.id = crtc;
-                out->crtc_index = j;
-                return 0;
-            }
-        }
-
-        drmModeFreeEncoder(enc);
-    }
-
-    fprintf(stderr, "cannot find suitable crtc for connector %u\n", conn->connector_id);
-    return -ENOENT;
+    out->plane_index = plane;
+    out->plane = card->topo.planes[plane].obj;
+    fprintf(stderr, "found primary plane, id: %d\n", out->plane.id);
+    return 0;
 }
 
-static int modeset_find_plane(int fd, struct modeset_output *out)
+static int modeset_setup_framebuffers(struct modeset_output *out)
 {
-    drmModePlaneResPtr plane_res;
-    bool found_primary = false;
-    int i, ret = -EINVAL;
-
-    plane_res = drmModeGetPlaneResources(fd);
-    if (!plane_res) {
-        fprintf(stderr, "drmModeGetPlaneResources failed: %s\n", strerror(errno));
-        return -ENOENT;
-    }
-
-    for (i = 0; i < plane_res->count_planes && !found_primary; ++i) {
-        int plane_id = plane_res->planes[i];
-
-        drmModePlanePtr plane = drmModeGetPlane(fd, plane_id);
-        if (!plane) {
-            fprintf(stderr, "drmModeGetPlane(%u) failed: %s\n", plane_id, strerror(errno));
-            continue;
-        }
-
-        if (plane->possible_crtcs & (1 << out->crtc_index)) {
-            drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd, plane_id, DRM_MODE_OBJECT_PLANE);
-
-            if (get_property_value(fd, props, "type") == DRM_PLANE_TYPE_PRIMARY) {
-                found_primary = true;
-                out->plane.id = plane_id;
-                ret = 0;
-            }
-
-            drmModeFreeObjectProperties(props);
-        }
-
-        drmModeFreePlane(plane);
-    }
+    unsigned int count = modeset_swapchain_count();
+    bool mailbox = modeset_env_match("MODESET_MAILBOX", out->connector.id);
+    int ret;
 
-    drmModeFreePlaneResources(plane_res);
+    /* a mailbox needs a buffer to paint into besides the queued and scanned out ones */
+    if (mailbox && count < 3)
+        count = 3;
 
-    if (found_primary)
-        fprintf(stderr, "found primary plane, id: %d\n", out->plane.id);
-    else
-        fprintf(stderr, "couldn't find a primary plane\n");
+    ret = modeset_swapchain_init(&out->sc, &out->card->pool, out->mode.hdisplay, out->mode.vdisplay, count);
+    out->sc.mailbox = mailbox;
     return ret;
 }
 
-static void modeset_drm_object_fini(struct drm_object *obj)
-{
-    for (int i = 0; i < obj->props->count_props; ++i)
-        drmModeFreeProperty(obj->props_info[i]);
-    free(obj->props_info);
-    drmModeFreeObjectProperties(obj->props);
-}
-
-static int modeset_setup_objects(int fd, struct modeset_output *out)
+static int modeset_setup_flip_req(struct modeset_output *out)
 {
-    struct drm_object *connector = &out->connector;
-    struct drm_object *crtc = &out->crtc;
+    struct modeset_req *req = &out->flip_req;
     struct drm_object *plane = &out->plane;
+    struct modeset_buf *buf = &out->sc.bufs[0];
 
-    modeset_get_object_properties(fd, connector, DRM_MODE_OBJECT_CONNECTOR);
-    if (!connector->props)
-        goto out_conn;
+    modeset_req_init(req);
 
-    modeset_get_object_properties(fd, crtc, DRM_MODE_OBJECT_CRTC);
-    if (!crtc->props)
-        goto out_crtc;
+    out->flip_fb_slot = modeset_req_add(req, plane, MODESET_PROP_FB_ID, buf->fb);
+    if (out->flip_fb_slot < 0)
+        return out->flip_fb_slot;
+    if (modeset_req_add(req, plane, MODESET_PROP_CRTC_ID, out->crtc.id) < 0)
+        return -EINVAL;
+    if (modeset_req_add(req, plane, MODESET_PROP_SRC_X, 0) < 0)
+        return -EINVAL;
+    if (modeset_req_add(req, plane, MODESET_PROP_SRC_Y, 0) < 0)
+        return -EINVAL;
+    if (modeset_req_add(req, plane, MODESET_PROP_SRC_W, buf->width << 16) < 0)
+        return -EINVAL;
+    if (modeset_req_add(req, plane, MODESET_PROP_SRC_H, buf->height << 16) < 0)
+        return -EINVAL;
+    if (modeset_req_add(req, plane, MODESET_PROP_CRTC_X, 0) < 0)
+        return -EINVAL;
+    if (modeset_req_add(req, plane, MODESET_PROP_CRTC_Y, 0) < 0)
+        return -EINVAL;
+    if (modeset_req_add(req, plane, MODESET_PROP_CRTC_W, buf->width) < 0)
+        return -EINVAL;
+    if (modeset_req_add(req, plane, MODESET_PROP_CRTC_H, buf->height) < 0)
+        return -EINVAL;
 
-    modeset_get_object_properties(fd, plane, DRM_MODE_OBJECT_PLANE);
-    if (!plane->props)
-        goto out_plane;
+    out->flip_cursor = modeset_req_get_cursor(req);
 
-    return 0;
+    modeset_req_init(&out->async_req);
+    out->async_fb_slot = modeset_req_add(&out->async_req, plane, MODESET_PROP_FB_ID, buf->fb);
+    if (out->async_fb_slot < 0)
+        return out->async_fb_slot;
 
-out_plane:
-    modeset_drm_object_fini(crtc);
-out_crtc:
-    modeset_drm_object_fini(connector);
-out_conn:
-    return -ENOMEM;
-}
-
-static void modeset_destroy_objects(int fd, struct modeset_output *out)
-{
-    modeset_drm_object_fini(&out->connector);
-    modeset_drm_object_fini(&out->crtc);
-    modeset_drm_object_fini(&out->plane);
+    return 0;
 }
 
-static int modeset_create_fb(int fd, struct modeset_buf *buf)
+static void modeset_setup_damage(struct modeset_output *out, bool damage_only)
 {
-    struct drm_mode_create_dumb creq;
-    struct drm_mode_destroy_dumb dreq;
-    struct drm_mode_map_dumb mreq;
-    int ret;
-    uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
-
-    memset(&creq, 0, sizeof(creq));
-    creq.width = buf->width;
-    creq.height = buf->height;
-    creq.bpp = 32;
-    ret = drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
-    if (ret < 0) {
-        fprintf(stderr, "cannot create dumb buffer (%d): %m\n", errno);
-        return -errno;
-    }
-    buf->stride = creq.pitch;
-    buf->size = creq.size;
-    buf->handle = creq.handle;
-
-    handles[0] = buf->handle;
-    pitches[0] = buf->stride;
-    ret = drmModeAddFB2(fd, buf->width, buf->height, DRM_FORMAT_XRGB8888, handles, pitches, offsets, &buf->fb, 0);
-    if (ret) {
-        fprintf(stderr, "cannot create framebuffer (%d): %m\n", errno);
-        ret = -errno;
-        goto err_destroy;
-    }
+    struct modeset_buf *buf = &out->sc.bufs[0];
+    unsigned int i;
 
-    memset(&mreq, 0, sizeof(mreq));
-    mreq.handle = buf->handle;
-    ret = drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
-    if (ret) {
-        fprintf(stderr, "cannot map dumb buffer (%d): %m\n", errno);
-        ret = -errno;
-        goto err_fb;
+    /* only a centered box animates when damage-only updates are requested */
+    if (damage_only) {
+        out->box.x1 = buf->width / 4;
+        out->box.y1 = buf->height / 4;
+        out->box.x2 = out->box.x1 + buf->width / 2;
+        out->box.y2 = out->box.y1 + buf->height / 2;
     }
-
-    buf->map = mmap(0, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mreq.offset);
-    if (buf->map == MAP_FAILED) {
-        fprintf(stderr, "cannot mmap dumb buffer (%d): %m\n", errno);
-        ret = -errno;
-        goto err_fb;
+    else {
+        out->box.x2 = buf->width;
+        out->box.y2 = buf->height;
     }
 
-    memset(buf->map, 0, buf->size);
-
-    return 0;
-
-err_fb:
-    drmModeRmFB(fd, buf->fb);
-err_destroy:
-    memset(&dreq, 0, sizeof(dreq));
-    dreq.handle = buf->handle;
-    drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
-    return ret;
+    modeset_damage_add(&out->damage, 0, 0, buf->width, buf->height);
+    for (i = 0; i < out->sc.count; ++i)
+        out->stale[i] = out->damage;
 }
 
-static void modeset_destroy_fb(int fd, struct modeset_buf *buf)
+static void modeset_output_destroy(int fd, struct modeset_output *out)
 {
-    struct drm_mode_destroy_dumb dreq;
-
-    munmap(buf->map, buf->size);
+    if (out->cursor.buf.fb) {
+        out->card->cursor_used &= ~(1ull << out->cursor.plane_index);
+        modeset_cursor_fini(&out->cursor);
+    }
+    modeset_shadow_fini(&out->shadow);
+    modeset_swapchain_fini(&out->sc, &out->card->pool);
 
-    drmModeRmFB(fd, buf->fb);
+    drmModeDestroyPropertyBlob(fd, out->mode_blob_id);
 
-    memset(&dreq, 0, sizeof(dreq));
-    dreq.handle = buf->handle;
-    drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+    free(out);
 }
 
-static int modeset_setup_framebuffers(int fd, drmModeConnector *conn, struct modeset_output *out)
-{
-    int i, ret;
+#define MODESET_ARROW_W 11
+#define MODESET_ARROW_H 16
 
-    for (i = 0; i < 2; ++i) {
-        out->bufs[i].width = conn->modes[0].hdisplay;
-        out->bufs[i].height = conn->modes[0].vdisplay;
+/* white arrow with a black outline, hotspot at the tip */
+static void modeset_setup_cursor(struct modeset_card *card, struct modeset_output *out)
+{
+    uint32_t arrow[MODESET_ARROW_W * MODESET_ARROW_H];
+    uint32_t x, y, w;
 
-        ret = modeset_create_fb(fd, &out->bufs[i]);
-        if (ret) {
-            if (i == 1)
-                modeset_destroy_fb(fd, &out->bufs[0]);
-            return ret;
+    if (modeset_cursor_init(&out->cursor, card->fd, &card->topo, out->crtc_index, card->cursor_used)) {
+        fprintf(stderr, "no cursor plane for crtc %u\n", out->crtc.id);
+        return;
+    }
+    card->cursor_used |= 1ull << out->cursor.plane_index;
+
+    for (y = 0; y < MODESET_ARROW_H; ++y) {
+        w = y * 2 / 3 + 1;
+        for (x = 0; x < MODESET_ARROW_W; ++x) {
+            if (x >= w)
+                arrow[y * MODESET_ARROW_W + x] = 0;
+            else if (x == 0 || x == w - 1 || y == MODESET_ARROW_H - 1)
+                arrow[y * MODESET_ARROW_W + x] = 0xff000000;
+            else
+                arrow[y * MODESET_ARROW_W + x] = 0xffffffff;
         }
     }
+    modeset_cursor_set_image(&out->cursor, arrow, MODESET_ARROW_W, MODESET_ARROW_H, 0, 0);
 
-    return 0;
+    out->cursor.x = out->mode.hdisplay / 2;
+    out->cursor.y = out->mode.vdisplay / 2;
+    out->cursor_dx = 3;
+    out->cursor_dy = 2;
 }
 
-static void modeset_output_destroy(int fd, struct modeset_output *out)
+/* compare the CRTC state found at probe time with the configuration we want */
+static bool modeset_can_takeover(struct modeset_card *card, struct modeset_output *out)
 {
-    modeset_destroy_objects(fd, out);
+    const struct modeset_topo_crtc *crtc = &card->topo.crtcs[out->crtc_index];
 
-    modeset_destroy_fb(fd, &out->bufs[0]);
-    modeset_destroy_fb(fd, &out->bufs[1]);
-
-    drmModeDestroyPropertyBlob(fd, out->mode_blob_id);
-
-    free(out);
+    return crtc->mode_valid && crtc->obj.prop_values[MODESET_PROP_ACTIVE] &&
+           card->topo.connectors[out->conn_index].crtc == (int)out->crtc_index &&
+           modeset_mode_equal(&crtc->mode, &out->mode);
 }
 
-static struct modeset_output* modeset_output_create(int fd, drmModeRes *res, drmModeConnector *conn)
+static struct modeset_output* modeset_output_create(struct modeset_card *card, unsigned int conn_index)
 {
-    int ret;
+    const struct modeset_topo_connector *conn = &card->topo.connectors[conn_index];
+    int ret, fd = card->fd;
     struct modeset_output *out;
 
     out = malloc(sizeof(*out));
     memset(out, 0, sizeof(*out));
-    out->connector.id = conn->connector_id;
+    out->card = card;
+    out->conn_index = conn_index;
+    out->sched_timer = -1;
+    out->batch = -1;
+    out->connector = conn->obj;
+    out->stream = modeset_stream_enabled(conn->obj.id);
 
     if (conn->connection != DRM_MODE_CONNECTED) {
-        fprintf(stderr, "ignoring unused connector %u\n", conn->connector_id);
+        fprintf(stderr, "ignoring unused connector %u\n", conn->obj.id);
         goto out_error;
     }
 
-    memcpy(&out->mode, &conn->modes[0], sizeof(out->mode));
+    if (!conn->count_modes) {
+        fprintf(stderr, "no valid mode for connector %u\n", conn->obj.id);
+        goto out_error;
+    }
+
+    memcpy(&out->mode, &conn->mode, sizeof(out->mode));
     if (drmModeCreatePropertyBlob(fd, &out->mode, sizeof(out->mode), &out->mode_blob_id) != 0) {
         fprintf(stderr, "couldn't create a blob property\n");
         goto out_error;
     }
-    fprintf(stderr, "mode for connector %u is %ux%u\n", conn->connector_id, out->bufs[0].width, out->bufs[0].height);
+    fprintf(stderr, "mode for connector %u is %ux%u\n", conn->obj.id, out->mode.hdisplay, out->mode.vdisplay);
 
-    ret = modeset_find_crtc(fd, res, conn, out);
+    ret = modeset_find_crtc(card, out);
     if (ret) {
-        fprintf(stderr, "no valid crtc for connector %u\n", conn->connector_id);
+        fprintf(stderr, "no valid crtc for connector %u\n", conn->obj.id);
         goto out_blob;
     }
 
-    ret = modeset_find_plane(fd, out);
+    ret = modeset_find_plane(card, out);
     if (ret) {
         fprintf(stderr, "no valid plane for crtc %u\n", out->crtc.id);
         goto out_blob;
     }
 
-    ret = modeset_setup_objects(fd, out);
+    ret = modeset_setup_framebuffers(out);
     if (ret) {
-        fprintf(stderr, "cannot get plane properties\n");
+        fprintf(stderr, "cannot create framebuffer for connector %u\n", conn->obj.id);
         goto out_blob;
     }
 
-    ret = modeset_setup_framebuffers(fd, conn, out);
+    ret = modeset_setup_flip_req(out);
     if (ret) {
-        fprintf(stderr, "cannot create framebuffer for connector %u\n", conn->connector_id);
-        goto out_obj;
+        fprintf(stderr, "cannot prepare flip request for connector %u\n", conn->obj.id);
+        goto out_fb;
+    }
+
+    if (modeset_shadow_enabled(conn->obj.id)) {
+        ret = modeset_shadow_init(&out->shadow, out->mode.hdisplay, out->mode.vdisplay);
+        if (ret) {
+            fprintf(stderr, "cannot allocate shadow buffer for connector %u\n", conn->obj.id);
+            goto out_fb;
+        }
+    }
+
+    /* immediate flips trade tearing for latency, only on request */
+    if (modeset_env_match("MODESET_ASYNC", conn->obj.id)) {
+        out->async = card->async;
+        if (!card->async)
+            fprintf(stderr, "no atomic async flips on this device, connector %u stays vsynced\n", conn->obj.id);
     }
 
+    if (modeset_env_match("MODESET_CURSOR", conn->obj.id))
+        modeset_setup_cursor(card, out);
+
+    if (modeset_env_match("MODESET_TAKEOVER", conn->obj.id))
+        out->takeover = modeset_can_takeover(card, out);
+
+    modeset_setup_damage(out, modeset_damage_enabled(conn->obj.id));
+    modeset_stats_init(&out->stats, out->crtc.id, modeset_mode_period_ns(&out->mode));
+    modeset_sched_init(&out->sched, modeset_mode_period_ns(&out->mode), modeset_sched_margin());
+
     return out;
 
-out_obj:
-    modeset_destroy_objects(fd, out);
+out_fb:
+    modeset_swapchain_fini(&out->sc, &out->card->pool);
 out_blob:
     drmModeDestroyPropertyBlob(fd, out->mode_blob_id);
 out_error:
@@ -481,79 +414,191 @@ out_error:
     return NULL;
 }
 
-static int modeset_prepare(int fd)
+static int modeset_atomic_prepare_commit(int fd, struct modeset_output *out, struct modeset_buf *buf,
+                                         drmModeAtomicReq *req)
 {
-    drmModeRes *res;
-    drmModeConnector *conn;
-    unsigned int i;
-    struct modeset_output *out;
+    struct drm_object *plane = &out->plane;
+
+    if (!out->takeover) {
+        if (set_drm_object_property(req, &out->connector, MODESET_PROP_CRTC_ID, out->crtc.id) < 0)
+            return -1;
 
-    res = drmModeGetResources(fd);
-    if (!res) {
-        fprintf(stderr, "cannot retrieve DRM resources (%d): %m\n", errno);
-        return -errno;
+        if (set_drm_object_property(req, &out->crtc, MODESET_PROP_MODE_ID, out->mode_blob_id) < 0)
+            return -1;
+
+        if (set_drm_object_property(req, &out->crtc, MODESET_PROP_ACTIVE, 1) < 0)
+            return -1;
     }
 
-    for (i = 0; i < res->count_connectors; ++i) {
-        conn = drmModeGetConnector(fd, res->connectors[i]);
-        if (!conn) {
-            fprintf(stderr, "cannot retrieve DRM connector %u:%u (%d): %m\n", i, res->connectors[i], errno);
+    if (set_drm_object_property(req, plane, MODESET_PROP_FB_ID, buf->fb) < 0)
+        return -1;
+    if (set_drm_object_property(req, plane, MODESET_PROP_CRTC_ID, out->crtc.id) < 0)
+        return -1;
+    if (set_drm_object_property(req, plane, MODESET_PROP_SRC_X, 0) < 0)
+        return -1;
+    if (set_drm_object_property(req, plane, MODESET_PROP_SRC_Y, 0) < 0)
+        return -1;
+    if (set_drm_object_property(req, plane, MODESET_PROP_SRC_W, buf->width << 16) < 0)
+        return -1;
+    if (set_drm_object_property(req, plane, MODESET_PROP_SRC_H, buf->height << 16) < 0)
+        return -1;
+    if (set_drm_object_property(req, plane, MODESET_PROP_CRTC_X, 0) < 0)
+        return -1;
+    if (set_drm_object_property(req, plane, MODESET_PROP_CRTC_Y, 0) < 0)
+        return -1;
+    if (set_drm_object_property(req, plane, MODESET_PROP_CRTC_W, buf->width) < 0)
+        return -1;
+    if (set_drm_object_property(req, plane, MODESET_PROP_CRTC_H, buf->height) < 0)
+        return -1;
+
+    return 0;
+}
+
+static void modeset_create_outputs(struct modeset_card *card)
+{
+    struct modeset_output *out;
+    unsigned int i;
+
+    for (i = 0; i < card->topo.count_connectors; ++i) {
+        if (card->assign.conn_crtc[i] < 0)
             continue;
-        }
 
-        out = modeset_output_create(fd, res, conn);
-        drmModeFreeConnector(conn);
+        out = modeset_output_create(card, i);
         if (!out)
             continue;
 
         out->next = output_list;
         output_list = out;
     }
-    if (!output_list) {
-        fprintf(stderr, "couldn't create any outputs\n");
-        return -1;
+}
+
+static void modeset_destroy_outputs(struct modeset_card *card)
+{
+    struct modeset_output *out, **link;
+
+    for (link = &output_list; *link;) {
+        out = *link;
+        if (out->card != card) {
+            link = &out->next;
+            continue;
+        }
+        *link = out->next;
+        modeset_output_destroy(card->fd, out);
     }
+}
 
-    drmModeFreeResources(res);
-    return 0;
+/* the output most likely to have broken the configuration: a modeset rather than a takeover, the highest pixel clock */
+static struct modeset_output *modeset_pick_shed(struct modeset_card *card)
+{
+    struct modeset_output *iter, *shed = NULL;
+
+    for (iter = output_list; iter; iter = iter->next) {
+        if (iter->card != card)
+            continue;
+        if (shed && iter->takeover != shed->takeover) {
+            if (iter->takeover)
+                continue;
+        }
+        else if (shed && (iter->mode.clock < shed->mode.clock ||
+                          (iter->mode.clock == shed->mode.clock && iter->conn_index < shed->conn_index))) {
+            continue;
+        }
+        shed = iter;
+    }
+
+    return shed;
 }
 
-static int modeset_atomic_prepare_commit(int fd, struct modeset_output *out, drmModeAtomicReq *req)
+/*
+ * Test the whole card in one commit. When the driver rejects the
+ * combination (EINVAL, or ERANGE for bandwidth and clocks), shed one
+ * connector and solve the assignment again over the rest, which may
+ * route them differently; any other error is not about the combination
+ * and is returned.
+ */
+static int modeset_test_outputs(struct modeset_card *card, uint32_t conn_mask)
 {
-    struct drm_object *plane = &out->plane;
-    struct modeset_buf *buf = &out->bufs[out->front_buf ^ 1];
+    struct modeset_output *iter, *shed, *failed;
+    drmModeAtomicReq *req;
+    unsigned int count;
+    int ret, flags;
 
-    if (set_drm_object_property(req, &out->connector, "CRTC_ID", out->crtc.id) < 0)
-        return -1;
+    flags = DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET;
+    for (;;) {
+        modeset_create_outputs(card);
+
+        req = drmModeAtomicAlloc();
+        count = 0;
+        failed = NULL;
+        for (iter = output_list; iter && !failed; iter = iter->next) {
+            if (iter->card != card)
+                continue;
 
-    if (set_drm_object_property(req, &out->crtc, "MODE_ID", out->mode_blob_id) < 0)
-        return -1;
+            if (modeset_atomic_prepare_commit(card->fd, iter, &iter->sc.bufs[0], req))
+                failed = iter;
+            ++count;
+        }
 
-    if (set_drm_object_property(req, &out->crtc, "ACTIVE", 1) < 0)
-        return -1;
+        if (!count) {
+            drmModeAtomicFree(req);
+            return -ENOENT;
+        }
 
-    if (set_drm_object_property(req, plane, "FB_ID", buf->fb) < 0)
-        return -1;
-    if (set_drm_object_property(req, plane, "CRTC_ID", out->crtc.id) < 0)
-        return -1;
-    if (set_drm_object_property(req, plane, "SRC_X", 0) < 0)
-        return -1;
-    if (set_drm_object_property(req, plane, "SRC_Y", 0) < 0)
-        return -1;
-    if (set_drm_object_property(req, plane, "SRC_W", buf->width << 16) < 0)
-        return -1;
-    if (set_drm_object_property(req, plane, "SRC_H", buf->height << 16) < 0)
-        return -1;
-    if (set_drm_object_property(req, plane, "CRTC_X", 0) < 0)
-        return -1;
-    if (set_drm_object_property(req, plane, "CRTC_Y", 0) < 0)
-        return -1;
-    if (set_drm_object_property(req, plane, "CRTC_W", buf->width) < 0)
-        return -1;
-    if (set_drm_object_property(req, plane, "CRTC_H", buf->height) < 0)
-        return -1;
+        ret = failed ? -EINVAL : drmModeAtomicCommit(card->fd, req, flags, NULL);
+        drmModeAtomicFree(req);
+        if (!ret)
+            return 0;
 
-    return 0;
+        if (ret != -EINVAL && ret != -ERANGE) {
+            fprintf(stderr, "test-only atomic failed with %u outputs (%d)\n", count, ret);
+            modeset_destroy_outputs(card);
+            return ret;
+        }
+
+        shed = failed ? failed : modeset_pick_shed(card);
+        fprintf(stderr, "test-only atomic failed with %u outputs, dropping connector %u\n", count,
+                shed->connector.id);
+        conn_mask &= ~(1u << shed->conn_index);
+        modeset_destroy_outputs(card);
+
+        /* the cached assignment is no longer the one that lights the card */
+        card->cached = false;
+        ret = modeset_assign_solve(&card->topo, conn_mask, &card->assign);
+        if (ret) {
+            fprintf(stderr, "no connector of '%s' can be lit\n", card->node);
+            return ret;
+        }
+    }
+}
+
+static int modeset_prepare(struct modeset_card *card)
+{
+    uint32_t conn_mask = 0;
+    unsigned int i;
+    int ret;
+
+    /* a known device and monitor set skips probing and solving altogether */
+    card->cached = !modeset_cache_load(card->fd, MODESET_CACHE_CAPS, &card->topo, &card->assign);
+    if (!card->cached) {
+        ret = modeset_topo_probe(card->fd, &card->topo);
+        if (ret) {
+            fprintf(stderr, "cannot probe '%s'\n", card->node);
+            return ret;
+        }
+
+        ret = modeset_assign_solve(&card->topo, card->topo.connected_mask, &card->assign);
+        if (ret) {
+            fprintf(stderr, "no connector of '%s' can be lit\n", card->node);
+            return ret;
+        }
+    }
+
+    for (i = 0; i < card->topo.count_connectors; ++i) {
+        if (card->assign.conn_crtc[i] >= 0)
+            conn_mask |= 1u << i;
+    }
+
+    return modeset_test_outputs(card, conn_mask);
 }
 
 static uint8_t next_color(bool *up, uint8_t cur, unsigned int mod)
@@ -568,48 +613,288 @@ static uint8_t next_color(bool *up, uint8_t cur, unsigned int mod)
     return next;
 }
 
-static void modeset_paint_framebuffer(struct modeset_output *out)
+/* repaint one rect of the scene: a static background with the animated box on top */
+static void modeset_paint_rect(struct modeset_output *out, struct modeset_buf *buf,
+                               const struct drm_mode_rect *rect, uint32_t color, bool stream)
+{
+    void (*fill_rect)(struct modeset_buf *, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+    int32_t x1, y1, x2, y2;
+
+    fill_rect = stream ? modeset_stream_fill_rect : modeset_fill_rect;
+
+    x1 = rect->x1 > out->box.x1 ? rect->x1 : out->box.x1;
+    y1 = rect->y1 > out->box.y1 ? rect->y1 : out->box.y1;
+    x2 = rect->x2 < out->box.x2 ? rect->x2 : out->box.x2;
+    y2 = rect->y2 < out->box.y2 ? rect->y2 : out->box.y2;
+
+    if (x1 != rect->x1 || y1 != rect->y1 || x2 != rect->x2 || y2 != rect->y2)
+        fill_rect(buf, rect->x1, rect->y1, rect->x2 - rect->x1, rect->y2 - rect->y1, out->bg);
+    if (x1 < x2 && y1 < y2)
+        fill_rect(buf, x1, y1, x2 - x1, y2 - y1, color);
+}
+
+static void modeset_paint_framebuffer(struct modeset_output *out, int idx)
 {
     struct modeset_buf *buf;
-    unsigned int j, k, off;
+    struct modeset_damage *stale;
+    uint32_t color;
+    unsigned int i;
 
     out->r = next_color(&out->r_up, out->r, 5);
     out->g = next_color(&out->g_up, out->g, 5);
     out->b = next_color(&out->b_up, out->b, 5);
-    buf = &out->bufs[out->front_buf ^ 1];
-    for (j = 0; j < buf->height; ++j) {
-        for (k = 0; k < buf->width; ++k) {
-            off = buf->stride * j + k * 4;
-            *(uint32_t*)&buf->map[off] = (out->r << 16) | (out->g << 8) | out->b;
+    color = (out->r << 16) | (out->g << 8) | out->b;
+    buf = &out->sc.bufs[idx];
+    stale = &out->stale[idx];
+
+    modeset_damage_add(&out->damage, out->box.x1, out->box.y1,
+                       out->box.x2 - out->box.x1, out->box.y2 - out->box.y1);
+    for (i = 0; i < out->sc.count; ++i)
+        modeset_damage_merge(&out->stale[i], &out->damage);
+
+    if (out->shadow.buf.map) {
+        /* the shadow keeps its own per-slot row tracking */
+        for (i = 0; i < out->damage.count; ++i) {
+            modeset_paint_rect(out, &out->shadow.buf, &out->damage.rects[i], color, false);
+            modeset_shadow_damage(&out->shadow, out->damage.rects[i].y1,
+                                  out->damage.rects[i].y2 - out->damage.rects[i].y1);
         }
+        modeset_shadow_flush(&out->shadow, idx, buf, out->stream);
+    }
+    else {
+        for (i = 0; i < stale->count; ++i)
+            modeset_paint_rect(out, buf, &stale->rects[i], color, out->stream);
+        if (out->stream)
+            modeset_stream_fence();
+    }
+
+    modeset_damage_reset(stale);
+    out->frame_damage[idx] = out->damage;
+    if (out->sc.mailbox) {
+        /* the mailbox drops frames, so each one carries all damage since the last flip */
+        modeset_damage_merge(&out->unflipped, &out->damage);
+        out->frame_damage[idx] = out->unflipped;
     }
+    modeset_damage_reset(&out->damage);
 }
 
-static void modeset_draw_out(int fd, struct modeset_output *out)
+/* patch the flip template with buf idx, the pending cursor move and the frame's damage */
+static void modeset_prepare_flip(int fd, struct modeset_output *out, int idx, uint32_t *damage_blob)
 {
-    drmModeAtomicReq *req;
-    int ret, flags;
+    modeset_req_set(&out->flip_req, out->flip_fb_slot, out->sc.bufs[idx].fb);
+
+    /* tell the driver which part of the new buffer changed, where it cares */
+    modeset_req_set_cursor(&out->flip_req, out->flip_cursor);
+    if (out->cursor.dirty)
+        modeset_cursor_add_position(&out->cursor, &out->flip_req);
+    *damage_blob = 0;
+    if (out->plane.prop_ids[MODESET_PROP_FB_DAMAGE_CLIPS] &&
+        !modeset_damage_create_blob(fd, &out->frame_damage[idx], damage_blob))
+        modeset_req_add(&out->flip_req, &out->plane, MODESET_PROP_FB_DAMAGE_CLIPS, *damage_blob);
+}
+
+static void modeset_flip_queued(struct modeset_output *out, int idx)
+{
+    modeset_damage_reset(&out->unflipped);
+    modeset_stats_submit(&out->stats);
+    modeset_swapchain_queue(&out->sc, idx);
+    out->pflip_pending = true;
+}
 
-    modeset_paint_framebuffer(out);
+/* flip to the next finished frame unless a flip is still in flight */
+static void modeset_flip_out(int fd, struct modeset_output *out)
+{
+    struct modeset_buf *buf;
+    uint32_t damage_blob;
+    int idx, ret, flags;
 
-    req = drmModeAtomicAlloc();
-    ret = modeset_atomic_prepare_commit(fd, out, req);
-    if (ret < 0) {
-        fprintf(stderr, "prepare atomic commit failed, %d\n", errno);
+    idx = modeset_swapchain_next(&out->sc);
+    if (idx < 0 || out->pflip_pending)
         return;
-    }
 
+    buf = &out->sc.bufs[idx];
     flags = DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK;
-    ret = drmModeAtomicCommit(fd, req, flags, NULL);
-    drmModeAtomicFree(req);
 
+    /* the async template carries FB_ID only, a cursor move goes out vsynced */
+    if (out->async && !out->cursor.dirty) {
+        modeset_req_set(&out->async_req, out->async_fb_slot, buf->fb);
+        ret = modeset_req_commit(fd, &out->async_req, flags | DRM_MODE_PAGE_FLIP_ASYNC, NULL);
+        if (!ret) {
+            modeset_flip_queued(out, idx);
+            return;
+        }
+        if (errno != EINVAL) {
+            fprintf(stderr, "atomic async commit failed, %d\n", errno);
+            return;
+        }
+        fprintf(stderr, "async flip rejected on connector %u, falling back to vsync\n", out->connector.id);
+        out->async = false;
+    }
+
+    modeset_prepare_flip(fd, out, idx, &damage_blob);
+    ret = modeset_req_commit(fd, &out->flip_req, flags, NULL);
+    if (damage_blob)
+        drmModeDestroyPropertyBlob(fd, damage_blob);
     if (ret < 0) {
         fprintf(stderr, "atomic commit failed, %d\n", errno);
         return;
     }
 
-    out->front_buf ^= 1;
-    out->pflip_pending = true;
+    modeset_flip_queued(out, idx);
+}
+
+/*
+ * Flip every output of a batch in one commit once all of them have a frame
+ * ready and none is still in flight. The kernel sends one event per CRTC, so
+ * the last event of a frame is what triggers the next commit.
+ */
+static void modeset_flip_batch(struct modeset_card *card, int batch)
+{
+    struct modeset_req *req = &card->batch_req;
+    struct modeset_output *iter;
+    uint32_t damage_blob[MODESET_TOPO_MAX_CRTCS];
+    int idx[MODESET_TOPO_MAX_CRTCS];
+    unsigned int i, count = 0;
+    int ret, flags;
+    bool rejected = false;
+
+    for (iter = output_list; iter; iter = iter->next) {
+        if (iter->card != card || iter->batch != batch)
+            continue;
+        if (iter->pflip_pending || iter->cleanup || modeset_swapchain_next(&iter->sc) < 0)
+            return;
+    }
+
+    modeset_req_init(req);
+    ret = 0;
+    for (iter = output_list; iter; iter = iter->next) {
+        if (iter->card != card || iter->batch != batch)
+            continue;
+
+        idx[count] = modeset_swapchain_next(&iter->sc);
+        modeset_prepare_flip(card->fd, iter, idx[count], &damage_blob[count]);
+        ++count;
+        if (!ret)
+            ret = modeset_req_append(req, &iter->flip_req);
+    }
+
+    /* a request that does not fit is this frame's problem, the batch stays */
+    flags = DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK;
+    if (ret < 0) {
+        fprintf(stderr, "cannot build batched commit, %d, flipping crtcs separately this frame\n", -ret);
+    }
+    else if (modeset_req_commit(card->fd, req, flags, NULL) < 0) {
+        ret = -errno;
+        rejected = true;
+        fprintf(stderr, "batched commit failed, %d, flipping crtcs separately\n", -ret);
+    }
+
+    i = 0;
+    for (iter = output_list; iter; iter = iter->next) {
+        if (iter->card != card || iter->batch != batch)
+            continue;
+
+        /* a rejected batch is broken up, every CRTC commits its own template from now on */
+        if (ret < 0) {
+            if (rejected)
+                iter->batch = -1;
+            if (modeset_req_commit(card->fd, &iter->flip_req, flags, NULL) < 0) {
+                fprintf(stderr, "atomic commit failed, %d\n", errno);
+                ++i;
+                continue;
+            }
+        }
+        modeset_flip_queued(iter, idx[i++]);
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (damage_blob[i])
+            drmModeDestroyPropertyBlob(card->fd, damage_blob[i]);
+    }
+}
+
+static void modeset_draw_out(int fd, struct modeset_output *out)
+{
+    int idx;
+
+    /* a frame painted ahead goes out first, then every free buffer is refilled */
+    if (out->batch < 0)
+        modeset_flip_out(fd, out);
+
+    while ((idx = modeset_swapchain_acquire(&out->sc)) >= 0) {
+        modeset_paint_framebuffer(out, idx);
+        modeset_swapchain_submit(&out->sc, idx);
+    }
+
+    if (out->batch < 0)
+        modeset_flip_out(fd, out);
+    else
+        modeset_flip_batch(out->card, out->batch);
+}
+
+/* mailbox outputs paint as fast as they can, flips pick the newest frame */
+static void modeset_render_event(struct modeset_loop *loop, int fd, void *data)
+{
+    struct modeset_output *iter;
+    int idx;
+
+    for (iter = output_list; iter; iter = iter->next) {
+        if (!iter->sc.mailbox || iter->cleanup)
+            continue;
+
+        idx = modeset_swapchain_acquire(&iter->sc);
+        if (idx >= 0) {
+            modeset_paint_framebuffer(iter, idx);
+            modeset_swapchain_submit(&iter->sc, idx);
+        }
+        modeset_flip_out(iter->card->fd, iter);
+    }
+}
+
+/* paint one frame as late as the predicted vblank allows, then flip it */
+static void modeset_deadline_event(struct modeset_loop *loop, int fd, void *data)
+{
+    struct modeset_output *out = data;
+    uint64_t start;
+    int idx;
+
+    if (out->cleanup || out->pflip_pending)
+        return;
+
+    idx = modeset_swapchain_acquire(&out->sc);
+    if (idx < 0)
+        return;
+
+    start = modeset_now_ns();
+    modeset_paint_framebuffer(out, idx);
+    modeset_sched_paint(&out->sched, modeset_now_ns() - start);
+    modeset_swapchain_submit(&out->sc, idx);
+
+    modeset_flip_out(out->card->fd, out);
+}
+
+/* bounce every cursor around its screen; planes move, nothing is repainted */
+static void modeset_cursor_event(struct modeset_loop *loop, int fd, void *data)
+{
+    struct modeset_output *iter;
+    int32_t x, y;
+    bool busy;
+
+    for (iter = output_list; iter; iter = iter->next) {
+        if (!iter->cursor.visible || iter->cleanup)
+            continue;
+
+        x = iter->cursor.x + iter->cursor_dx;
+        y = iter->cursor.y + iter->cursor_dy;
+        if (x < 0 || x >= iter->mode.hdisplay)
+            iter->cursor_dx = -iter->cursor_dx;
+        if (y < 0 || y >= iter->mode.vdisplay)
+            iter->cursor_dy = -iter->cursor_dy;
+
+        /* outputs that are about to flip take the position with the flip */
+        busy = iter->pflip_pending || iter->sc.mailbox || iter->sched_timer >= 0 || iter->batch >= 0;
+        modeset_cursor_move(&iter->cursor, iter->cursor.x + iter->cursor_dx, iter->cursor.y + iter->cursor_dy, busy);
+    }
 }
 
 static void modeset_page_flip_event(int fd, unsigned int frame, unsigned int sec, unsigned int usec, unsigned int crtc_id, void *data)
@@ -618,7 +903,7 @@ static void modeset_page_flip_event(int fd, unsigned int frame, unsigned int sec
 
     out = NULL;
     for (iter = output_list; iter; iter = iter->next) {
-        if (iter->crtc.id == crtc_id) {
+        if (iter->card->fd == fd && iter->crtc.id == crtc_id) {
             out = iter;
             break;
         }
@@ -628,96 +913,236 @@ static void modeset_page_flip_event(int fd, unsigned int frame, unsigned int sec
         return;
 
     out->pflip_pending = false;
-    if (!out->cleanup)
+    modeset_stats_flip(&out->stats, frame, sec, usec);
+    modeset_sched_vblank(&out->sched, sec, usec);
+    modeset_swapchain_flip_done(&out->sc);
+    if (out->cleanup)
+        return;
+
+    if (out->sc.mailbox)
+        modeset_flip_out(fd, out);
+    else if (out->sched_timer >= 0)
+        modeset_loop_arm_timer(&loop, out->sched_timer, modeset_sched_deadline(&out->sched, modeset_now_ns()), 0);
+    else
         modeset_draw_out(fd, out);
 }
 
-static int modeset_perform_modeset(int fd)
+/* commit the outputs that are (or are not) taken over; returns how many, or -errno */
+static int modeset_commit_outputs(struct modeset_card *card, bool takeover, int flags)
 {
-    int ret, flags;
     struct modeset_output *iter;
     drmModeAtomicReq *req;
+    int ret, count = 0;
 
     req = drmModeAtomicAlloc();
+    if (!req)
+        return -ENOMEM;
+
     for (iter = output_list; iter; iter = iter->next) {
-        ret = modeset_atomic_prepare_commit(fd, output_list, req);
-        if (ret < 0)
-            break;
-    }
-    if (ret < 0) {
-        fprintf(stderr, "prepare atomic commit failed, %d\n", errno);
-        return ret;
+        if (iter->card != card || iter->takeover != takeover)
+            continue;
+
+        if (modeset_atomic_prepare_commit(card->fd, iter, &iter->sc.bufs[modeset_swapchain_next(&iter->sc)], req) < 0) {
+            fprintf(stderr, "prepare atomic commit failed for connector %u\n", iter->connector.id);
+            drmModeAtomicFree(req);
+            return -EINVAL;
+        }
+        ++count;
     }
 
-    flags = DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET;
-    ret = drmModeAtomicCommit(fd, req, flags, NULL);
-    if (ret < 0) {
-        fprintf(stderr, "test-only atomic failed, %d\n", errno);
-        drmModeAtomicFree(req);
+    ret = count ? drmModeAtomicCommit(card->fd, req, flags, NULL) : 0;
+    drmModeAtomicFree(req);
+    if (ret < 0)
         return ret;
+    if (flags & DRM_MODE_ATOMIC_TEST_ONLY)
+        return count;
+
+    for (iter = output_list; iter; iter = iter->next) {
+        if (iter->card != card || iter->takeover != takeover)
+            continue;
+
+        modeset_swapchain_queue(&iter->sc, modeset_swapchain_next(&iter->sc));
+        iter->pflip_pending = true;
+
+        if (iter->cursor.buf.fb)
+            modeset_cursor_show(&iter->cursor);
     }
 
+    return count;
+}
+
+static int modeset_perform_modeset(struct modeset_card *card)
+{
+    int idx, ret;
+    struct modeset_output *iter;
+
     for (iter = output_list; iter; iter = iter->next) {
+        if (iter->card != card)
+            continue;
+
         iter->r = rand() % 0xff;
         iter->g = rand() % 0xff;
         iter->b = rand() % 0xff;
         iter->r_up = iter->g_up = iter->b_up = true;
+        iter->bg = (iter->r << 16) | (iter->g << 8) | iter->b;
 
-        modeset_paint_framebuffer(iter);
+        idx = modeset_swapchain_acquire(&iter->sc);
+        modeset_paint_framebuffer(iter, idx);
+        modeset_swapchain_submit(&iter->sc, idx);
+    }
+
+    /*
+     * Takeover CRTCs go out in a commit of their own without ALLOW_MODESET,
+     * so neither the test nor the commit can hand them a modeset on the way;
+     * modeset_test_outputs allowed one for the whole card.
+     */
+    ret = modeset_commit_outputs(card, true, DRM_MODE_ATOMIC_TEST_ONLY);
+    if (ret >= 0)
+        ret = modeset_commit_outputs(card, true, DRM_MODE_PAGE_FLIP_EVENT);
+    if (ret < 0) {
+        fprintf(stderr, "takeover rejected, %d, doing a full modeset\n", -ret);
+        for (iter = output_list; iter; iter = iter->next) {
+            if (iter->card == card)
+                iter->takeover = false;
+        }
+    }
+    else if (ret) {
+        fprintf(stderr, "taking over active crtcs on %s\n", card->node);
     }
 
-    flags = DRM_MODE_ATOMIC_ALLOW_MODESET | DRM_MODE_PAGE_FLIP_EVENT;
-    ret = drmModeAtomicCommit(fd, req, flags, NULL);
+    /* one request per device, a commit cannot span file descriptors */
+    ret = modeset_commit_outputs(card, false, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_ALLOW_MODESET);
     if (ret < 0)
-        fprintf(stderr, "modeset aomic commit failed, %d\n", errno);
+        fprintf(stderr, "modeset atomic commit failed, %d\n", -ret);
 
-    drmModeAtomicFree(req);
+    return ret < 0 ? ret : 0;
+}
 
-    return ret;
+static void modeset_drm_event(struct modeset_loop *loop, int fd, void *data)
+{
+    drmHandleEvent(fd, data);
 }
 
-static void modeset_draw(int fd)
+static void modeset_stdin_event(struct modeset_loop *loop, int fd, void *data)
 {
-    int ret;
-    fd_set fds;
-    time_t start, cur;
-    struct timeval v;
-    drmEventContext ev;
+    fprintf(stderr, "exit due to user-input\n");
+    modeset_loop_quit(loop);
+}
+
+static void modeset_quit_event(struct modeset_loop *loop, int fd, void *data)
+{
+    modeset_loop_quit(loop);
+}
+
+/*
+ * Group vsynced outputs of a card by refresh period: CRTCs scanning out at
+ * the same rate flip together, one at a different rate would stall the rest
+ * of its batch and keeps committing on its own. Async, mailbox and deadline
+ * outputs pace themselves and never join a batch.
+ */
+static void modeset_setup_batches(void)
+{
+    struct modeset_output *iter, *other;
+    uint64_t period, diff;
+
+    for (iter = output_list; iter; iter = iter->next) {
+        if (iter->async || iter->sc.mailbox || iter->sched_timer >= 0)
+            continue;
+
+        period = iter->sched.period_ns;
+        for (other = output_list; other != iter; other = other->next) {
+            if (other->card != iter->card || other->async || other->sc.mailbox || other->sched_timer >= 0)
+                continue;
+
+            diff = period > other->sched.period_ns ? period - other->sched.period_ns : other->sched.period_ns - period;
+            if (diff <= period / 2000) {
+                if (other->batch < 0)
+                    other->batch = other->conn_index;
+                iter->batch = other->batch;
+                break;
+            }
+        }
+    }
+
+    for (iter = output_list; iter; iter = iter->next) {
+        if (iter->batch >= 0)
+            fprintf(stderr, "connector %u flips in batch %d\n", iter->connector.id, iter->batch);
+    }
+}
 
-    srand(time(&start));
-    FD_ZERO(&fds);
-    memset(&v, 0, sizeof(v));
-    memset(&ev, 0 ,sizeof(ev));
+static void modeset_draw(void)
+{
+    struct modeset_output *iter;
+    drmEventContext ev;
+    unsigned int i;
+    int timer, cursor_timer;
 
+    srand(time(NULL));
+    memset(&ev, 0, sizeof(ev));
     ev.version = 3;
     ev.page_flip_handler2 = modeset_page_flip_event;
 
-    modeset_perform_modeset(fd);
+    if (modeset_loop_init(&loop))
+        return;
 
-    while (time(&cur) < start + 5) {
-        FD_SET(0, &fds);
-        FD_SET(fd, &fds);
-        v.tv_sec = start + 5 - cur;
+    for (i = 0; i < count_cards; ++i)
+        modeset_loop_add_fd(&loop, cards[i].fd, modeset_drm_event, &ev);
+    modeset_loop_add_fd(&loop, 0, modeset_stdin_event, NULL);
+    modeset_loop_add_signal(&loop, SIGINT, modeset_quit_event, NULL);
+    modeset_loop_add_signal(&loop, SIGTERM, modeset_quit_event, NULL);
+    timer = modeset_loop_add_timer(&loop, modeset_quit_event, NULL);
+    if (timer >= 0)
+        modeset_loop_arm_timer(&loop, timer, modeset_now_ns() + 5000000000ull, 0);
 
-        ret = select(fd + 1, &fds, NULL, NULL, &v);
-        if (ret < 0) {
-            fprintf(stderr, "select() failed with %d: %m\n", errno);
-            break;
-        }
-        else if (FD_ISSET(0, &fds)) {
-            fprintf(stderr, "exit due to user-input\n");
-            break;
-        }
-        else if (FD_ISSET(fd, &fds)) {
-            drmHandleEvent(fd, &ev);
-        }
+    cursor_timer = -1;
+    for (iter = output_list; iter; iter = iter->next) {
+        if (iter->sc.mailbox)
+            modeset_loop_set_idle(&loop, modeset_render_event, NULL);
+        else if (modeset_env_match("MODESET_DEADLINE", iter->connector.id))
+            iter->sched_timer = modeset_loop_add_timer(&loop, modeset_deadline_event, iter);
+
+        if (iter->cursor.buf.fb && cursor_timer < 0)
+            cursor_timer = modeset_loop_add_timer(&loop, modeset_cursor_event, NULL);
+    }
+    if (cursor_timer >= 0)
+        modeset_loop_arm_timer(&loop, cursor_timer, modeset_now_ns() + 4000000, 4000000);
+
+    modeset_setup_batches();
+
+    for (i = 0; i < count_cards; ++i) {
+        if (!modeset_perform_modeset(&cards[i]) && !cards[i].cached)
+            modeset_cache_store(cards[i].fd, MODESET_CACHE_CAPS, &cards[i].topo, &cards[i].assign);
+    }
+
+    modeset_loop_run(&loop);
+    modeset_loop_fini(&loop);
+}
+
+static void modeset_report_stats(void)
+{
+    struct modeset_stats *stats[16];
+    struct modeset_output *iter;
+    const char *path;
+    unsigned int count = 0;
+
+    for (iter = output_list; iter; iter = iter->next) {
+        modeset_stats_print(&iter->stats);
+        if (iter->sched_timer >= 0)
+            modeset_sched_print(&iter->sched, iter->crtc.id);
+        if (count < 16)
+            stats[count++] = &iter->stats;
     }
+
+    path = getenv("MODESET_STATS_JSON");
+    if (path)
+        modeset_stats_write_json(path, stats, count);
 }
 
-static void modeset_cleanup(int fd)
+static void modeset_cleanup(void)
 {
     struct modeset_output *iter;
     drmEventContext ev;
+    unsigned int i;
     int ret;
 
     memset(&ev, 0, sizeof(ev));
@@ -730,45 +1155,101 @@ static void modeset_cleanup(int fd)
         iter->cleanup = true;
         fprintf(stderr, "wait for pending page-flip to complete...\n");
         while (iter->pflip_pending) {
-            ret = drmHandleEvent(fd, &ev);
+            ret = drmHandleEvent(iter->card->fd, &ev);
             if (ret)
                 break;
         }
 
         output_list = iter->next;
 
-        modeset_output_destroy(fd, iter);
+        modeset_output_destroy(iter->card->fd, iter);
     }
+
+    for (i = 0; i < count_cards; ++i)
+        modeset_pool_fini(&cards[i].pool);
 }
 
-int main(int argc, char **argv)
+static int modeset_add_card(const char *node)
 {
-    int ret, fd;
-    const char *card;
-
-    if (argc > 1)
-        card = argv[1];
-    else
-        card = "/dev/dri/card0";
+    struct modeset_card *card;
+    uint64_t cap;
+    int ret;
 
-    fprintf(stderr, "using card '%s'\n", card);
+    if (count_cards == MODESET_MAX_CARDS)
+        return -ENOSPC;
 
-    ret = modeset_open(&fd, card);
+    card = &cards[count_cards];
+    ret = modeset_open(&card->fd, node);
     if (ret)
+        return ret;
+
+    if (drmGetCap(card->fd, DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP, &cap) == 0)
+        card->async = cap;
+
+    fprintf(stderr, "using card '%s'\n", node);
+    snprintf(card->node, sizeof(card->node), "%s", node);
+    modeset_pool_init(&card->pool, card->fd);
+    ++count_cards;
+
+    return 0;
+}
+
+/* every primary node; render-only GPUs drop out in modeset_open */
+static void modeset_add_all_cards(void)
+{
+    drmDevicePtr devices[MODESET_MAX_CARDS];
+    int i, count;
+
+    count = drmGetDevices2(0, devices, MODESET_MAX_CARDS);
+    if (count <= 0) {
+        modeset_add_card("/dev/dri/card0");
+        return;
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (devices[i]->available_nodes & (1 << DRM_NODE_PRIMARY))
+            modeset_add_card(devices[i]->nodes[DRM_NODE_PRIMARY]);
+    }
+
+    drmFreeDevices(devices, count);
+}
+
+int main(int argc, char **argv)
+{
+    int i, ret;
+
+    if (argc > 1) {
+        for (i = 1; i < argc; ++i)
+            modeset_add_card(argv[i]);
+    }
+    else {
+        modeset_add_all_cards();
+    }
+
+    if (!count_cards) {
+        ret = -ENODEV;
         goto out_return;
+    }
 
-    ret = modeset_prepare(fd);
-    if (ret)
+    for (i = 0; i < count_cards; ++i)
+        modeset_prepare(&cards[i]);
+
+    if (!output_list) {
+        fprintf(stderr, "couldn't create any outputs\n");
+        ret = -ENOENT;
         goto out_close;
+    }
 
-    modeset_draw(fd);
+    modeset_draw();
 
-    modeset_cleanup(fd);
+    modeset_report_stats();
+    modeset_cleanup();
 
     ret = 0;
 
 out_close:
-    close(fd);
+    for (i = 0; i < count_cards; ++i)
+        close(cards[i].fd);
 out_return:
     if (ret) {
         errno = -ret;
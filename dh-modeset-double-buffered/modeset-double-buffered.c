@@ -5,18 +5,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
-struct modeset_buf;
+#include "modeset-bringup.h"
+#include "modeset-buf.h"
+#include "modeset-fill.h"
+#include "modeset-topo.h"
+#include "modeset-util.h"
+
 struct modeset_dev;
 
 static int modeset_find_crtc(int fd, drmModeRes *res, drmModeConnector *conn, struct modeset_dev *dev);
-static int modeset_create_fb(int fd, struct modeset_buf *buf);
-static void modeset_destroy_fb(int fd, struct modeset_buf *buf);
 static int modeset_setup_dev(int fd, drmModeRes *res, drmModeConnector *conn, struct modeset_dev *dev);
 static int modeset_open(int *out, const char *node);
 static int modeset_prepare(int fd);
@@ -45,16 +47,6 @@ static int modeset_open(int *out, const char *node)
     return 0;
 }
 
-struct modeset_buf {
-    uint32_t width;
-    uint32_t height;
-    uint32_t stride;
-    uint32_t size;
-    uint32_t handle;
-    uint8_t *map;
-    uint32_t fb;
-};
-
 struct modeset_dev {
     struct modeset_dev *next;
 
@@ -68,6 +60,9 @@ struct modeset_dev {
 };
 
 static struct modeset_dev *modeset_list = NULL;
+static struct modeset_pool modeset_pool;
+static struct modeset_bringup *modeset_outputs;
+static unsigned int modeset_count_outputs;
 
 static int modeset_prepare(int fd)
 {
@@ -75,6 +70,7 @@ static int modeset_prepare(int fd)
     drmModeConnector *conn;
     unsigned int i;
     struct modeset_dev *dev;
+    unsigned int flags = modeset_topo_probe_env();
     int ret;
 
     res = drmModeGetResources(fd);
@@ -83,8 +79,14 @@ static int modeset_prepare(int fd)
         return -errno;
     }
 
+    modeset_outputs = calloc(res->count_connectors ? res->count_connectors : 1, sizeof(*modeset_outputs));
+    if (!modeset_outputs) {
+        drmModeFreeResources(res);
+        return -ENOMEM;
+    }
+
     for (i = 0; i < res->count_connectors; ++i) {
-        conn = drmModeGetConnector(fd, res->connectors[i]);
+        conn = modeset_topo_get_connector(fd, res->connectors[i], flags);
         if (!conn) {
             fprintf(stderr, "cannot retrieve DRM connector %u:%u (%d): %m\n", i, res->connectors[i], errno);
             continue;
@@ -108,6 +110,9 @@ static int modeset_prepare(int fd)
         drmModeFreeConnector(conn);
         dev->next = modeset_list;
         modeset_list = dev;
+
+        dev->saved_crtc = drmModeGetCrtc(fd, dev->crtc);
+        modeset_bringup_set(&modeset_outputs[modeset_count_outputs++], dev->conn, dev->crtc, &dev->bufs[dev->front_buf], &dev->mode);
     }
 
     drmModeFreeResources(res);
@@ -141,16 +146,16 @@ static int modeset_setup_dev(int fd, drmModeRes *res, drmModeConnector *conn, st
         return ret;
     }
 
-    ret = modeset_create_fb(fd, &dev->bufs[0]);
+    ret = modeset_pool_get(&modeset_pool, &dev->bufs[0]);
     if (ret) {
         fprintf(stderr, "cannot create framebuffer for connector %u\n", conn->connector_id);
         return ret;
     }
 
-    ret = modeset_create_fb(fd, &dev->bufs[1]);
+    ret = modeset_pool_get(&modeset_pool, &dev->bufs[1]);
     if (ret) {
         fprintf(stderr, "cannot create framebuffer for connector %u\n", conn->connector_id);
-        modeset_destroy_fb(fd, &dev->bufs[0]);
+        modeset_pool_put(&modeset_pool, &dev->bufs[0]);
         return ret;
     }
 
@@ -220,81 +225,11 @@ static int modeset_find_crtc(int fd, drmModeRes *res, drmModeConnector *conn, st
     return -ENOENT;
 }
 
-static int modeset_create_fb(int fd, struct modeset_buf *buf)
-{
-    struct drm_mode_create_dumb creq;
-    struct drm_mode_destroy_dumb dreq;
-    struct drm_mode_map_dumb mreq;
-    int ret;
-
-    memset(&creq, 0, sizeof(creq));
-    creq.width = buf->width;
-    creq.height = buf->height;
-    creq.bpp = 32;
-    ret = drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
-    if (ret < 0) {
-        fprintf(stderr, "cannot create dumb buffer (%d): %m\n", errno);
-        return -errno;
-    }
-    buf->stride = creq.pitch;
-    buf->size = creq.size;
-    buf->handle = creq.handle;
-
-    ret = drmModeAddFB(fd, buf->width, buf->height, 24, 32, buf->stride, buf->handle, &buf->fb);
-    if (ret) {
-        fprintf(stderr, "cannot create framebuffer (%d): %m\n", errno);
-        ret = -errno;
-        goto err_destroy;
-    }
-
-    memset(&mreq, 0, sizeof(mreq));
-    mreq.handle = buf->handle;
-    ret = drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
-    if (ret) {
-        fprintf(stderr, "cannot map dumb buffer (%d): %m\n", errno);
-        ret = -errno;
-        goto err_fb;
-    }
-
-    buf->map = mmap(0, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mreq.offset);
-    if (buf->map == MAP_FAILED) {
-        fprintf(stderr, "cannot mmap dumb buffer (%d): %m\n", errno);
-        ret = -errno;
-        goto err_fb;
-    }
-
-    memset(buf->map, 0, buf->size);
-
-    return 0;
-
-err_fb:
-    drmModeRmFB(fd, buf->fb);
-err_destroy:
-    memset(&dreq, 0, sizeof(dreq));
-    dreq.handle = buf->handle;
-    drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
-    return ret;
-}
-
-static void modeset_destroy_fb(int fd, struct modeset_buf *buf)
-{
-    struct drm_mode_destroy_dumb dreq;
-
-    munmap(buf->map, buf->size);
-
-    drmModeRmFB(fd, buf->fb);
-
-    memset(&dreq, 0, sizeof(dreq));
-    dreq.handle = buf->handle;
-    drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
-}
-
 int main(int argc, char **argv)
 {
     int ret, fd;
     const char *card;
-    struct modeset_dev *iter;
-    struct modeset_buf *buf;
+    uint64_t start;
 
     if (argc > 1)
         card = argv[1];
@@ -303,21 +238,24 @@ int main(int argc, char **argv)
 
     fprintf(stderr, "using card '%s'\n", card);
 
+    start = modeset_now_ns();
     ret = modeset_open(&fd, card);
     if (ret)
         goto out_return;
 
+    modeset_pool_init(&modeset_pool, fd);
+
     ret = modeset_prepare(fd);
     if (ret)
         goto out_close;
 
-    for (iter = modeset_list; iter; iter = iter->next) {
-        iter->saved_crtc = drmModeGetCrtc(fd, iter->crtc);
-        buf = &iter->bufs[iter->front_buf];
-        ret = drmModeSetCrtc(fd, iter->crtc, buf->fb, 0, 0, &iter->conn, 1, &iter->mode);
-        if (ret)
-            fprintf(stderr, "cannot set CRTC for connector %u (%d): %m\n", iter->conn, errno);
+    /* every output comes up in one go, the first frame is on screen on return */
+    ret = modeset_bringup_report(fd, modeset_outputs, modeset_count_outputs);
+    if (ret) {
+        modeset_cleanup(fd);
+        goto out_close;
     }
+    fprintf(stderr, "open to first frame: %.3f ms\n", (modeset_now_ns() - start) / 1e6);
 
     modeset_draw(fd);
 
@@ -354,7 +292,7 @@ static void modeset_draw(int fd)
 {
     uint8_t r, g, b;
     bool r_up, g_up, b_up;
-    unsigned int i, j, k, off;
+    unsigned int i;
     struct modeset_dev *iter;
     struct modeset_buf *buf;
     int ret;
@@ -372,12 +310,7 @@ static void modeset_draw(int fd)
 
         for (iter = modeset_list; iter; iter = iter->next) {
             buf = &iter->bufs[iter->front_buf ^ 1];
-            for (j = 0; j < buf->height; ++j) {
-                for (k = 0; k < buf->width; ++k) {
-                    off = buf->stride * j + k * 4;
-                    *(uint32_t *)&buf->map[off] = (r << 16) | (g << 8) | b;
-                }
-            }
+            modeset_fill(buf, (r << 16) | (g << 8) | b);
 
             ret = drmModeSetCrtc(fd, iter->crtc, buf->fb, 0, 0, &iter->conn, 1, &iter->mode);
             if (ret)
@@ -402,9 +335,12 @@ static void modeset_cleanup(int fd)
                        iter->saved_crtc->y, &iter->conn, 1, &iter->saved_crtc->mode);
         drmModeFreeCrtc(iter->saved_crtc);
 
-        modeset_destroy_fb(fd, &iter->bufs[1]);
-        modeset_destroy_fb(fd, &iter->bufs[0]);
+        modeset_pool_put(&modeset_pool, &iter->bufs[1]);
+        modeset_pool_put(&modeset_pool, &iter->bufs[0]);
 
         free(iter);
     }
+
+    free(modeset_outputs);
+    modeset_pool_fini(&modeset_pool);
 }
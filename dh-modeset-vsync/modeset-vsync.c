@@ -7,20 +7,30 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <time.h>
 
-struct modeset_buf;
+#include "modeset-assign.h"
+#include "modeset-bringup.h"
+#include "modeset-buf.h"
+#include "modeset-cache.h"
+#include "modeset-fill.h"
+#include "modeset-loop.h"
+#include "modeset-shadow.h"
+#include "modeset-stats.h"
+#include "modeset-swapchain.h"
+#include "modeset-topo.h"
+#include "modeset-util.h"
+
 struct modeset_dev;
-static int modeset_find_crtc(int fd, drmModeRes *res, drmModeConnector *conn, struct modeset_dev *dev);
-static int modeset_create_fb(int fb, struct modeset_buf *buf);
-static void modeset_destroy_fb(int fd, struct modeset_buf *buf);
-static int modeset_setup_dev(int fd, drmModeRes *res, drmModeConnector *conn, struct modeset_dev *dev);
+static int modeset_find_crtc(const struct modeset_topo_connector *conn, struct modeset_dev *dev);
+static int modeset_setup_dev(const struct modeset_topo_connector *conn, struct modeset_dev *dev);
 static int modeset_open(int *out, const char *name);
 static int modeset_prepare(int fd);
 static void modeset_draw(int fd);
 static void modeset_draw_dev(int fd, struct modeset_dev *dev);
+static void modeset_report_stats(void);
 static void modeset_cleanup(int fd);
 
 static int modeset_open(int *out, const char *node)
@@ -45,264 +55,170 @@ static int modeset_open(int *out, const char *node)
     return 0;
 }
 
-struct modeset_buf {
-    uint32_t width;
-    uint32_t height;
-    uint32_t stride;
-    uint32_t size;
-    uint32_t handle;
-    uint8_t *map;
-    uint32_t fb;
-};
-
 struct modeset_dev {
     struct modeset_dev *next;
 
-    unsigned int front_buf;
-    struct modeset_buf bufs[2];
+    struct modeset_swapchain sc;
+    struct modeset_shadow shadow;
 
     drmModeModeInfo mode;
     uint32_t conn;
     uint32_t crtc;
+    uint32_t crtc_index;
     drmModeCrtc *saved_crtc;
 
+    struct modeset_stats stats;
+
     bool pflip_pending;
     bool cleanup;
+    bool stream;
+    bool async;
 
     uint8_t r, g, b;
     bool r_up, g_up, b_up;
 };
 
 static struct modeset_dev *modeset_list = NULL;
+static struct modeset_pool modeset_pool;
+static struct modeset_topo modeset_topo;
+static struct modeset_assign modeset_assign;
+static bool modeset_cached;
+static struct modeset_bringup *modeset_outputs;
+static unsigned int modeset_count_outputs;
 
 static int modeset_prepare(int fd)
 {
-    drmModeRes *res;
-    drmModeConnector *conn;
+    const struct modeset_topo_connector *conn;
     unsigned int i;
     struct modeset_dev *dev;
-    int ret;
+    uint64_t has_async = 0;
+    int ret, idx;
 
-    res = drmModeGetResources(fd);
-    if (!res) {
-        fprintf(stderr, "cannot retrieve DRM resources (%d): %m\n", errno);
-        return -errno;
-    }
+    drmGetCap(fd, DRM_CAP_ASYNC_PAGE_FLIP, &has_async);
 
-    for (i = 0; i < res->count_connectors; ++i) {
-        conn = drmModeGetConnector(fd, res->connectors[i]);
-        if (!conn) {
-            fprintf(stderr, "cannot retrieve DRM connector %u:%u (%d): %m\n", i, res->connectors[i], errno);
-            continue;
+    modeset_cached = !modeset_cache_load(fd, 0, &modeset_topo, &modeset_assign);
+    if (!modeset_cached) {
+        ret = modeset_topo_probe(fd, &modeset_topo);
+        if (ret)
+            return ret;
+
+        /* without universal planes the solver only has to match CRTCs */
+        ret = modeset_assign_solve(&modeset_topo, modeset_topo.connected_mask, &modeset_assign);
+        if (ret) {
+            fprintf(stderr, "no connector can be lit\n");
+            return ret;
         }
+    }
+
+    modeset_outputs = calloc(modeset_topo.count_connectors ? modeset_topo.count_connectors : 1,
+                             sizeof(*modeset_outputs));
+    if (!modeset_outputs)
+        return -ENOMEM;
+
+    for (i = 0; i < modeset_topo.count_connectors; ++i) {
+        conn = &modeset_topo.connectors[i];
 
         dev = malloc(sizeof(*dev));
         memset(dev, 0, sizeof(*dev));
-        dev->conn = conn->connector_id;
+        dev->conn = conn->obj.id;
+        dev->stream = modeset_stream_enabled(conn->obj.id);
+
+        /* immediate flips trade tearing for latency, only on request */
+        if (modeset_env_match("MODESET_ASYNC", conn->obj.id)) {
+            dev->async = has_async;
+            if (!has_async)
+                fprintf(stderr, "no async page flips on this device, connector %u stays vsynced\n", conn->obj.id);
+        }
 
-        ret = modeset_setup_dev(fd, res, conn, dev);
+        ret = modeset_setup_dev(conn, dev);
         if (ret) {
             if (ret != -ENOENT) {
                 errno = -ret;
-                fprintf(stderr, "cannot setup device for connector %u:%u (%d): %m\n", i, res->connectors[i], errno);
+                fprintf(stderr, "cannot setup device for connector %u:%u (%d): %m\n", i, conn->obj.id, errno);
             }
             free(dev);
-            drmModeFreeConnector(conn);
             continue;
         }
 
-        drmModeFreeConnector(conn);
         dev->next = modeset_list;
         modeset_list = dev;
+
+        dev->saved_crtc = drmModeGetCrtc(fd, dev->crtc);
+        idx = modeset_swapchain_acquire(&dev->sc);
+        modeset_bringup_set(&modeset_outputs[modeset_count_outputs++], dev->conn, dev->crtc, &dev->sc.bufs[idx],
+                            &dev->mode);
+
+        /* the bring-up commit is synchronous and nothing runs if it fails, the buffer is the front one */
+        modeset_swapchain_queue(&dev->sc, idx);
+        modeset_swapchain_flip_done(&dev->sc);
     }
 
-    drmModeFreeResources(res);
     return 0;
 }
 
-static int modeset_setup_dev(int fd, drmModeRes *res, drmModeConnector *conn, struct modeset_dev *dev)
+static int modeset_setup_dev(const struct modeset_topo_connector *conn, struct modeset_dev *dev)
 {
     int ret;
 
     if (conn->connection != DRM_MODE_CONNECTED) {
-        fprintf(stderr, "ignoring unused connector %u\n", conn->connector_id);
+        fprintf(stderr, "ignoring unused connector %u\n", conn->obj.id);
         return -ENOENT;
     }
 
     if (conn->count_modes == 0) {
-        fprintf(stderr, "no valid mode for connector %u\n", conn->connector_id);
+        fprintf(stderr, "no valid mode for connector %u\n", conn->obj.id);
         return -EFAULT;
     }
 
-    memcpy(&dev->mode, &conn->modes[0], sizeof(dev->mode));
-    dev->bufs[0].width = conn->modes[0].hdisplay;
-    dev->bufs[0].height = conn->modes[0].vdisplay;
-    dev->bufs[1].width = conn->modes[0].hdisplay;
-    dev->bufs[1].height = conn->modes[0].vdisplay;
-    fprintf(stderr, "mode for connector %u is %ux%u\n", conn->connector_id, dev->bufs[0].width, dev->bufs[0].height);
-
-    ret = modeset_find_crtc(fd, res, conn, dev);
-    if (ret) {
-        fprintf(stderr, "no valid crtc for connector %u\n", conn->connector_id);
-        return ret;
-    }
+    memcpy(&dev->mode, &conn->mode, sizeof(dev->mode));
+    fprintf(stderr, "mode for connector %u is %ux%u\n", conn->obj.id, dev->mode.hdisplay, dev->mode.vdisplay);
 
-    ret = modeset_create_fb(fd, &dev->bufs[0]);
+    ret = modeset_find_crtc(conn, dev);
     if (ret) {
-        fprintf(stderr, "cannot create framebuffer for connector %u\n", conn->connector_id);
+        fprintf(stderr, "no valid crtc for connector %u\n", conn->obj.id);
         return ret;
     }
 
-    ret = modeset_create_fb(fd, &dev->bufs[1]);
+    ret = modeset_swapchain_init(&dev->sc, &modeset_pool, dev->mode.hdisplay, dev->mode.vdisplay,
+                                 modeset_swapchain_count());
     if (ret) {
-        fprintf(stderr, "cannot create framebuffer for connector %u\n", conn->connector_id);
-        modeset_destroy_fb(fd, &dev->bufs[0]);
+        fprintf(stderr, "cannot create framebuffer for connector %u\n", conn->obj.id);
         return ret;
     }
 
-    return 0;
-}
-
-static int modeset_find_crtc(int fd, drmModeRes *res, drmModeConnector *conn, struct modeset_dev *dev)
-{
-    drmModeEncoder *enc;
-    unsigned int i, j;
-    int32_t crtc;
-    struct modeset_dev *iter;
-
-    if (conn->encoder_id)
-        enc = drmModeGetEncoder(fd, conn->encoder_id);
-    else
-        enc = NULL;
-
-    if (enc) {
-        if (enc->crtc_id) {
-            crtc = enc->crtc_id;
-            for (iter = modeset_list; iter; iter = iter->next) {
-                if (iter->crtc == crtc) {
-                    crtc = -1;
-                    break;
-                }
-            }
-
-            if (crtc >= 0) {
-                drmModeFreeEncoder(enc);
-                dev->crtc = crtc;
-                return 0;
-            }
+    if (modeset_shadow_enabled(conn->obj.id)) {
+        ret = modeset_shadow_init(&dev->shadow, dev->mode.hdisplay, dev->mode.vdisplay);
+        if (ret) {
+            fprintf(stderr, "cannot allocate shadow buffer for connector %u\n", conn->obj.id);
+            modeset_swapchain_fini(&dev->sc, &modeset_pool);
+            return ret;
         }
-
-        drmModeFreeEncoder(enc);
     }
 
-    for (i = 0; i < conn->count_encoders; ++i) {
-        enc = drmModeGetEncoder(fd, conn->encoders[i]);
-        if (!enc) {
-            fprintf(stderr, "cannot retrieve encoder %u:%u (%d): %m\n", i, conn->encoders[i], errno);
-            continue;
-        }
-
-        for (j = 0; j < res->count_crtcs; ++j) {
-            if (!(enc->possible_crtcs & (1 << j)))
-                continue;
-
-            crtc = res->crtcs[j];
-            for (iter = modeset_list; iter; iter = iter->next) {
-                if (iter->crtc == crtc) {
-                    crtc = -1;
-                    break;
-                }
-            }
+    modeset_stats_init(&dev->stats, dev->crtc, modeset_mode_period_ns(&dev->mode));
 
-            if (crtc >= 0) {
-                drmModeFreeEncoder(enc);
-                dev->crtc = crtc;
-                return 0;
-            }
-        }
-
-        drmModeFreeEncoder(enc);
-    }
-
-    fprintf(stderr, "cannot find suitable CRTC for connector %u\n", conn->connector_id);
-    return -ENOENT;
+    return 0;
 }
 
-static int modeset_create_fb(int fd, struct modeset_buf *buf)
+static int modeset_find_crtc(const struct modeset_topo_connector *conn, struct modeset_dev *dev)
 {
-    struct drm_mode_create_dumb creq;
-    struct drm_mode_destroy_dumb dreq;
-    struct drm_mode_map_dumb mreq;
-    int ret;
+    int crtc = modeset_assign.conn_crtc[conn - modeset_topo.connectors];
 
-    memset(&creq, 0, sizeof(creq));
-    creq.width = buf->width;
-    creq.height = buf->height;
-    creq.bpp = 32;
-    ret = drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
-    if (ret < 0) {
-        fprintf(stderr, "cannot create dumb buffer (%d): %m\n", errno);
-        return -errno;
-    }
-    buf->stride = creq.pitch;
-    buf->size = creq.size;
-    buf->handle = creq.handle;
-
-    ret = drmModeAddFB(fd, buf->width, buf->height, 24, 32, buf->stride, buf->handle, &buf->fb);
-    if (ret) {
-        fprintf(stderr, "cannot create framebuffer (%d): %m\n", errno);
-        ret = -errno;
-        goto err_destroy;
-    }
-
-    memset(&mreq, 0, sizeof(mreq));
-    mreq.handle = buf->handle;
-    ret = drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
-    if (ret) {
-        fprintf(stderr, "cannot map dumb buffer (%d): %m\n", errno);
-        ret = -errno;
-        goto err_fb;
-    }
-
-    buf->map = mmap(0, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mreq.offset);
-    if (buf->map == MAP_FAILED) {
-        fprintf(stderr, "cannot mmap dumb buffer (%d): %m\n", errno);
-        ret = -errno;
-        goto err_fb;
+    if (crtc < 0) {
+        fprintf(stderr, "cannot find suitable CRTC for connector %u\n", conn->obj.id);
+        return -ENOENT;
     }
 
-    memset(buf->map, 0, buf->size);
-
+    dev->crtc_index = crtc;
+    dev->crtc = modeset_topo.crtcs[crtc].obj.id;
     return 0;
-
-err_fb:
-    drmModeRmFB(fd, buf->fb);
-err_destroy:
-    memset(&dreq, 0, sizeof(dreq));
-    dreq.handle = buf->handle;
-    drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
-    return ret;
-}
-
-static void modeset_destroy_fb(int fd, struct modeset_buf *buf)
-{
-    struct drm_mode_destroy_dumb dreq;
-
-    munmap(buf->map, buf->size);
-
-    drmModeRmFB(fd, buf->size);
-
-    memset(&dreq, 0, sizeof(dreq));
-    dreq.handle = buf->handle;
-    drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
 }
 
 int main(int argc, char **argv)
 {
     int ret, fd;
     const char *card;
-    struct modeset_dev *iter;
-    struct modeset_buf *buf;
+    uint64_t start;
 
     if (argc > 1)
         card = argv[1];
@@ -311,25 +227,31 @@ int main(int argc, char **argv)
 
     fprintf(stderr, "using card '%s'\n", card);
 
+    start = modeset_now_ns();
     ret = modeset_open(&fd, card);
     if (ret)
         goto out_return;
 
+    modeset_pool_init(&modeset_pool, fd);
+
     ret = modeset_prepare(fd);
     if (ret)
         goto out_close;
 
-    for (iter = modeset_list; iter; iter = iter->next) {
-        iter->saved_crtc = drmModeGetCrtc(fd, iter->crtc);
-        buf = &iter->bufs[iter->front_buf];
-        ret = drmModeSetCrtc(fd, iter->crtc, buf->fb, 0, 0, &iter->conn, 1, &iter->mode);
-
-        if (ret)
-            fprintf(stderr, "cannot set CRTC for connecotr %u (%d): %m\n", iter->conn, errno);
+    /* every output comes up in one go, the first frame is on screen on return */
+    ret = modeset_bringup_report(fd, modeset_outputs, modeset_count_outputs);
+    if (ret) {
+        modeset_cleanup(fd);
+        goto out_close;
     }
+    fprintf(stderr, "open to first frame: %.3f ms\n", (modeset_now_ns() - start) / 1e6);
+    /* the snapshot was taken before modeset_bringup enabled atomic, key it as a legacy probe */
+    if (!modeset_cached)
+        modeset_cache_store(fd, 0, &modeset_topo, &modeset_assign);
 
     modeset_draw(fd);
 
+    modeset_report_stats();
     modeset_cleanup(fd);
 
     ret = 0;
@@ -352,26 +274,51 @@ static void modeset_page_flip_event(int fd, unsigned int frame, unsigned int sec
     struct modeset_dev *dev = data;
 
     dev->pflip_pending = false;
+    modeset_stats_flip(&dev->stats, frame, sec, usec);
+    modeset_swapchain_flip_done(&dev->sc);
     if (!dev->cleanup)
         modeset_draw_dev(fd, dev);
 }
 
+static void modeset_drm_event(struct modeset_loop *loop, int fd, void *data)
+{
+    drmHandleEvent(fd, data);
+}
+
+static void modeset_stdin_event(struct modeset_loop *loop, int fd, void *data)
+{
+    fprintf(stderr, "exit due to user-input\n");
+    modeset_loop_quit(loop);
+}
+
+static void modeset_quit_event(struct modeset_loop *loop, int fd, void *data)
+{
+    modeset_loop_quit(loop);
+}
+
 static void modeset_draw(int fd)
 {
-    int ret;
-    fd_set fds;
-    time_t start, cur;
-    struct timeval v;
+    struct modeset_loop loop;
     drmEventContext ev;
     struct modeset_dev *iter;
+    int timer;
 
-    srand(time(&start));
-    FD_ZERO(&fds);
-    memset(&v, 0, sizeof(v));
+    srand(time(NULL));
     memset(&ev, 0, sizeof(ev));
     ev.version = 2;
     ev.page_flip_handler = modeset_page_flip_event;
 
+    if (modeset_loop_init(&loop))
+        return;
+
+    modeset_loop_add_fd(&loop, fd, modeset_drm_event, &ev);
+    modeset_loop_add_fd(&loop, 0, modeset_stdin_event, NULL);
+    modeset_loop_add_signal(&loop, SIGINT, modeset_quit_event, NULL);
+    modeset_loop_add_signal(&loop, SIGTERM, modeset_quit_event, NULL);
+    timer = modeset_loop_add_timer(&loop, modeset_quit_event, NULL);
+    if (timer >= 0)
+        modeset_loop_arm_timer(&loop, timer, modeset_now_ns() + 5000000000ull, 0);
+
     for (iter = modeset_list; iter; iter = iter->next) {
         iter->r = rand() % 0xff;
         iter->g = rand() % 0xff;
@@ -381,24 +328,8 @@ static void modeset_draw(int fd)
         modeset_draw_dev(fd, iter);
     }
 
-    while (time(&cur) < start + 5) {
-        FD_SET(0, &fds);
-        FD_SET(fd, &fds);
-        v.tv_sec = start + 5 - cur;
-
-        ret = select(fd + 1, &fds, NULL, NULL, &v);
-        if (ret < 0) {
-            fprintf(stderr, "select() failed with %d: %m\n", errno);
-            break;
-        }
-        else if (FD_ISSET(0, &fds)) {
-            fprintf(stderr, "exit due to user-input\n");
-            break;
-        }
-        else if (FD_ISSET(fd, &fds)) {
-            drmHandleEvent(fd, &ev);
-        }
-    }
+    modeset_loop_run(&loop);
+    modeset_loop_fini(&loop);
 }
 
 static uint8_t next_color(bool *up, uint8_t cur, unsigned int mod)
@@ -414,34 +345,92 @@ static uint8_t next_color(bool *up, uint8_t cur, unsigned int mod)
     return next;
 }
 
-static void modeset_draw_dev(int fd, struct modeset_dev *dev)
+static void modeset_paint_dev(struct modeset_dev *dev, int idx)
 {
     struct modeset_buf *buf;
-    unsigned int j, k, off;
-    int ret;
+    uint32_t color;
 
     dev->r = next_color(&dev->r_up, dev->r, 20);
     dev->g = next_color(&dev->g_up, dev->g, 10);
     dev->b = next_color(&dev->b_up, dev->b, 5);
+    color = (dev->r << 16) | (dev->g << 8) | dev->b;
 
-    buf = &dev->bufs[dev->front_buf ^ 1];
-    for (j = 0; j < buf->height; ++j) {
-        for (k = 0; k < buf->width; ++k) {
-            off = buf->stride * j + k * 4;
-            *(uint32_t*)&buf->map[off] = (dev->r << 16) | (dev->g << 8) | dev->b;
-        }
+    buf = &dev->sc.bufs[idx];
+    if (dev->shadow.buf.map) {
+        modeset_fill(&dev->shadow.buf, color);
+        modeset_shadow_damage(&dev->shadow, 0, buf->height);
+        modeset_shadow_flush(&dev->shadow, idx, buf, dev->stream);
+    }
+    else if (dev->stream) {
+        modeset_stream_fill(buf, color);
+        modeset_stream_fence();
+    }
+    else {
+        modeset_fill(buf, color);
     }
+}
 
-    ret = drmModePageFlip(fd, dev->crtc, buf->fb, DRM_MODE_PAGE_FLIP_EVENT, dev);
+static void modeset_flip_dev(int fd, struct modeset_dev *dev)
+{
+    int idx, ret = -1;
+
+    idx = modeset_swapchain_next(&dev->sc);
+    if (idx < 0 || dev->pflip_pending)
+        return;
+
+    if (dev->async) {
+        ret = drmModePageFlip(fd, dev->crtc, dev->sc.bufs[idx].fb,
+                              DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_PAGE_FLIP_ASYNC, dev);
+        if (ret && errno == EINVAL) {
+            fprintf(stderr, "async flip rejected on connector %u, falling back to vsync\n", dev->conn);
+            dev->async = false;
+        }
+    }
+    if (!dev->async)
+        ret = drmModePageFlip(fd, dev->crtc, dev->sc.bufs[idx].fb, DRM_MODE_PAGE_FLIP_EVENT, dev);
     if (ret) {
         fprintf(stderr, "cannot flip CRTC for connector %u (%d): %m\n", dev->conn, errno);
     }
     else {
-        dev->front_buf ^= 1;
+        modeset_stats_submit(&dev->stats);
+        modeset_swapchain_queue(&dev->sc, idx);
         dev->pflip_pending = true;
     }
 }
 
+static void modeset_draw_dev(int fd, struct modeset_dev *dev)
+{
+    int idx;
+
+    /* a frame painted ahead goes out first, then every free buffer is refilled */
+    modeset_flip_dev(fd, dev);
+
+    while ((idx = modeset_swapchain_acquire(&dev->sc)) >= 0) {
+        modeset_paint_dev(dev, idx);
+        modeset_swapchain_submit(&dev->sc, idx);
+    }
+
+    modeset_flip_dev(fd, dev);
+}
+
+static void modeset_report_stats(void)
+{
+    struct modeset_stats *stats[16];
+    struct modeset_dev *iter;
+    const char *path;
+    unsigned int count = 0;
+
+    for (iter = modeset_list; iter; iter = iter->next) {
+        modeset_stats_print(&iter->stats);
+        if (count < 16)
+            stats[count++] = &iter->stats;
+    }
+
+    path = getenv("MODESET_STATS_JSON");
+    if (path)
+        modeset_stats_write_json(path, stats, count);
+}
+
 static void modeset_cleanup(int fd)
 {
     struct modeset_dev *iter;
@@ -468,9 +457,12 @@ static void modeset_cleanup(int fd)
             drmModeSetCrtc(fd, iter->saved_crtc->crtc_id, iter->saved_crtc->buffer_id, iter->saved_crtc->x, iter->saved_crtc->y, &iter->conn, 1, &iter->saved_crtc->mode);
         drmModeFreeCrtc(iter->saved_crtc);
 
-        modeset_destroy_fb(fd, &iter->bufs[1]);
-        modeset_destroy_fb(fd, &iter->bufs[0]);
+        modeset_shadow_fini(&iter->shadow);
+        modeset_swapchain_fini(&iter->sc, &modeset_pool);
 
         free(iter);
     }
+
+    free(modeset_outputs);
+    modeset_pool_fini(&modeset_pool);
 }
@@ -5,20 +5,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+#include "modeset-bringup.h"
+#include "modeset-buf.h"
+#include "modeset-damage.h"
+#include "modeset-fill.h"
+#include "modeset-topo.h"
+#include "modeset-util.h"
+
 struct modeset_dev;
 
 static int modeset_find_crtc(int fd, drmModeRes *res, drmModeConnector *conn, struct modeset_dev *dev);
-static int modeset_create_fb(int fd, struct modeset_dev *dev);
 static int modeset_setup_dev(int fd, drmModeRes *res, drmModeConnector *conn, struct modeset_dev *dev);
 static int modeset_open(int *out, const char *node);
 static int modeset_prepare(int fd);
-static void modeset_draw(void);
+static void modeset_draw(int fd);
 static void modeset_cleanup(int fd);
 
 static int modeset_open(int *out, const char *node)
@@ -46,21 +51,20 @@ static int modeset_open(int *out, const char *node)
 struct modeset_dev {
     struct modeset_dev *next;
 
-    uint32_t width;
-    uint32_t height;
-    uint32_t stride;
-    uint32_t size;
-    uint32_t handle;
-    uint8_t *map;
+    struct modeset_buf buf;
+    struct modeset_damage damage;
+    struct drm_mode_rect box;
 
     drmModeModeInfo mode;
-    uint32_t fb;
     uint32_t conn;
     uint32_t crtc;
     drmModeCrtc *saved_crtc;
 };
 
 static struct modeset_dev *modeset_list = NULL;
+static struct modeset_pool modeset_pool;
+static struct modeset_bringup *modeset_outputs;
+static unsigned int modeset_count_outputs;
 
 static int modeset_prepare(int fd)
 {
@@ -68,6 +72,7 @@ static int modeset_prepare(int fd)
     drmModeConnector *conn;
     unsigned int i;
     struct modeset_dev *dev;
+    unsigned int flags = modeset_topo_probe_env();
     int ret;
 
     res = drmModeGetResources(fd);
@@ -76,8 +81,14 @@ static int modeset_prepare(int fd)
         return -errno;
     }
 
+    modeset_outputs = calloc(res->count_connectors ? res->count_connectors : 1, sizeof(*modeset_outputs));
+    if (!modeset_outputs) {
+        drmModeFreeResources(res);
+        return -ENOMEM;
+    }
+
     for (i = 0; i < res->count_connectors; ++i) {
-        conn = drmModeGetConnector(fd, res->connectors[i]);
+        conn = modeset_topo_get_connector(fd, res->connectors[i], flags);
         if (!conn) {
             fprintf(stderr, "cannot retrieve DRM connector %u:%u (%d): %m", i, res->connectors[i], errno);
             continue;
@@ -101,6 +112,9 @@ static int modeset_prepare(int fd)
         drmModeFreeConnector(conn);
         dev->next = modeset_list;
         modeset_list = dev;
+
+        dev->saved_crtc = drmModeGetCrtc(fd, dev->crtc);
+        modeset_bringup_set(&modeset_outputs[modeset_count_outputs++], dev->conn, dev->crtc, &dev->buf, &dev->mode);
     }
 
     drmModeFreeResources(res);
@@ -122,9 +136,9 @@ static int modeset_setup_dev(int fd, drmModeRes *res, drmModeConnector *conn, st
     }
 
     memcpy(&dev->mode, &conn->modes[0], sizeof(dev->mode));
-    dev->width = conn->modes[0].hdisplay;
-    dev->height = conn->modes[0].vdisplay;
-    fprintf(stderr, "mode for connector %u is %ux%u\n", conn->connector_id, dev->width, dev->height);
+    dev->buf.width = conn->modes[0].hdisplay;
+    dev->buf.height = conn->modes[0].vdisplay;
+    fprintf(stderr, "mode for connector %u is %ux%u\n", conn->connector_id, dev->buf.width, dev->buf.height);
 
     ret = modeset_find_crtc(fd, res, conn, dev);
     if (ret) {
@@ -132,12 +146,22 @@ static int modeset_setup_dev(int fd, drmModeRes *res, drmModeConnector *conn, st
         return ret;
     }
 
-    ret = modeset_create_fb(fd, dev);
+    ret = modeset_pool_get(&modeset_pool, &dev->buf);
     if (ret) {
         fprintf(stderr, "cannot create framebuffer for connector %u\n", conn->connector_id);
         return ret;
     }
 
+    /* the first frame covers everything, later ones only the animated box */
+    modeset_damage_add(&dev->damage, 0, 0, dev->buf.width, dev->buf.height);
+    dev->box = dev->damage.rects[0];
+    if (modeset_damage_enabled(conn->connector_id)) {
+        dev->box.x1 = dev->buf.width / 4;
+        dev->box.y1 = dev->buf.height / 4;
+        dev->box.x2 = dev->box.x1 + dev->buf.width / 2;
+        dev->box.y2 = dev->box.y1 + dev->buf.height / 2;
+    }
+
     return 0;
 }
 
@@ -204,66 +228,11 @@ static int modeset_find_crtc(int fd, drmModeRes *res, drmModeConnector *conn, st
     return -ENOENT;
 }
 
-static int modeset_create_fb(int fd, struct modeset_dev *dev)
-{
-    struct drm_mode_create_dumb creq;
-    struct drm_mode_destroy_dumb dreq;
-    struct drm_mode_map_dumb mreq;
-    int ret;
-
-    memset(&creq, 0, sizeof(creq));
-    creq.width = dev->width;
-    creq.height = dev->height;
-    creq.bpp = 32;
-    ret = drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
-    if (ret < 0) {
-        fprintf(stderr, "cannot create dumb buffer (%d): %m\n", errno);
-        return -errno;
-    }
-    dev->stride = creq.pitch;
-    dev->size = creq.size;
-    dev->handle = creq.handle;
-
-    ret = drmModeAddFB(fd, dev->width, dev->height, 24, 32, dev->stride, dev->handle, &dev->fb);
-    if (ret) {
-        fprintf(stderr, "cannot create framebuffer (%d): %m", errno);
-        ret = -errno;
-        goto err_destroy;
-    }
-
-    memset(&mreq, 0, sizeof(mreq));
-    mreq.handle = dev->handle;
-    ret = drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
-    if (ret) {
-        fprintf(stderr, "cannot map dumb buffer (%d): %m", errno);
-        ret = -errno;
-        goto err_fb;
-    }
-
-    dev->map = mmap(0, dev->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mreq.offset);
-    if (dev->map == MAP_FAILED) {
-        fprintf(stderr, "cannot mmap dumb buffer (%d): %m\n", errno);
-        ret = -errno;
-        goto err_fb;
-    }
-
-    memset(dev->map, 0, dev->size);
-    return 0;
-
-err_fb:
-    drmModeRmFB(fd, dev->fb);
-err_destroy:
-    memset(&dreq, 0, sizeof(dreq));
-    dreq.handle = dev->handle;
-    drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
-    return ret;
-}
-
 int main(int argc, char **argv)
 {
     int ret, fd;
     const char *card;
-    struct modeset_dev *iter;
+    uint64_t start;
 
     if (argc > 1)
         card = argv[1];
@@ -272,23 +241,26 @@ int main(int argc, char **argv)
 
     fprintf(stderr, "using card '%s'\n", card);
 
+    start = modeset_now_ns();
     ret = modeset_open(&fd, card);
     if (ret)
         goto out_return;
 
+    modeset_pool_init(&modeset_pool, fd);
+
     ret = modeset_prepare(fd);
     if (ret)
         goto out_close;
 
-    for (iter = modeset_list; iter; iter = iter->next) {
-        iter->saved_crtc = drmModeGetCrtc(fd, iter->crtc);
-        ret = drmModeSetCrtc(fd, iter->crtc, iter->fb, 0, 0, &iter->conn, 1, &iter->mode);
-
-        if (ret)
-            fprintf(stderr, "cannot set CRTC for connector %u (%d): %m\n", iter->conn, errno);
+    /* every output comes up in one go, the first frame is on screen on return */
+    ret = modeset_bringup_report(fd, modeset_outputs, modeset_count_outputs);
+    if (ret) {
+        modeset_cleanup(fd);
+        goto out_close;
     }
+    fprintf(stderr, "open to first frame: %.3f ms\n", (modeset_now_ns() - start) / 1e6);
 
-    modeset_draw();
+    modeset_draw(fd);
 
     modeset_cleanup(fd);
 
@@ -320,12 +292,13 @@ static uint8_t next_color(bool *up, uint8_t cur, unsigned int mod)
     return next;
 }
 
-static void modeset_draw(void)
+static void modeset_draw(int fd)
 {
     uint8_t r, g, b;
     bool r_up, g_up, b_up;
-    unsigned int i, j, k, off;
+    unsigned int i, j;
     struct modeset_dev *iter;
+    struct drm_mode_rect *rect;
 
     srand(time(NULL));
     r = rand() % 0xff;
@@ -339,12 +312,18 @@ static void modeset_draw(void)
         b = next_color(&b_up, b, 5);
 
         for (iter = modeset_list; iter; iter = iter->next) {
-            for (j = 0; j < iter->height; ++j) {
-                for (k = 0; k < iter->width; ++k) {
-                    off = iter->stride * j + k * 4;
-                    *(uint32_t *)&iter->map[off] = (r << 16) | (g << 8) | b;
-                }
+            modeset_damage_add(&iter->damage, iter->box.x1, iter->box.y1,
+                               iter->box.x2 - iter->box.x1, iter->box.y2 - iter->box.y1);
+            for (j = 0; j < iter->damage.count; ++j) {
+                rect = &iter->damage.rects[j];
+                modeset_fill_rect(&iter->buf, rect->x1, rect->y1, rect->x2 - rect->x1, rect->y2 - rect->y1,
+                                  (r << 16) | (g << 8) | b);
             }
+
+            /* front-buffer rendering: drivers with a shadowed scanout need the hint */
+            if (modeset_damage_dirtyfb(fd, iter->buf.fb, &iter->damage))
+                fprintf(stderr, "cannot flush damage for connector %u (%d): %m\n", iter->conn, errno);
+            modeset_damage_reset(&iter->damage);
         }
 
         usleep(100000);
@@ -354,7 +333,6 @@ static void modeset_draw(void)
 static void modeset_cleanup(int fd)
 {
     struct modeset_dev *iter;
-    struct drm_mode_destroy_dumb dreq;
 
     while (modeset_list) {
         iter = modeset_list;
@@ -364,14 +342,11 @@ static void modeset_cleanup(int fd)
                        iter->saved_crtc->y, &iter->conn, 1, &iter->saved_crtc->mode);
         drmModeFreeCrtc(iter->saved_crtc);
 
-        munmap(iter->map, iter->size);
-
-        drmModeRmFB(fd, iter->fb);
-
-        memset(&dreq, 0, sizeof(dreq));
-        dreq.handle = iter->handle;
-        drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+        modeset_pool_put(&modeset_pool, &iter->buf);
 
         free(iter);
     }
+
+    free(modeset_outputs);
+    modeset_pool_fini(&modeset_pool);
 }
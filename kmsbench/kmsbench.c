@@ -0,0 +1,463 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "modeset-buf.h"
+#include "modeset-fill.h"
+#include "modeset-util.h"
+
+/*
+ * Fill-rate and bandwidth benchmark over dumb buffers. Every kernel runs
+ * against a fresh dumb buffer at each resolution (skipping those above
+ * the device limits), so it works on any KMS driver including vkms.
+ *
+ * Before anything is timed, every supported row kernel is checked against
+ * the scalar ops in system memory, over all lengths up to a few 64-byte
+ * lines and every head alignment within a line, with guard pixels on
+ * both sides to catch writes past the row.
+ */
+
+#define BENCH_MAX_RES 8
+#define BENCH_MAX_KERNELS (3 + 4 * MODESET_FILL_MAX_OPS)
+
+#define CHECK_MAX_LEN 80
+#define CHECK_GUARD 16
+#define CHECK_SIZE (CHECK_GUARD + CHECK_MAX_LEN + CHECK_GUARD * 2)
+
+enum bench_format {
+    BENCH_TEXT,
+    BENCH_CSV,
+    BENCH_JSON,
+};
+
+struct bench_res {
+    uint32_t width, height;
+};
+
+struct bench_kernel {
+    char name[32];
+    const struct modeset_fill_ops *ops;
+    void (*paint)(const struct bench_kernel *kernel, unsigned int i);
+    /* pixel (x, y) after paint(kernel, i) */
+    uint32_t (*expect)(unsigned int i, uint32_t x, uint32_t y);
+};
+
+static const struct bench_res bench_default_res[] = {
+    { 1280, 720 },
+    { 1920, 1080 },
+    { 2560, 1440 },
+    { 3840, 2160 },
+    { 7680, 4320 },
+};
+
+static struct modeset_buf buf;
+static uint32_t *shadow;
+
+/* every kernel writes the visible width * height * 4 bytes, not the stride padding */
+static void paint_memset(const struct bench_kernel *kernel, unsigned int i)
+{
+    uint32_t j;
+
+    if (buf.stride == buf.width * 4) {
+        memset(buf.map, i & 0xff, (size_t)buf.stride * buf.height);
+        return;
+    }
+
+    for (j = 0; j < buf.height; ++j)
+        memset(buf.map + buf.stride * j, i & 0xff, buf.width * 4);
+}
+
+static uint32_t expect_byte(unsigned int i, uint32_t x, uint32_t y)
+{
+    return (i & 0xff) * 0x01010101u;
+}
+
+static uint32_t expect_color(unsigned int i, uint32_t x, uint32_t y)
+{
+    return i * 0x010101;
+}
+
+static uint32_t expect_shadow(unsigned int i, uint32_t x, uint32_t y)
+{
+    return shadow[buf.width * y + x];
+}
+
+/* the original per-pixel loop of modeset_paint_framebuffer */
+static void paint_pixel_loop(const struct bench_kernel *kernel, unsigned int i)
+{
+    uint32_t j, k, off;
+
+    for (j = 0; j < buf.height; ++j) {
+        for (k = 0; k < buf.width; ++k) {
+            off = buf.stride * j + k * 4;
+            *(uint32_t *)&buf.map[off] = i * 0x010101;
+        }
+    }
+}
+
+static void paint_row_copy(const struct bench_kernel *kernel, unsigned int i)
+{
+    uint32_t j;
+
+    for (j = 0; j < buf.height; ++j)
+        memcpy(buf.map + buf.stride * j, shadow + buf.width * j, buf.width * 4);
+}
+
+static void paint_fill(const struct bench_kernel *kernel, unsigned int i)
+{
+    uint32_t j;
+
+    for (j = 0; j < buf.height; ++j)
+        kernel->ops->fill_row((uint32_t *)(buf.map + buf.stride * j), i * 0x010101, buf.width);
+}
+
+static void paint_copy(const struct bench_kernel *kernel, unsigned int i)
+{
+    uint32_t j;
+
+    for (j = 0; j < buf.height; ++j)
+        kernel->ops->copy_row((uint32_t *)(buf.map + buf.stride * j), shadow + buf.width * j, buf.width);
+}
+
+static void paint_stream_fill(const struct bench_kernel *kernel, unsigned int i)
+{
+    uint32_t j;
+
+    for (j = 0; j < buf.height; ++j)
+        kernel->ops->stream_fill_row((uint32_t *)(buf.map + buf.stride * j), i * 0x010101, buf.width);
+    kernel->ops->stream_fence();
+}
+
+static void paint_stream_copy(const struct bench_kernel *kernel, unsigned int i)
+{
+    uint32_t j;
+
+    for (j = 0; j < buf.height; ++j)
+        kernel->ops->stream_copy_row((uint32_t *)(buf.map + buf.stride * j), shadow + buf.width * j, buf.width);
+    kernel->ops->stream_fence();
+}
+
+static uint32_t check_src[CHECK_SIZE] __attribute__((aligned(64)));
+static uint32_t check_dst[CHECK_SIZE] __attribute__((aligned(64)));
+static uint32_t check_ref[CHECK_SIZE] __attribute__((aligned(64)));
+
+/* variant 0..3: fill, copy, stream fill, stream copy */
+static void check_row(const struct modeset_fill_ops *ops, unsigned int variant, uint32_t *dst,
+                      const uint32_t *src, uint32_t count)
+{
+    switch (variant) {
+        case 0:
+            ops->fill_row(dst, 0x80402010, count);
+            break;
+        case 1:
+            ops->copy_row(dst, src, count);
+            break;
+        case 2:
+            ops->stream_fill_row(dst, 0x80402010, count);
+            ops->stream_fence();
+            break;
+        case 3:
+            ops->stream_copy_row(dst, src, count);
+            ops->stream_fence();
+            break;
+    }
+}
+
+static int bench_check_ops(const struct modeset_fill_ops *ops)
+{
+    static const char *const variants[] = { "fill", "copy", "stream-fill", "stream-copy" };
+    unsigned int variant, head, src_head, len, i;
+
+    for (i = 0; i < CHECK_SIZE; ++i)
+        check_src[i] = 0x01000193 * (i + 1);
+
+    for (variant = 0; variant < 4; ++variant) {
+        for (head = 0; head < CHECK_GUARD; ++head) {
+            /* the source is misaligned differently from the destination */
+            src_head = (head * 7 + 3) % CHECK_GUARD;
+            for (len = 0; len <= CHECK_MAX_LEN; ++len) {
+                for (i = 0; i < CHECK_SIZE; ++i)
+                    check_dst[i] = check_ref[i] = 0xdeadbeef ^ i;
+
+                check_row(&modeset_fill_scalar_ops, variant, check_ref + CHECK_GUARD + head,
+                          check_src + src_head, len);
+                check_row(ops, variant, check_dst + CHECK_GUARD + head, check_src + src_head, len);
+                if (memcmp(check_dst, check_ref, sizeof(check_dst))) {
+                    fprintf(stderr, "%s-%s differs from scalar, %u pixels at head %u\n", ops->name,
+                            variants[variant], len, head);
+                    return -EINVAL;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int bench_check_kernels(void)
+{
+    const struct modeset_fill_ops *ops[MODESET_FILL_MAX_OPS];
+    unsigned int i, count_ops;
+    int ret = 0;
+
+    count_ops = modeset_fill_get_supported(ops);
+    for (i = 0; i < count_ops; ++i) {
+        if (ops[i] != &modeset_fill_scalar_ops && bench_check_ops(ops[i]))
+            ret = -EINVAL;
+    }
+
+    return ret;
+}
+
+static unsigned int bench_setup_kernels(struct bench_kernel *kernels)
+{
+    const struct modeset_fill_ops *ops[MODESET_FILL_MAX_OPS];
+    static const struct {
+        const char *suffix;
+        void (*paint)(const struct bench_kernel *, unsigned int);
+        uint32_t (*expect)(unsigned int, uint32_t, uint32_t);
+    } variants[] = {
+        { "fill", paint_fill, expect_color },
+        { "copy", paint_copy, expect_shadow },
+        { "stream-fill", paint_stream_fill, expect_color },
+        { "stream-copy", paint_stream_copy, expect_shadow },
+    };
+    unsigned int i, j, count_ops, count = 0;
+
+    strcpy(kernels[count].name, "memset");
+    kernels[count].expect = expect_byte;
+    kernels[count++].paint = paint_memset;
+    strcpy(kernels[count].name, "pixel-loop");
+    kernels[count].expect = expect_color;
+    kernels[count++].paint = paint_pixel_loop;
+    strcpy(kernels[count].name, "row-memcpy");
+    kernels[count].expect = expect_shadow;
+    kernels[count++].paint = paint_row_copy;
+
+    count_ops = modeset_fill_get_supported(ops);
+    for (i = 0; i < count_ops; ++i) {
+        for (j = 0; j < 4; ++j) {
+            snprintf(kernels[count].name, sizeof(kernels[count].name), "%s-%s", ops[i]->name, variants[j].suffix);
+            kernels[count].ops = ops[i];
+            kernels[count].expect = variants[j].expect;
+            kernels[count++].paint = variants[j].paint;
+        }
+    }
+
+    return count;
+}
+
+/* one frame over a buffer of 0xff bytes, read back pixel by pixel */
+static int bench_verify(const struct bench_kernel *kernel)
+{
+    const unsigned int i = 0x5a;
+    uint32_t x, y, pixel;
+
+    memset(buf.map, 0xff, buf.size);
+    kernel->paint(kernel, i);
+
+    for (y = 0; y < buf.height; ++y) {
+        for (x = 0; x < buf.width; ++x) {
+            pixel = ((uint32_t *)(buf.map + buf.stride * y))[x];
+            if (pixel != kernel->expect(i, x, y)) {
+                fprintf(stderr, "%s: pixel %u,%u is %08x, expected %08x, not timed\n", kernel->name, x, y, pixel,
+                        kernel->expect(i, x, y));
+                return -EINVAL;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void bench_run(const struct bench_kernel *kernel, unsigned int warmup, unsigned int reps,
+                      enum bench_format format, int *first)
+{
+    uint64_t start, ns, min = UINT64_MAX, total = 0;
+    double bytes, mean;
+    unsigned int i;
+
+    if (bench_verify(kernel))
+        return;
+
+    for (i = 0; i < warmup; ++i)
+        kernel->paint(kernel, i);
+
+    for (i = 0; i < reps; ++i) {
+        start = modeset_now_ns();
+        kernel->paint(kernel, i);
+        ns = modeset_now_ns() - start;
+
+        total += ns;
+        if (ns < min)
+            min = ns;
+    }
+
+    mean = (double)total / reps;
+    bytes = (double)buf.width * buf.height * 4;
+
+    switch (format) {
+        case BENCH_TEXT:
+            printf("  %-20s %12.0f %12llu %10.1f\n", kernel->name, mean, (unsigned long long)min,
+                   bytes * 1e3 / mean);
+            break;
+        case BENCH_CSV:
+            printf("%u,%u,%s,%.0f,%llu,%.1f\n", buf.width, buf.height, kernel->name, mean,
+                   (unsigned long long)min, bytes * 1e3 / mean);
+            break;
+        case BENCH_JSON:
+            printf("%s  {\"width\": %u, \"height\": %u, \"kernel\": \"%s\", \"ns_per_frame\": %.0f, "
+                   "\"min_ns\": %llu, \"mb_per_s\": %.1f}", *first ? "" : ",\n", buf.width, buf.height,
+                   kernel->name, mean, (unsigned long long)min, bytes * 1e3 / mean);
+            break;
+    }
+    *first = 0;
+}
+
+static int bench_parse_res(const char *arg, struct bench_res *res)
+{
+    unsigned int count = 0;
+    char *end;
+
+    while (*arg && count < BENCH_MAX_RES) {
+        res[count].width = strtoul(arg, &end, 10);
+        if (*end != 'x')
+            return -EINVAL;
+        res[count].height = strtoul(end + 1, &end, 10);
+        if (!res[count].width || !res[count].height)
+            return -EINVAL;
+        ++count;
+        if (*end != ',')
+            break;
+        arg = end + 1;
+    }
+
+    return count;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d card] [-r WxH[,WxH...]] [-w warmup] [-n reps] [-f text|csv|json]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_kernel kernels[BENCH_MAX_KERNELS];
+    struct bench_res res[BENCH_MAX_RES];
+    enum bench_format format = BENCH_TEXT;
+    unsigned int warmup = 5, reps = 100;
+    unsigned int i, j, count_res, count_kernels;
+    const char *card = "/dev/dri/card0";
+    drmModeRes *drm_res;
+    int fd, opt, ret, first = 1;
+
+    count_res = sizeof(bench_default_res) / sizeof(bench_default_res[0]);
+    memcpy(res, bench_default_res, sizeof(bench_default_res));
+
+    while ((opt = getopt(argc, argv, "d:r:w:n:f:h")) != -1) {
+        switch (opt) {
+            case 'd':
+                card = optarg;
+                break;
+            case 'r':
+                ret = bench_parse_res(optarg, res);
+                if (ret <= 0) {
+                    fprintf(stderr, "invalid resolution list '%s'\n", optarg);
+                    return 1;
+                }
+                count_res = ret;
+                break;
+            case 'w':
+                warmup = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                reps = strtoul(optarg, NULL, 10);
+                if (!reps)
+                    reps = 1;
+                break;
+            case 'f':
+                if (!strcmp(optarg, "csv")) {
+                    format = BENCH_CSV;
+                }
+                else if (!strcmp(optarg, "json")) {
+                    format = BENCH_JSON;
+                }
+                else if (strcmp(optarg, "text")) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (bench_check_kernels())
+        return 1;
+
+    fd = open(card, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open '%s': %m\n", card);
+        return 1;
+    }
+
+    count_kernels = bench_setup_kernels(kernels);
+    drm_res = drmModeGetResources(fd);
+
+    if (format == BENCH_CSV)
+        printf("width,height,kernel,ns_per_frame,min_ns,mb_per_s\n");
+    else if (format == BENCH_JSON)
+        printf("[\n");
+
+    for (i = 0; i < count_res; ++i) {
+        if (drm_res && (res[i].width > drm_res->max_width || res[i].height > drm_res->max_height)) {
+            fprintf(stderr, "skipping %ux%u, device limit is %ux%u\n", res[i].width, res[i].height,
+                    drm_res->max_width, drm_res->max_height);
+            continue;
+        }
+
+        memset(&buf, 0, sizeof(buf));
+        buf.width = res[i].width;
+        buf.height = res[i].height;
+        if (modeset_create_fb(fd, &buf)) {
+            fprintf(stderr, "skipping %ux%u\n", res[i].width, res[i].height);
+            continue;
+        }
+
+        shadow = aligned_alloc(64, (buf.width * buf.height * 4 + 63) & ~63u);
+        if (!shadow) {
+            modeset_destroy_fb(fd, &buf);
+            continue;
+        }
+        for (j = 0; j < buf.width * buf.height; ++j)
+            shadow[j] = j;
+
+        if (format == BENCH_TEXT) {
+            printf("%ux%u stride %u, %u warmup + %u reps\n", buf.width, buf.height, buf.stride, warmup, reps);
+            printf("  %-20s %12s %12s %10s\n", "kernel", "ns/frame", "min ns", "MB/s");
+        }
+
+        for (j = 0; j < count_kernels; ++j)
+            bench_run(&kernels[j], warmup, reps, format, &first);
+
+        free(shadow);
+        modeset_destroy_fb(fd, &buf);
+    }
+
+    if (format == BENCH_JSON)
+        printf("\n]\n");
+
+    drmModeFreeResources(drm_res);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+
+#include "modeset-assign.h"
+
+struct modeset_assign_state {
+    const struct modeset_topo *topo;
+    struct modeset_assign *assign;
+    int crtc_conn[MODESET_TOPO_MAX_CRTCS];
+    uint32_t crtc_visited;
+    uint64_t plane_visited;
+};
+
+static int modeset_assign_connector(struct modeset_assign_state *st, unsigned int conn);
+
+/* give the CRTC a primary plane, moving other CRTCs to other planes if needed */
+static int modeset_assign_plane(struct modeset_assign_state *st, unsigned int crtc)
+{
+    const struct modeset_topo *topo = st->topo;
+    unsigned int p;
+    int owner;
+
+    if (!topo->primary_mask)
+        return 1;
+
+    for (p = 0; p < topo->count_planes; ++p) {
+        if (!(topo->primary_mask & (1ull << p)) || (st->plane_visited & (1ull << p)))
+            continue;
+        if (!(topo->planes[p].possible_crtcs & (1u << crtc)))
+            continue;
+
+        st->plane_visited |= 1ull << p;
+        owner = st->assign->plane_crtc[p];
+        if (owner < 0 || modeset_assign_plane(st, owner)) {
+            st->assign->plane_crtc[p] = crtc;
+            st->assign->crtc_primary[crtc] = p;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int modeset_assign_try(struct modeset_assign_state *st, unsigned int conn, unsigned int crtc)
+{
+    if (st->crtc_visited & (1u << crtc))
+        return 0;
+    st->crtc_visited |= 1u << crtc;
+
+    if (st->crtc_conn[crtc] < 0) {
+        if (!modeset_assign_plane(st, crtc))
+            return 0;
+    }
+    else if (!modeset_assign_connector(st, st->crtc_conn[crtc])) {
+        return 0;
+    }
+
+    st->crtc_conn[crtc] = conn;
+    st->assign->conn_crtc[conn] = crtc;
+    return 1;
+}
+
+static int modeset_assign_connector(struct modeset_assign_state *st, unsigned int conn)
+{
+    const struct modeset_topo_connector *tc = &st->topo->connectors[conn];
+    unsigned int k;
+
+    /* the current CRTC first, so a running configuration stays as it is */
+    if (tc->crtc >= 0 && (tc->possible_crtcs & (1u << tc->crtc)) &&
+        modeset_assign_try(st, conn, tc->crtc))
+        return 1;
+
+    for (k = 0; k < st->topo->count_crtcs; ++k) {
+        if ((tc->possible_crtcs & (1u << k)) && modeset_assign_try(st, conn, k))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* overlays go to the lit CRTC holding the fewest, most constrained planes first */
+static void modeset_assign_spread_overlays(const struct modeset_topo *topo, struct modeset_assign *assign)
+{
+    unsigned int count_overlays[MODESET_TOPO_MAX_CRTCS] = { 0 };
+    uint64_t pending = topo->overlay_mask;
+    unsigned int p, k, n, best_n;
+    int best, crtc;
+
+    while (pending) {
+        best = -1;
+        best_n = 33;
+        for (p = 0; p < topo->count_planes; ++p) {
+            if (!(pending & (1ull << p)))
+                continue;
+            n = __builtin_popcount(topo->planes[p].possible_crtcs & assign->crtc_used);
+            if (n < best_n) {
+                best = p;
+                best_n = n;
+            }
+        }
+        pending &= ~(1ull << best);
+        if (!best_n)
+            continue;
+
+        crtc = -1;
+        for (k = 0; k < topo->count_crtcs; ++k) {
+            if (!(topo->planes[best].possible_crtcs & assign->crtc_used & (1u << k)))
+                continue;
+            if (crtc < 0 || count_overlays[k] < count_overlays[crtc])
+                crtc = k;
+        }
+
+        assign->plane_crtc[best] = crtc;
+        assign->plane_used |= 1ull << best;
+        ++count_overlays[crtc];
+    }
+}
+
+int modeset_assign_solve(const struct modeset_topo *topo, uint32_t conn_mask, struct modeset_assign *assign)
+{
+    struct modeset_assign_state st;
+    unsigned int i;
+
+    memset(assign, 0, sizeof(*assign));
+    memset(assign->conn_crtc, 0xff, sizeof(assign->conn_crtc));
+    memset(assign->crtc_primary, 0xff, sizeof(assign->crtc_primary));
+    memset(assign->plane_crtc, 0xff, sizeof(assign->plane_crtc));
+
+    st.topo = topo;
+    st.assign = assign;
+    memset(st.crtc_conn, 0xff, sizeof(st.crtc_conn));
+
+    /* connectors that are already lit get the first pick of their CRTC */
+    for (i = 0; i < topo->count_connectors; ++i) {
+        if (!(conn_mask & (1u << i)) || topo->connectors[i].crtc < 0)
+            continue;
+        st.crtc_visited = 0;
+        st.plane_visited = 0;
+        if (modeset_assign_connector(&st, i))
+            ++assign->count_lit;
+    }
+
+    for (i = 0; i < topo->count_connectors; ++i) {
+        if (!(conn_mask & (1u << i)) || topo->connectors[i].crtc >= 0)
+            continue;
+        st.crtc_visited = 0;
+        st.plane_visited = 0;
+        if (modeset_assign_connector(&st, i))
+            ++assign->count_lit;
+    }
+
+    for (i = 0; i < topo->count_crtcs; ++i) {
+        if (st.crtc_conn[i] < 0)
+            continue;
+        assign->crtc_used |= 1u << i;
+        if (assign->crtc_primary[i] >= 0)
+            assign->plane_used |= 1ull << assign->crtc_primary[i];
+    }
+
+    modeset_assign_spread_overlays(topo, assign);
+
+    return assign->count_lit ? 0 : -ENOENT;
+}
+
+uint64_t modeset_assign_overlays(const struct modeset_assign *assign, unsigned int crtc)
+{
+    uint64_t mask = 0;
+    unsigned int p;
+
+    for (p = 0; p < MODESET_TOPO_MAX_PLANES; ++p) {
+        if (assign->plane_crtc[p] == (int)crtc)
+            mask |= 1ull << p;
+    }
+
+    if (assign->crtc_primary[crtc] >= 0)
+        mask &= ~(1ull << assign->crtc_primary[crtc]);
+    return mask;
+}
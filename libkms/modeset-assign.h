@@ -0,0 +1,32 @@
+#ifndef MODESET_ASSIGN_H
+#define MODESET_ASSIGN_H
+
+#include <stdint.h>
+
+#include "modeset-topo.h"
+
+/*
+ * Connector -> CRTC -> primary plane assignment over a topology snapshot.
+ * Augmenting paths over the encoder possible_crtcs masks, preferring each
+ * connector's current CRTC, give every connector a CRTC that can also get
+ * a primary plane, moving other CRTCs to other primaries where needed.
+ * The two levels are searched one after the other rather than jointly, so
+ * this is a heuristic: it lights every connector the CRTC masks allow on
+ * common hardware, but a plane constraint can leave one dark that a joint
+ * search would have placed. Overlay planes are then spread over the lit
+ * CRTCs, the most constrained planes first. Without universal planes (no
+ * primary planes in the snapshot) only CRTCs are matched, which is exact.
+ */
+struct modeset_assign {
+    unsigned int count_lit;
+    int conn_crtc[MODESET_TOPO_MAX_CONNECTORS];
+    int crtc_primary[MODESET_TOPO_MAX_CRTCS];
+    int plane_crtc[MODESET_TOPO_MAX_PLANES];
+    uint32_t crtc_used;
+    uint64_t plane_used;
+};
+
+int modeset_assign_solve(const struct modeset_topo *topo, uint32_t conn_mask, struct modeset_assign *assign);
+uint64_t modeset_assign_overlays(const struct modeset_assign *assign, unsigned int crtc);
+
+#endif
@@ -0,0 +1,142 @@
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "modeset-blend.h"
+
+static int modeset_blend_intersect(const struct drm_mode_rect *a, const struct drm_mode_rect *b,
+                                   struct drm_mode_rect *out)
+{
+    out->x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+    out->y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+    out->x2 = a->x2 < b->x2 ? a->x2 : b->x2;
+    out->y2 = a->y2 < b->y2 ? a->y2 : b->y2;
+
+    return out->x1 < out->x2 && out->y1 < out->y2;
+}
+
+static int modeset_blend_opaque(const struct modeset_blend_layer *layer)
+{
+    return layer->op == MODESET_BLEND_SRC || (layer->op == MODESET_BLEND_FILL && layer->color >> 24 == 255);
+}
+
+/* source pixels of one layer row inside r, scaled into tmp when needed */
+static const uint32_t *modeset_blend_src_row(const struct modeset_blend_layer *layer, const struct drm_mode_rect *r,
+                                             int32_t y, uint32_t *tmp)
+{
+    int32_t sw = layer->src.x2 - layer->src.x1, sh = layer->src.y2 - layer->src.y1;
+    int32_t dw = layer->dst.x2 - layer->dst.x1, dh = layer->dst.y2 - layer->dst.y1;
+    const uint32_t *row;
+    int32_t x;
+
+    row = (const uint32_t *)(layer->buf->map + layer->buf->stride *
+                             (layer->src.y1 + (int64_t)(y - layer->dst.y1) * sh / dh));
+    if (sw == dw)
+        return row + layer->src.x1 + (r->x1 - layer->dst.x1);
+
+    for (x = r->x1; x < r->x2; ++x)
+        tmp[x - r->x1] = row[layer->src.x1 + (int64_t)(x - layer->dst.x1) * sw / dw];
+    return tmp;
+}
+
+static void modeset_blend_layer_tile(const struct modeset_fill_ops *ops, uint32_t *tile,
+                                     const struct drm_mode_rect *t, const struct modeset_blend_layer *layer)
+{
+    uint32_t tmp[MODESET_BLEND_TILE_W];
+    struct drm_mode_rect r;
+    const uint32_t *src;
+    uint32_t *out;
+    int32_t y;
+
+    if (!modeset_blend_intersect(t, &layer->dst, &r))
+        return;
+
+    for (y = r.y1; y < r.y2; ++y) {
+        out = tile + (y - t->y1) * MODESET_BLEND_TILE_W + (r.x1 - t->x1);
+
+        switch (layer->op) {
+            case MODESET_BLEND_FILL:
+                if (layer->color >> 24 == 255)
+                    ops->fill_row(out, layer->color, r.x2 - r.x1);
+                else
+                    ops->blend_solid_row(out, layer->color, r.x2 - r.x1);
+                break;
+            case MODESET_BLEND_SRC:
+                src = modeset_blend_src_row(layer, &r, y, tmp);
+                ops->copy_row(out, src, r.x2 - r.x1);
+                break;
+            case MODESET_BLEND_OVER:
+                src = modeset_blend_src_row(layer, &r, y, tmp);
+                ops->blend_row(out, src, r.x2 - r.x1);
+                break;
+        }
+    }
+}
+
+void modeset_blend_ops(const struct modeset_fill_ops *ops, struct modeset_buf *dst,
+                       const struct modeset_blend_layer *layers, unsigned int count, int stream)
+{
+    uint32_t tile[MODESET_BLEND_TILE_W * MODESET_BLEND_TILE_H] __attribute__((aligned(64)));
+    struct drm_mode_rect bounds, screen = { 0, 0, dst->width, dst->height }, t, r;
+    unsigned int i;
+    int32_t y;
+    int base;
+
+    if (!count)
+        return;
+
+    bounds = layers[0].dst;
+    for (i = 1; i < count; ++i) {
+        bounds.x1 = layers[i].dst.x1 < bounds.x1 ? layers[i].dst.x1 : bounds.x1;
+        bounds.y1 = layers[i].dst.y1 < bounds.y1 ? layers[i].dst.y1 : bounds.y1;
+        bounds.x2 = layers[i].dst.x2 > bounds.x2 ? layers[i].dst.x2 : bounds.x2;
+        bounds.y2 = layers[i].dst.y2 > bounds.y2 ? layers[i].dst.y2 : bounds.y2;
+    }
+    if (!modeset_blend_intersect(&bounds, &screen, &bounds))
+        return;
+
+    /* keep tile rows on 64-byte lines for the streaming write back */
+    bounds.x1 &= ~15;
+
+    for (t.y1 = bounds.y1; t.y1 < bounds.y2; t.y1 += MODESET_BLEND_TILE_H) {
+        t.y2 = t.y1 + MODESET_BLEND_TILE_H < bounds.y2 ? t.y1 + MODESET_BLEND_TILE_H : bounds.y2;
+
+        for (t.x1 = bounds.x1; t.x1 < bounds.x2; t.x1 += MODESET_BLEND_TILE_W) {
+            t.x2 = t.x1 + MODESET_BLEND_TILE_W < bounds.x2 ? t.x1 + MODESET_BLEND_TILE_W : bounds.x2;
+
+            /* everything under the topmost opaque layer covering the tile is hidden */
+            for (base = count - 1; base >= 0; --base) {
+                if (modeset_blend_opaque(&layers[base]) && modeset_blend_intersect(&t, &layers[base].dst, &r) &&
+                    !memcmp(&r, &t, sizeof(r)))
+                    break;
+            }
+
+            if (base < 0) {
+                base = 0;
+                for (y = t.y1; y < t.y2; ++y)
+                    ops->copy_row(tile + (y - t.y1) * MODESET_BLEND_TILE_W,
+                                  (const uint32_t *)(dst->map + dst->stride * y) + t.x1, t.x2 - t.x1);
+            }
+
+            for (i = base; i < count; ++i)
+                modeset_blend_layer_tile(ops, tile, &t, &layers[i]);
+
+            for (y = t.y1; y < t.y2; ++y) {
+                if (stream)
+                    ops->stream_copy_row((uint32_t *)(dst->map + dst->stride * y) + t.x1,
+                                         tile + (y - t.y1) * MODESET_BLEND_TILE_W, t.x2 - t.x1);
+                else
+                    ops->copy_row((uint32_t *)(dst->map + dst->stride * y) + t.x1,
+                                  tile + (y - t.y1) * MODESET_BLEND_TILE_W, t.x2 - t.x1);
+            }
+        }
+    }
+
+    if (stream)
+        ops->stream_fence();
+}
+
+void modeset_blend(struct modeset_buf *dst, const struct modeset_blend_layer *layers, unsigned int count,
+                   int stream)
+{
+    modeset_blend_ops(modeset_fill_get_ops(), dst, layers, count, stream);
+}
@@ -0,0 +1,45 @@
+#ifndef MODESET_BLEND_H
+#define MODESET_BLEND_H
+
+#include <stdint.h>
+#include <xf86drm.h>
+
+#include "modeset-buf.h"
+#include "modeset-fill.h"
+
+/*
+ * CPU composition of premultiplied ARGB8888 layers, given bottom to top.
+ * The destination is processed in tiles small enough to stay in L1: each
+ * tile is built in a scratch buffer from the topmost layer that covers it
+ * opaquely (or from the destination if none does), every layer above is
+ * blended into it with the row kernels of modeset_fill_ops, and the tile
+ * is written back once. A framebuffer mapping is therefore read at most
+ * once and written exactly once per pixel, however many layers overlap.
+ */
+#define MODESET_BLEND_TILE_W 256
+#define MODESET_BLEND_TILE_H 16
+
+enum modeset_blend_op {
+    /* plain copy, for opaque layers */
+    MODESET_BLEND_SRC,
+    /* premultiplied source over destination */
+    MODESET_BLEND_OVER,
+    /* premultiplied solid color over destination, buf is unused */
+    MODESET_BLEND_FILL,
+};
+
+struct modeset_blend_layer {
+    enum modeset_blend_op op;
+    const struct modeset_buf *buf;
+    uint32_t color;
+    /* src in buffer pixels, dst in destination pixels, scaled nearest-neighbour */
+    struct drm_mode_rect src;
+    struct drm_mode_rect dst;
+};
+
+void modeset_blend_ops(const struct modeset_fill_ops *ops, struct modeset_buf *dst,
+                       const struct modeset_blend_layer *layers, unsigned int count, int stream);
+void modeset_blend(struct modeset_buf *dst, const struct modeset_blend_layer *layers, unsigned int count,
+                   int stream);
+
+#endif
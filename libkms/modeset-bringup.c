@@ -0,0 +1,267 @@
+#define _GNU_SOURCE
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modeset-bringup.h"
+#include "modeset-props.h"
+#include "modeset-util.h"
+
+/* same timings, the name and the preferred/driver type bits do not matter */
+bool modeset_mode_equal(const drmModeModeInfo *a, const drmModeModeInfo *b)
+{
+    return a->clock == b->clock &&
+           a->hdisplay == b->hdisplay && a->hsync_start == b->hsync_start &&
+           a->hsync_end == b->hsync_end && a->htotal == b->htotal && a->hskew == b->hskew &&
+           a->vdisplay == b->vdisplay && a->vsync_start == b->vsync_start &&
+           a->vsync_end == b->vsync_end && a->vtotal == b->vtotal && a->vscan == b->vscan &&
+           a->flags == b->flags;
+}
+
+/* the CRTC already scans out our mode on this connector, only its plane has to change */
+static bool modeset_bringup_can_takeover(int fd, const struct modeset_bringup *out, struct drm_object *conn,
+                                         struct drm_object *crtc)
+{
+    drmModeCrtc *info;
+    bool ret;
+
+    if (!modeset_env_match("MODESET_TAKEOVER", out->conn))
+        return false;
+    if (conn->prop_values[MODESET_PROP_CRTC_ID] != out->crtc || !crtc->prop_values[MODESET_PROP_ACTIVE])
+        return false;
+
+    info = drmModeGetCrtc(fd, out->crtc);
+    if (!info)
+        return false;
+    ret = info->mode_valid && modeset_mode_equal(&info->mode, out->mode);
+    drmModeFreeCrtc(info);
+
+    return ret;
+}
+
+/* the primary plane of crtc, skipping planes already taken by another output */
+static int modeset_bringup_find_primary(int fd, drmModeRes *res, drmModePlaneRes *plane_res, uint32_t crtc,
+                                        uint64_t *used, struct drm_object *plane)
+{
+    drmModePlane *info;
+    uint32_t i, crtc_index;
+
+    for (crtc_index = 0; crtc_index < (uint32_t)res->count_crtcs; ++crtc_index) {
+        if (res->crtcs[crtc_index] == crtc)
+            break;
+    }
+    if (crtc_index == (uint32_t)res->count_crtcs)
+        return -ENOENT;
+
+    for (i = 0; i < plane_res->count_planes && i < 64; ++i) {
+        if (*used & (1ull << i))
+            continue;
+
+        info = drmModeGetPlane(fd, plane_res->planes[i]);
+        if (!info)
+            continue;
+        if (!(info->possible_crtcs & (1 << crtc_index))) {
+            drmModeFreePlane(info);
+            continue;
+        }
+        drmModeFreePlane(info);
+
+        plane->id = plane_res->planes[i];
+        if (modeset_get_object_properties(fd, plane, DRM_MODE_OBJECT_PLANE))
+            continue;
+        if (plane->prop_values[MODESET_PROP_TYPE] == DRM_PLANE_TYPE_PRIMARY) {
+            *used |= 1ull << i;
+            return 0;
+        }
+    }
+
+    return -ENOENT;
+}
+
+/* returns 1 if the output went into the modeset request, 0 if its plane alone takes it over */
+static int modeset_bringup_add(int fd, drmModeAtomicReq *modeset_req, drmModeAtomicReq *takeover_req,
+                               const struct modeset_bringup *out, struct drm_object *plane, bool takeover,
+                               uint32_t *blob_id)
+{
+    struct drm_object conn, crtc;
+    drmModeAtomicReq *req;
+    int ret;
+
+    conn.id = out->conn;
+    crtc.id = out->crtc;
+    if (modeset_get_object_properties(fd, &conn, DRM_MODE_OBJECT_CONNECTOR) ||
+        modeset_get_object_properties(fd, &crtc, DRM_MODE_OBJECT_CRTC))
+        return -ENOENT;
+
+    takeover = takeover && modeset_bringup_can_takeover(fd, out, &conn, &crtc);
+    req = takeover ? takeover_req : modeset_req;
+    if (takeover) {
+        fprintf(stderr, "taking over crtc %u on connector %u without a modeset\n", out->crtc, out->conn);
+    }
+    else {
+        ret = drmModeCreatePropertyBlob(fd, out->mode, sizeof(*out->mode), blob_id);
+        if (ret < 0)
+            return ret;
+
+        if (set_drm_object_property(req, &conn, MODESET_PROP_CRTC_ID, out->crtc) < 0 ||
+            set_drm_object_property(req, &crtc, MODESET_PROP_MODE_ID, *blob_id) < 0 ||
+            set_drm_object_property(req, &crtc, MODESET_PROP_ACTIVE, 1) < 0)
+            return -EINVAL;
+    }
+
+    if (set_drm_object_property(req, plane, MODESET_PROP_FB_ID, out->fb) < 0 ||
+        set_drm_object_property(req, plane, MODESET_PROP_CRTC_ID, out->crtc) < 0 ||
+        set_drm_object_property(req, plane, MODESET_PROP_SRC_X, 0) < 0 ||
+        set_drm_object_property(req, plane, MODESET_PROP_SRC_Y, 0) < 0 ||
+        set_drm_object_property(req, plane, MODESET_PROP_SRC_W, out->width << 16) < 0 ||
+        set_drm_object_property(req, plane, MODESET_PROP_SRC_H, out->height << 16) < 0 ||
+        set_drm_object_property(req, plane, MODESET_PROP_CRTC_X, 0) < 0 ||
+        set_drm_object_property(req, plane, MODESET_PROP_CRTC_Y, 0) < 0 ||
+        set_drm_object_property(req, plane, MODESET_PROP_CRTC_W, out->width) < 0 ||
+        set_drm_object_property(req, plane, MODESET_PROP_CRTC_H, out->height) < 0)
+        return -EINVAL;
+
+    return !takeover;
+}
+
+static int modeset_bringup_atomic(int fd, const struct modeset_bringup *outputs, unsigned int count, bool takeover)
+{
+    drmModePlaneRes *plane_res;
+    drmModeAtomicReq *req, *takeover_req;
+    struct drm_object plane;
+    drmModeRes *res;
+    uint32_t *blob_ids;
+    uint64_t used = 0;
+    unsigned int i;
+    int ret = 0;
+    bool took_over = false, modeset = false;
+
+    if (drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) || drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1))
+        return -EOPNOTSUPP;
+
+    res = drmModeGetResources(fd);
+    plane_res = drmModeGetPlaneResources(fd);
+    req = drmModeAtomicAlloc();
+    takeover_req = drmModeAtomicAlloc();
+    blob_ids = calloc(count, sizeof(*blob_ids));
+    if (!res || !plane_res || !req || !takeover_req || !blob_ids) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < count && !ret; ++i) {
+        ret = modeset_bringup_find_primary(fd, res, plane_res, outputs[i].crtc, &used, &plane);
+        if (ret) {
+            fprintf(stderr, "no primary plane for crtc %u\n", outputs[i].crtc);
+            break;
+        }
+        ret = modeset_bringup_add(fd, req, takeover_req, &outputs[i], &plane, takeover, &blob_ids[i]);
+        if (ret > 0) {
+            modeset = true;
+            ret = 0;
+        }
+        else if (!ret) {
+            took_over = true;
+        }
+    }
+
+    /*
+     * The taken over CRTCs go first, in a commit without ALLOW_MODESET, so
+     * the modeset of the other outputs cannot pull them into one.
+     */
+    if (!ret && took_over) {
+        ret = drmModeAtomicCommit(fd, takeover_req, DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+        if (ret < 0)
+            fprintf(stderr, "takeover rejected by TEST_ONLY (%d)\n", -ret);
+        else
+            ret = drmModeAtomicCommit(fd, takeover_req, 0, NULL);
+    }
+
+    if (!ret && modeset) {
+        ret = drmModeAtomicCommit(fd, req, DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+        if (ret < 0)
+            fprintf(stderr, "combined modeset rejected by TEST_ONLY (%d)\n", -ret);
+        else
+            ret = drmModeAtomicCommit(fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+    }
+
+    for (i = 0; blob_ids && i < count; ++i) {
+        if (blob_ids[i])
+            drmModeDestroyPropertyBlob(fd, blob_ids[i]);
+    }
+
+out:
+    free(blob_ids);
+    drmModeAtomicFree(takeover_req);
+    drmModeAtomicFree(req);
+    drmModeFreePlaneResources(plane_res);
+    drmModeFreeResources(res);
+
+    /* a rejected takeover still gets a full modeset before going legacy */
+    if (ret && took_over)
+        return modeset_bringup_atomic(fd, outputs, count, false);
+
+    /* the legacy path below expects a plain legacy client again */
+    if (ret)
+        drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 0);
+
+    return ret;
+}
+
+int modeset_bringup(int fd, const struct modeset_bringup *outputs, unsigned int count, bool *atomic)
+{
+    unsigned int i;
+    int ret = 0;
+
+    *atomic = false;
+    if (!count)
+        return 0;
+
+    if (!modeset_bringup_atomic(fd, outputs, count, true)) {
+        *atomic = true;
+        return 0;
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (drmModeSetCrtc(fd, outputs[i].crtc, outputs[i].fb, 0, 0, (uint32_t *)&outputs[i].conn, 1,
+                           (drmModeModeInfo *)outputs[i].mode)) {
+            ret = -errno;
+            fprintf(stderr, "cannot set CRTC for connector %u (%d): %m\n", outputs[i].conn, errno);
+        }
+    }
+
+    return ret;
+}
+
+void modeset_bringup_set(struct modeset_bringup *out, uint32_t conn, uint32_t crtc, const struct modeset_buf *buf,
+                         const drmModeModeInfo *mode)
+{
+    out->conn = conn;
+    out->crtc = crtc;
+    out->fb = buf->fb;
+    out->width = buf->width;
+    out->height = buf->height;
+    out->mode = mode;
+}
+
+int modeset_bringup_report(int fd, const struct modeset_bringup *outputs, unsigned int count)
+{
+    bool atomic;
+    int ret;
+
+    if (!count) {
+        fprintf(stderr, "no output to set up\n");
+        return -ENOENT;
+    }
+
+    ret = modeset_bringup(fd, outputs, count, &atomic);
+    if (ret)
+        fprintf(stderr, "cannot set up %u outputs (%d)\n", count, ret);
+    else
+        fprintf(stderr, "%u outputs set up %s\n", count, atomic ? "by one atomic commit" : "by legacy SetCrtc");
+
+    return ret;
+}
@@ -0,0 +1,42 @@
+#ifndef MODESET_BRINGUP_H
+#define MODESET_BRINGUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+#include "modeset-buf.h"
+
+/*
+ * Initial modeset of every output of a device. With atomic KMS all outputs
+ * are configured by one DRM_MODE_ATOMIC_ALLOW_MODESET commit, validated
+ * with TEST_ONLY first, so a multi-head cold start costs one modeset
+ * instead of one per screen. Only when the device has no atomic support
+ * (or rejects the combined state) the outputs are set one by one with
+ * drmModeSetCrtc. Either way the first frame is on screen on return.
+ *
+ * Connectors listed in MODESET_TAKEOVER whose CRTC is already active in
+ * the requested mode and routed to them (e.g. after a service restart)
+ * are taken over seamlessly: only the primary plane is pointed at the new
+ * framebuffer, without a blank or link retrain. They are committed on
+ * their own without ALLOW_MODESET, before the outputs that need a
+ * modeset, so that modeset cannot pull them in.
+ *
+ * modeset_bringup_report() is the examples' entry point: it brings the
+ * outputs up and reports how, or that it failed.
+ */
+struct modeset_bringup {
+    uint32_t conn;
+    uint32_t crtc;
+    uint32_t fb;
+    uint32_t width, height;
+    const drmModeModeInfo *mode;
+};
+
+bool modeset_mode_equal(const drmModeModeInfo *a, const drmModeModeInfo *b);
+void modeset_bringup_set(struct modeset_bringup *out, uint32_t conn, uint32_t crtc, const struct modeset_buf *buf,
+                         const drmModeModeInfo *mode);
+int modeset_bringup(int fd, const struct modeset_bringup *outputs, unsigned int count, bool *atomic);
+int modeset_bringup_report(int fd, const struct modeset_bringup *outputs, unsigned int count);
+
+#endif
@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "modeset-buf.h"
+
+uint32_t modeset_format_bpp(uint32_t format)
+{
+    switch (format) {
+        case DRM_FORMAT_RGB565:
+            return 16;
+        default:
+            return 32;
+    }
+}
+
+int modeset_create_fb(int fd, struct modeset_buf *buf)
+{
+    struct drm_mode_create_dumb creq;
+    struct drm_mode_destroy_dumb dreq;
+    struct drm_mode_map_dumb mreq;
+    int ret;
+    uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
+
+    if (!buf->format)
+        buf->format = DRM_FORMAT_XRGB8888;
+
+    memset(&creq, 0, sizeof(creq));
+    creq.width = buf->width;
+    creq.height = buf->height;
+    creq.bpp = modeset_format_bpp(buf->format);
+    ret = drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
+    if (ret < 0) {
+        fprintf(stderr, "cannot create dumb buffer (%d): %m\n", errno);
+        return -errno;
+    }
+    buf->stride = creq.pitch;
+    buf->size = creq.size;
+    buf->handle = creq.handle;
+
+    handles[0] = buf->handle;
+    pitches[0] = buf->stride;
+    ret = drmModeAddFB2(fd, buf->width, buf->height, buf->format, handles, pitches, offsets, &buf->fb, 0);
+    if (ret) {
+        fprintf(stderr, "cannot create framebuffer (%d): %m\n", errno);
+        ret = -errno;
+        goto err_destroy;
+    }
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.handle = buf->handle;
+    ret = drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
+    if (ret) {
+        fprintf(stderr, "cannot map dumb buffer (%d): %m\n", errno);
+        ret = -errno;
+        goto err_fb;
+    }
+
+    buf->map = mmap(0, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mreq.offset);
+    if (buf->map == MAP_FAILED) {
+        fprintf(stderr, "cannot mmap dumb buffer (%d): %m\n", errno);
+        ret = -errno;
+        goto err_fb;
+    }
+
+    memset(buf->map, 0, buf->size);
+
+    return 0;
+
+err_fb:
+    drmModeRmFB(fd, buf->fb);
+err_destroy:
+    memset(&dreq, 0, sizeof(dreq));
+    dreq.handle = buf->handle;
+    drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+    return ret;
+}
+
+void modeset_destroy_fb(int fd, struct modeset_buf *buf)
+{
+    struct drm_mode_destroy_dumb dreq;
+
+    munmap(buf->map, buf->size);
+
+    drmModeRmFB(fd, buf->fb);
+
+    memset(&dreq, 0, sizeof(dreq));
+    dreq.handle = buf->handle;
+    drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+}
+
+void modeset_pool_init(struct modeset_pool *pool, int fd)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->fd = fd;
+}
+
+int modeset_pool_get(struct modeset_pool *pool, struct modeset_buf *buf)
+{
+    unsigned int i;
+
+    if (!buf->format)
+        buf->format = DRM_FORMAT_XRGB8888;
+
+    for (i = 0; i < pool->count; ++i) {
+        if (pool->bufs[i].width == buf->width && pool->bufs[i].height == buf->height &&
+            pool->bufs[i].format == buf->format) {
+            *buf = pool->bufs[i];
+            --pool->count;
+            memmove(&pool->bufs[i], &pool->bufs[i + 1], (pool->count - i) * sizeof(pool->bufs[0]));
+            return 0;
+        }
+    }
+
+    return modeset_create_fb(pool->fd, buf);
+}
+
+void modeset_pool_put(struct modeset_pool *pool, struct modeset_buf *buf)
+{
+    if (!buf->fb)
+        return;
+
+    /* evict the least recently released buffer when the pool is full */
+    if (pool->count == MODESET_POOL_SIZE) {
+        modeset_destroy_fb(pool->fd, &pool->bufs[0]);
+        memmove(&pool->bufs[0], &pool->bufs[1], (MODESET_POOL_SIZE - 1) * sizeof(pool->bufs[0]));
+        --pool->count;
+    }
+
+    pool->bufs[pool->count++] = *buf;
+    memset(buf, 0, sizeof(*buf));
+}
+
+void modeset_pool_fini(struct modeset_pool *pool)
+{
+    while (pool->count)
+        modeset_destroy_fb(pool->fd, &pool->bufs[--pool->count]);
+}
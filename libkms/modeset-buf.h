@@ -0,0 +1,41 @@
+#ifndef MODESET_BUF_H
+#define MODESET_BUF_H
+
+#include <stdint.h>
+
+struct modeset_buf {
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t stride;
+    uint32_t size;
+    uint32_t handle;
+    uint8_t *map;
+    uint32_t fb;
+};
+
+/*
+ * Cache of released dumb buffers keyed by (width, height, format). A buffer
+ * taken from the pool keeps its handle, framebuffer and mapping, so a mode
+ * change or output restart costs no ioctl, mmap or page fault. Recycled
+ * buffers are not cleared and still hold their last contents.
+ */
+#define MODESET_POOL_SIZE 16
+
+struct modeset_pool {
+    int fd;
+    unsigned int count;
+    struct modeset_buf bufs[MODESET_POOL_SIZE];
+};
+
+uint32_t modeset_format_bpp(uint32_t format);
+
+int modeset_create_fb(int fd, struct modeset_buf *buf);
+void modeset_destroy_fb(int fd, struct modeset_buf *buf);
+
+void modeset_pool_init(struct modeset_pool *pool, int fd);
+int modeset_pool_get(struct modeset_pool *pool, struct modeset_buf *buf);
+void modeset_pool_put(struct modeset_pool *pool, struct modeset_buf *buf);
+void modeset_pool_fini(struct modeset_pool *pool);
+
+#endif
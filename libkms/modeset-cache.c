@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "modeset-cache.h"
+
+#define MODESET_CACHE_MAGIC 0x4b4d5343 /* "CSMK" */
+#define MODESET_CACHE_VERSION 3
+
+struct modeset_cache_file {
+    uint32_t magic;
+    uint32_t version;
+    /* struct layout changes invalidate the file just like a version bump */
+    uint32_t size_topo;
+    uint32_t size_assign;
+    uint64_t rdev;
+    uint32_t caps;
+    /* driver and kernel updates may renumber properties behind unchanged objects */
+    char driver[32];
+    int32_t driver_version[3];
+    char kernel[65];
+    uint64_t edid_hash[MODESET_TOPO_MAX_CONNECTORS];
+    struct modeset_topo topo;
+    struct modeset_assign assign;
+};
+
+static int modeset_cache_path(int fd, char *path, size_t size, uint64_t *rdev)
+{
+    const char *dir = getenv("MODESET_CACHE");
+    struct stat st;
+
+    if (!dir || !*dir)
+        return -ENOENT;
+    if (fstat(fd, &st))
+        return -errno;
+
+    *rdev = st.st_rdev;
+    snprintf(path, size, "%s/modeset-%u-%u.cache", dir, major(st.st_rdev), minor(st.st_rdev));
+    return 0;
+}
+
+struct modeset_cache_key {
+    char driver[32];
+    int32_t driver_version[3];
+    char kernel[65];
+};
+
+static void modeset_cache_get_key(int fd, struct modeset_cache_key *key)
+{
+    drmVersion *version = drmGetVersion(fd);
+    struct utsname uts;
+
+    memset(key, 0, sizeof(*key));
+    if (version) {
+        snprintf(key->driver, sizeof(key->driver), "%s", version->name);
+        key->driver_version[0] = version->version_major;
+        key->driver_version[1] = version->version_minor;
+        key->driver_version[2] = version->version_patchlevel;
+        drmFreeVersion(version);
+    }
+    if (!uname(&uts))
+        snprintf(key->kernel, sizeof(key->kernel), "%s", uts.release);
+}
+
+/* FNV-1a over the EDID blob, 0 for connectors without one */
+static uint64_t modeset_cache_edid_hash(int fd, uint64_t blob_id)
+{
+    drmModePropertyBlobRes *blob;
+    const uint8_t *data;
+    uint64_t hash = 0xcbf29ce484222325ull;
+    uint32_t i;
+
+    if (!blob_id)
+        return 0;
+
+    blob = drmModeGetPropertyBlob(fd, blob_id);
+    if (!blob)
+        return 0;
+
+    data = blob->data;
+    for (i = 0; i < blob->length; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    drmModeFreePropertyBlob(blob);
+
+    return hash;
+}
+
+/* pick the values of the properties we track out of a freshly read list */
+static void modeset_cache_update_values(struct drm_object *obj, const uint32_t *props, const uint64_t *values,
+                                        uint32_t count)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < count; ++i) {
+        for (j = 0; j < MODESET_PROP_COUNT; ++j) {
+            if (obj->prop_ids[j] && obj->prop_ids[j] == props[i]) {
+                obj->prop_values[j] = values[i];
+                break;
+            }
+        }
+    }
+}
+
+static void modeset_cache_refresh_object(int fd, struct drm_object *obj, uint32_t type)
+{
+    drmModeObjectProperties *props;
+
+    props = drmModeObjectGetProperties(fd, obj->id, type);
+    if (props) {
+        modeset_cache_update_values(obj, props->props, props->prop_values, props->count_props);
+        drmModeFreeObjectProperties(props);
+    }
+}
+
+static bool modeset_cache_index_ok(int index, unsigned int count)
+{
+    return index >= -1 && index < (int)count;
+}
+
+/* the file is only trusted as far as its indices stay inside the tables */
+static bool modeset_cache_check_bounds(const struct modeset_topo *topo, const struct modeset_assign *assign)
+{
+    unsigned int i;
+
+    if (topo->count_connectors > MODESET_TOPO_MAX_CONNECTORS || topo->count_encoders > MODESET_TOPO_MAX_ENCODERS ||
+        topo->count_crtcs > MODESET_TOPO_MAX_CRTCS || topo->count_planes > MODESET_TOPO_MAX_PLANES ||
+        assign->count_lit > topo->count_connectors)
+        return false;
+
+    for (i = 0; i < topo->count_connectors; ++i) {
+        if (!modeset_cache_index_ok(topo->connectors[i].crtc, topo->count_crtcs) ||
+            !modeset_cache_index_ok(assign->conn_crtc[i], topo->count_crtcs))
+            return false;
+    }
+    for (i = 0; i < topo->count_encoders; ++i) {
+        if (!modeset_cache_index_ok(topo->encoders[i].crtc, topo->count_crtcs))
+            return false;
+    }
+    for (i = 0; i < topo->count_crtcs; ++i) {
+        if (!modeset_cache_index_ok(assign->crtc_primary[i], topo->count_planes))
+            return false;
+    }
+    for (i = 0; i < topo->count_planes; ++i) {
+        if (!modeset_cache_index_ok(assign->plane_crtc[i], topo->count_crtcs))
+            return false;
+    }
+
+    return true;
+}
+
+/* the cheap part of a probe: ID lists, cached connector state and EDID blobs */
+static bool modeset_cache_validate(int fd, const struct modeset_cache_file *file, struct modeset_topo *topo)
+{
+    const struct modeset_topo *cached = &file->topo;
+    struct modeset_topo_connector *tc;
+    struct modeset_topo_crtc *tcrtc;
+    drmModePlaneRes *plane_res;
+    drmModeConnector *conn;
+    drmModeEncoder *enc;
+    drmModeCrtc *crtc;
+    drmModeRes *res;
+    uint64_t edid;
+    bool ret = false;
+    uint32_t i;
+    int j;
+
+    if (!modeset_cache_check_bounds(cached, &file->assign))
+        return false;
+
+    res = drmModeGetResources(fd);
+    plane_res = drmModeGetPlaneResources(fd);
+    if (!res || !plane_res)
+        goto out;
+
+    /* the plane list depends on the client caps, compare it with the snapshot itself */
+    if ((uint32_t)res->count_connectors != cached->count_connectors ||
+        (uint32_t)res->count_encoders != cached->count_encoders ||
+        (uint32_t)res->count_crtcs != cached->count_crtcs || plane_res->count_planes != cached->count_planes)
+        goto out;
+
+    for (i = 0; i < cached->count_encoders; ++i) {
+        if (res->encoders[i] != cached->encoders[i].id)
+            goto out;
+    }
+    for (i = 0; i < cached->count_crtcs; ++i) {
+        if (res->crtcs[i] != cached->crtcs[i].obj.id)
+            goto out;
+    }
+    for (i = 0; i < cached->count_planes; ++i) {
+        if (plane_res->planes[i] != cached->planes[i].obj.id)
+            goto out;
+    }
+
+    memcpy(topo, cached, sizeof(*topo));
+
+    for (i = 0; i < topo->count_connectors; ++i) {
+        tc = &topo->connectors[i];
+        if (res->connectors[i] != tc->obj.id)
+            goto out;
+
+        conn = drmModeGetConnectorCurrent(fd, tc->obj.id);
+        if (!conn)
+            goto out;
+
+        edid = 0;
+        for (j = 0; j < conn->count_props; ++j) {
+            if (tc->obj.prop_ids[MODESET_PROP_EDID] && conn->props[j] == tc->obj.prop_ids[MODESET_PROP_EDID])
+                edid = conn->prop_values[j];
+        }
+
+        if (conn->connection != tc->connection ||
+            (conn->connection == DRM_MODE_CONNECTED && !conn->count_modes) ||
+            modeset_cache_edid_hash(fd, edid) != file->edid_hash[i]) {
+            drmModeFreeConnector(conn);
+            goto out;
+        }
+
+        /* routing is live state, the cache only vouches for what is plugged in */
+        modeset_cache_update_values(&tc->obj, conn->props, conn->prop_values, conn->count_props);
+        tc->crtc = -1;
+        if (conn->encoder_id) {
+            enc = drmModeGetEncoder(fd, conn->encoder_id);
+            if (enc) {
+                if (enc->crtc_id)
+                    tc->crtc = modeset_topo_crtc_index(topo, enc->crtc_id);
+                drmModeFreeEncoder(enc);
+            }
+        }
+        drmModeFreeConnector(conn);
+    }
+
+    for (i = 0; i < topo->count_crtcs; ++i) {
+        tcrtc = &topo->crtcs[i];
+        crtc = drmModeGetCrtc(fd, tcrtc->obj.id);
+        if (crtc) {
+            tcrtc->fb = crtc->buffer_id;
+            tcrtc->mode_valid = crtc->mode_valid;
+            tcrtc->mode = crtc->mode;
+            drmModeFreeCrtc(crtc);
+        }
+        modeset_cache_refresh_object(fd, &tcrtc->obj, DRM_MODE_OBJECT_CRTC);
+    }
+
+    for (i = 0; i < topo->count_planes; ++i)
+        modeset_cache_refresh_object(fd, &topo->planes[i].obj, DRM_MODE_OBJECT_PLANE);
+
+    ret = true;
+
+out:
+    drmModeFreePlaneResources(plane_res);
+    drmModeFreeResources(res);
+    return ret;
+}
+
+/* returns 0 and fills topo and assign if the cached configuration still fits the device */
+int modeset_cache_load(int fd, uint32_t caps, struct modeset_topo *topo, struct modeset_assign *assign)
+{
+    const struct modeset_cache_file *file;
+    struct modeset_cache_key key;
+    char path[256];
+    uint64_t rdev;
+    struct stat st;
+    int cache_fd, ret;
+
+    ret = modeset_cache_path(fd, path, sizeof(path), &rdev);
+    if (ret)
+        return ret;
+
+    cache_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (cache_fd < 0)
+        return -errno;
+
+    if (fstat(cache_fd, &st) || st.st_size != sizeof(*file)) {
+        close(cache_fd);
+        return -EINVAL;
+    }
+
+    file = mmap(NULL, sizeof(*file), PROT_READ, MAP_PRIVATE, cache_fd, 0);
+    close(cache_fd);
+    if (file == MAP_FAILED)
+        return -errno;
+
+    modeset_cache_get_key(fd, &key);
+    ret = -ESTALE;
+    if (file->magic == MODESET_CACHE_MAGIC && file->version == MODESET_CACHE_VERSION &&
+        file->size_topo == sizeof(file->topo) && file->size_assign == sizeof(file->assign) &&
+        file->rdev == rdev && file->caps == caps && !memcmp(file->driver, key.driver, sizeof(key.driver)) &&
+        !memcmp(file->driver_version, key.driver_version, sizeof(key.driver_version)) &&
+        !memcmp(file->kernel, key.kernel, sizeof(key.kernel)) && modeset_cache_validate(fd, file, topo)) {
+        memcpy(assign, &file->assign, sizeof(*assign));
+        ret = 0;
+    }
+
+    munmap((void *)file, sizeof(*file));
+
+    if (ret)
+        fprintf(stderr, "display cache '%s' is stale, probing\n", path);
+    else
+        fprintf(stderr, "display configuration from cache '%s'\n", path);
+
+    return ret;
+}
+
+int modeset_cache_store(int fd, uint32_t caps, const struct modeset_topo *topo, const struct modeset_assign *assign)
+{
+    struct modeset_cache_file *file;
+    struct modeset_cache_key key;
+    char path[256], tmp[264];
+    uint64_t rdev;
+    uint32_t i;
+    ssize_t len;
+    int cache_fd, ret;
+
+    ret = modeset_cache_path(fd, path, sizeof(path), &rdev);
+    if (ret)
+        return ret;
+
+    file = calloc(1, sizeof(*file));
+    if (!file) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    file->magic = MODESET_CACHE_MAGIC;
+    file->version = MODESET_CACHE_VERSION;
+    file->size_topo = sizeof(file->topo);
+    file->size_assign = sizeof(file->assign);
+    file->rdev = rdev;
+    file->caps = caps;
+    modeset_cache_get_key(fd, &key);
+    memcpy(file->driver, key.driver, sizeof(file->driver));
+    memcpy(file->driver_version, key.driver_version, sizeof(file->driver_version));
+    memcpy(file->kernel, key.kernel, sizeof(file->kernel));
+    for (i = 0; i < topo->count_connectors; ++i)
+        file->edid_hash[i] = modeset_cache_edid_hash(fd, topo->connectors[i].obj.prop_values[MODESET_PROP_EDID]);
+    file->topo = *topo;
+    file->assign = *assign;
+
+    /* write aside and rename, a reader never maps a half-written file */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    cache_fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (cache_fd < 0) {
+        ret = -errno;
+        goto out;
+    }
+
+    len = write(cache_fd, file, sizeof(*file));
+    if (len != (ssize_t)sizeof(*file)) {
+        ret = len < 0 ? -errno : -EIO;
+        close(cache_fd);
+        unlink(tmp);
+        goto out;
+    }
+    close(cache_fd);
+
+    if (rename(tmp, path)) {
+        ret = -errno;
+        unlink(tmp);
+    }
+
+out:
+    if (ret)
+        fprintf(stderr, "cannot write display cache '%s': %s\n", path, strerror(-ret));
+    free(file);
+    return ret;
+}
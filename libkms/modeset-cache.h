@@ -0,0 +1,33 @@
+#ifndef MODESET_CACHE_H
+#define MODESET_CACHE_H
+
+#include "modeset-assign.h"
+#include "modeset-topo.h"
+
+/*
+ * On-disk copy of the last configuration that lit a device: the topology
+ * snapshot (object and property IDs, modes, plane types) and the
+ * connector/CRTC/plane assignment. Both are flat, so the file is the
+ * structs themselves behind a small header and is read with one mmap.
+ *
+ * A cached file is only used when the live device still matches: same
+ * device node, driver version and kernel release (property IDs may move
+ * between either), same client caps at probe time (they decide which
+ * planes are listed), same connector, encoder, CRTC and plane IDs, same
+ * connection status and EDID hash for every connector. All of that comes
+ * from the kernel's cached state (drmModeGetConnectorCurrent, EDID
+ * blobs), no connector is probed. CRTC state, connector routing and the
+ * property values of every object are then refreshed from the device,
+ * so takeover and routing decisions see the present, not the cached,
+ * state.
+ *
+ * The cache lives in the directory named by MODESET_CACHE and is off
+ * when it is unset.
+ */
+#define MODESET_CACHE_CAP_UNIVERSAL_PLANES (1u << 0)
+#define MODESET_CACHE_CAP_ATOMIC (1u << 1)
+
+int modeset_cache_load(int fd, uint32_t caps, struct modeset_topo *topo, struct modeset_assign *assign);
+int modeset_cache_store(int fd, uint32_t caps, const struct modeset_topo *topo, const struct modeset_assign *assign);
+
+#endif
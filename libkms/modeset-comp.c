@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "modeset-comp.h"
+
+void modeset_comp_init(struct modeset_comp *comp, int fd, struct modeset_topo *topo, uint32_t crtc_id,
+                       uint64_t overlays)
+{
+    memset(comp, 0, sizeof(*comp));
+    comp->fd = fd;
+    comp->topo = topo;
+    comp->crtc_id = crtc_id;
+    comp->overlays = overlays;
+}
+
+void modeset_comp_clear(struct modeset_comp *comp)
+{
+    comp->count_layers = 0;
+    comp->count_cpu = 0;
+    comp->planes_used = 0;
+}
+
+static int modeset_comp_insert(struct modeset_comp *comp, enum modeset_blend_op op, struct modeset_buf *buf,
+                               uint32_t color, const struct drm_mode_rect *src, const struct drm_mode_rect *dst,
+                               int zpos)
+{
+    struct modeset_layer *layer;
+    unsigned int i;
+
+    if (comp->count_layers == MODESET_COMP_MAX_LAYERS)
+        return -ENOSPC;
+    if (src->x1 >= src->x2 || src->y1 >= src->y2 || dst->x1 >= dst->x2 || dst->y1 >= dst->y2)
+        return -EINVAL;
+
+    layer = &comp->layers[comp->count_layers];
+    layer->op = op;
+    layer->buf = buf;
+    layer->color = color;
+    layer->src = *src;
+    layer->dst = *dst;
+    layer->zpos = zpos;
+    layer->plane = -1;
+
+    /* insertion keeps equal zpos in submission order */
+    for (i = comp->count_layers; i > 0 && comp->layers[comp->order[i - 1]].zpos > zpos; --i)
+        comp->order[i] = comp->order[i - 1];
+    comp->order[i] = comp->count_layers;
+
+    return comp->count_layers++;
+}
+
+int modeset_comp_add_layer(struct modeset_comp *comp, struct modeset_buf *buf, const struct drm_mode_rect *src,
+                           const struct drm_mode_rect *dst, int zpos)
+{
+    enum modeset_blend_op op = buf->format == DRM_FORMAT_ARGB8888 ? MODESET_BLEND_OVER : MODESET_BLEND_SRC;
+
+    return modeset_comp_insert(comp, op, buf, 0, src, dst, zpos);
+}
+
+int modeset_comp_add_fill(struct modeset_comp *comp, const struct drm_mode_rect *dst, uint32_t color, int zpos)
+{
+    return modeset_comp_insert(comp, MODESET_BLEND_FILL, NULL, color, dst, dst, zpos);
+}
+
+static int modeset_comp_overlaps(const struct drm_mode_rect *a, const struct drm_mode_rect *b)
+{
+    return a->x1 < b->x2 && b->x1 < a->x2 && a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static int modeset_comp_add_plane(struct modeset_comp *comp, struct modeset_req *req, unsigned int plane,
+                                  const struct modeset_layer *layer, uint64_t zpos)
+{
+    struct modeset_topo_plane *tp = &comp->topo->planes[plane];
+    struct drm_object *obj = &tp->obj;
+
+    if (modeset_req_add(req, obj, MODESET_PROP_FB_ID, layer->buf->fb) < 0 ||
+        modeset_req_add(req, obj, MODESET_PROP_CRTC_ID, comp->crtc_id) < 0 ||
+        modeset_req_add(req, obj, MODESET_PROP_SRC_X, (uint64_t)layer->src.x1 << 16) < 0 ||
+        modeset_req_add(req, obj, MODESET_PROP_SRC_Y, (uint64_t)layer->src.y1 << 16) < 0 ||
+        modeset_req_add(req, obj, MODESET_PROP_SRC_W, (uint64_t)(layer->src.x2 - layer->src.x1) << 16) < 0 ||
+        modeset_req_add(req, obj, MODESET_PROP_SRC_H, (uint64_t)(layer->src.y2 - layer->src.y1) << 16) < 0 ||
+        modeset_req_add(req, obj, MODESET_PROP_CRTC_X, layer->dst.x1) < 0 ||
+        modeset_req_add(req, obj, MODESET_PROP_CRTC_Y, layer->dst.y1) < 0 ||
+        modeset_req_add(req, obj, MODESET_PROP_CRTC_W, layer->dst.x2 - layer->dst.x1) < 0 ||
+        modeset_req_add(req, obj, MODESET_PROP_CRTC_H, layer->dst.y2 - layer->dst.y1) < 0)
+        return -ENOSPC;
+
+    /* an immutable zpos cannot be written, the plane sits where the driver put it */
+    if (tp->zpos_min < tp->zpos_max && modeset_req_add(req, obj, MODESET_PROP_ZPOS, zpos) < 0)
+        return -ENOSPC;
+
+    return 0;
+}
+
+/* zpos of the CRTC's primary plane, the floor every overlay has to stay above */
+static bool modeset_comp_primary_zpos(const struct modeset_comp *comp, uint64_t *zpos)
+{
+    const struct modeset_topo_plane *tp;
+    bool known = false;
+    unsigned int p;
+    int crtc;
+
+    *zpos = 0;
+    crtc = modeset_topo_crtc_index(comp->topo, comp->crtc_id);
+    if (crtc < 0)
+        return false;
+
+    for (p = 0; p < comp->topo->count_planes; ++p) {
+        tp = &comp->topo->planes[p];
+        if (!(comp->topo->primary_mask & (1ull << p)) || !(tp->possible_crtcs & (1u << crtc)) || !tp->zpos_known)
+            continue;
+        if (!known || tp->obj.prop_values[MODESET_PROP_ZPOS] > *zpos)
+            *zpos = tp->obj.prop_values[MODESET_PROP_ZPOS];
+        known = true;
+    }
+
+    return known;
+}
+
+/*
+ * req holds the rest of the CRTC's state (primary plane, and the modeset
+ * itself if flags allow it). On return it additionally carries every
+ * placed layer and disables the CRTC's unused overlays, ready to commit.
+ * Returns the number of layers left to modeset_comp_paint.
+ *
+ * Layers are placed from the top down, each on the free overlay with the
+ * highest zpos that still lies below the planes of the layers above it
+ * that it overlaps. A mutable zpos is set to that value, an immutable one
+ * has to fit as it is. Planes without a zpos property stack in a driver
+ * specific order, so they only take layers that overlap no other placed
+ * layer.
+ */
+int modeset_comp_assign(struct modeset_comp *comp, struct modeset_req *req, uint32_t flags)
+{
+    uint64_t zpos[MODESET_COMP_MAX_LAYERS];
+    uint64_t cand_zpos[MODESET_TOPO_MAX_PLANES];
+    unsigned int cand[MODESET_TOPO_MAX_PLANES];
+    const struct modeset_topo_plane *tp;
+    struct modeset_layer *layer, *above;
+    unsigned int i, j, k, p, count_cand;
+    uint64_t floor, ceiling, z;
+    bool floor_known, overlaps_unknown, overlaps_placed;
+    int cursor;
+
+    comp->planes_used = 0;
+    comp->count_cpu = 0;
+    cursor = modeset_req_get_cursor(req);
+    floor_known = modeset_comp_primary_zpos(comp, &floor);
+
+    for (i = comp->count_layers; i-- > 0;) {
+        layer = &comp->layers[comp->order[i]];
+        layer->plane = -1;
+
+        /* CPU layers end up in the primary, below every overlay */
+        ceiling = UINT64_MAX;
+        overlaps_unknown = overlaps_placed = false;
+        for (j = i + 1; j < comp->count_layers; ++j) {
+            above = &comp->layers[comp->order[j]];
+            if (!modeset_comp_overlaps(&layer->dst, &above->dst))
+                continue;
+            if (above->plane < 0)
+                break;
+
+            overlaps_placed = true;
+            if (!comp->topo->planes[above->plane].zpos_known)
+                overlaps_unknown = true;
+            else if (zpos[j] < ceiling)
+                ceiling = zpos[j];
+        }
+
+        count_cand = 0;
+        for (p = 0; layer->buf && j == comp->count_layers && p < comp->topo->count_planes; ++p) {
+            if (!(comp->overlays & ~comp->planes_used & (1ull << p)))
+                continue;
+
+            tp = &comp->topo->planes[p];
+            if (!tp->zpos_known) {
+                if (overlaps_placed)
+                    continue;
+                z = 0;
+            }
+            else {
+                if (overlaps_unknown || ceiling == 0)
+                    continue;
+                z = ceiling - 1 < tp->zpos_max ? ceiling - 1 : tp->zpos_max;
+                if (z < tp->zpos_min || (floor_known && z <= floor))
+                    continue;
+            }
+
+            /* known zpos first, highest first; planes without one keep their index order */
+            for (k = count_cand; k > 0; --k) {
+                tp = &comp->topo->planes[cand[k - 1]];
+                if (!comp->topo->planes[p].zpos_known || (tp->zpos_known && cand_zpos[k - 1] >= z))
+                    break;
+                cand[k] = cand[k - 1];
+                cand_zpos[k] = cand_zpos[k - 1];
+            }
+            cand[k] = p;
+            cand_zpos[k] = z;
+            ++count_cand;
+        }
+
+        for (k = 0; k < count_cand; ++k) {
+            p = cand[k];
+            if (!modeset_comp_add_plane(comp, req, p, layer, cand_zpos[k]) &&
+                !modeset_req_commit(comp->fd, req, flags | DRM_MODE_ATOMIC_TEST_ONLY, NULL)) {
+                cursor = modeset_req_get_cursor(req);
+                comp->planes_used |= 1ull << p;
+                layer->plane = p;
+                zpos[i] = cand_zpos[k];
+                break;
+            }
+            modeset_req_set_cursor(req, cursor);
+        }
+
+        if (layer->plane < 0)
+            ++comp->count_cpu;
+    }
+
+    for (p = 0; p < comp->topo->count_planes; ++p) {
+        if (!(comp->overlays & ~comp->planes_used & (1ull << p)))
+            continue;
+        modeset_req_add(req, &comp->topo->planes[p].obj, MODESET_PROP_FB_ID, 0);
+        modeset_req_add(req, &comp->topo->planes[p].obj, MODESET_PROP_CRTC_ID, 0);
+    }
+
+    return comp->count_cpu;
+}
+
+void modeset_comp_paint(const struct modeset_comp *comp, struct modeset_buf *dst)
+{
+    struct modeset_blend_layer blend[MODESET_COMP_MAX_LAYERS];
+    const struct modeset_layer *layer;
+    unsigned int i, count = 0;
+
+    for (i = 0; i < comp->count_layers; ++i) {
+        layer = &comp->layers[comp->order[i]];
+        if (layer->plane >= 0)
+            continue;
+
+        blend[count].op = layer->op;
+        blend[count].buf = layer->buf;
+        blend[count].color = layer->color;
+        blend[count].src = layer->src;
+        blend[count].dst = layer->dst;
+        ++count;
+    }
+
+    modeset_blend(dst, blend, count, 0);
+}
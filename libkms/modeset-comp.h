@@ -0,0 +1,62 @@
+#ifndef MODESET_COMP_H
+#define MODESET_COMP_H
+
+#include <stdint.h>
+#include <xf86drm.h>
+
+#include "modeset-blend.h"
+#include "modeset-buf.h"
+#include "modeset-req.h"
+#include "modeset-topo.h"
+
+/*
+ * Layer compositor for one CRTC. Layers are stacked by zpos and offered
+ * to the CRTC's overlay planes from the top down, in the order of the
+ * planes' own zpos, so overlapping layers keep their stacking on the
+ * scanout; a plane is kept only if a TEST_ONLY commit of the whole state
+ * including it passes. Overlays are only used above the primary's zpos;
+ * planes without a zpos property are assumed above the primary, as is
+ * the convention, but take no layer that overlaps another placed one. A
+ * layer that gets no plane is painted into the primary framebuffer by the
+ * CPU, and so is every layer below that it overlaps. Buffers with an
+ * alpha channel are treated as premultiplied, like the KMS default pixel
+ * blend mode; solid fills never get a plane.
+ */
+#define MODESET_COMP_MAX_LAYERS 8
+
+struct modeset_layer {
+    enum modeset_blend_op op;
+    struct modeset_buf *buf;
+    uint32_t color;
+    /* src in buffer pixels, dst in CRTC pixels, x2/y2 exclusive */
+    struct drm_mode_rect src;
+    struct drm_mode_rect dst;
+    int zpos;
+    /* topology plane index after modeset_comp_assign, -1 for the CPU */
+    int plane;
+};
+
+struct modeset_comp {
+    int fd;
+    struct modeset_topo *topo;
+    uint32_t crtc_id;
+    uint64_t overlays;
+    uint64_t planes_used;
+
+    unsigned int count_layers;
+    unsigned int count_cpu;
+    struct modeset_layer layers[MODESET_COMP_MAX_LAYERS];
+    /* layer indices, bottom to top */
+    unsigned int order[MODESET_COMP_MAX_LAYERS];
+};
+
+void modeset_comp_init(struct modeset_comp *comp, int fd, struct modeset_topo *topo, uint32_t crtc_id,
+                       uint64_t overlays);
+void modeset_comp_clear(struct modeset_comp *comp);
+int modeset_comp_add_layer(struct modeset_comp *comp, struct modeset_buf *buf, const struct drm_mode_rect *src,
+                           const struct drm_mode_rect *dst, int zpos);
+int modeset_comp_add_fill(struct modeset_comp *comp, const struct drm_mode_rect *dst, uint32_t color, int zpos);
+int modeset_comp_assign(struct modeset_comp *comp, struct modeset_req *req, uint32_t flags);
+void modeset_comp_paint(const struct modeset_comp *comp, struct modeset_buf *dst);
+
+#endif
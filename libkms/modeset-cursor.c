@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "modeset-cursor.h"
+
+int modeset_cursor_init(struct modeset_cursor *cursor, int fd, const struct modeset_topo *topo, unsigned int crtc,
+                        uint64_t used)
+{
+    uint64_t width = 64, height = 64;
+    int ret;
+
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->fd = fd;
+    cursor->crtc_id = topo->crtcs[crtc].obj.id;
+
+    cursor->plane_index = modeset_topo_find_plane(topo, crtc, topo->cursor_mask, used);
+    if (cursor->plane_index < 0)
+        return -ENOENT;
+    cursor->plane = topo->planes[cursor->plane_index].obj;
+
+    /* cursor planes usually only take framebuffers of exactly this size */
+    drmGetCap(fd, DRM_CAP_CURSOR_WIDTH, &width);
+    drmGetCap(fd, DRM_CAP_CURSOR_HEIGHT, &height);
+
+    cursor->buf.width = width;
+    cursor->buf.height = height;
+    cursor->buf.format = DRM_FORMAT_ARGB8888;
+    ret = modeset_create_fb(fd, &cursor->buf);
+    if (ret)
+        return ret;
+
+    modeset_req_init(&cursor->move_req);
+    cursor->move_x_slot = modeset_req_add(&cursor->move_req, &cursor->plane, MODESET_PROP_CRTC_X, 0);
+    cursor->move_y_slot = modeset_req_add(&cursor->move_req, &cursor->plane, MODESET_PROP_CRTC_Y, 0);
+
+    return 0;
+}
+
+void modeset_cursor_fini(struct modeset_cursor *cursor)
+{
+    if (cursor->buf.fb)
+        modeset_destroy_fb(cursor->fd, &cursor->buf);
+    memset(&cursor->buf, 0, sizeof(cursor->buf));
+}
+
+int modeset_cursor_set_image(struct modeset_cursor *cursor, const uint32_t *argb, uint32_t width, uint32_t height,
+                             int32_t hot_x, int32_t hot_y)
+{
+    uint32_t y;
+
+    if (width > cursor->buf.width || height > cursor->buf.height)
+        return -EINVAL;
+
+    memset(cursor->buf.map, 0, cursor->buf.size);
+    for (y = 0; y < height; ++y)
+        memcpy(cursor->buf.map + cursor->buf.stride * y, argb + width * y, width * 4);
+
+    cursor->hot_x = hot_x;
+    cursor->hot_y = hot_y;
+    return 0;
+}
+
+/* full plane state, committed once; later moves only touch the position */
+int modeset_cursor_show(struct modeset_cursor *cursor)
+{
+    struct modeset_req req;
+    struct drm_object *plane = &cursor->plane;
+    int ret;
+
+    modeset_req_init(&req);
+    if (modeset_req_add(&req, plane, MODESET_PROP_FB_ID, cursor->buf.fb) < 0 ||
+        modeset_req_add(&req, plane, MODESET_PROP_CRTC_ID, cursor->crtc_id) < 0 ||
+        modeset_req_add(&req, plane, MODESET_PROP_SRC_X, 0) < 0 ||
+        modeset_req_add(&req, plane, MODESET_PROP_SRC_Y, 0) < 0 ||
+        modeset_req_add(&req, plane, MODESET_PROP_SRC_W, cursor->buf.width << 16) < 0 ||
+        modeset_req_add(&req, plane, MODESET_PROP_SRC_H, cursor->buf.height << 16) < 0 ||
+        modeset_req_add(&req, plane, MODESET_PROP_CRTC_X, cursor->x - cursor->hot_x) < 0 ||
+        modeset_req_add(&req, plane, MODESET_PROP_CRTC_Y, cursor->y - cursor->hot_y) < 0 ||
+        modeset_req_add(&req, plane, MODESET_PROP_CRTC_W, cursor->buf.width) < 0 ||
+        modeset_req_add(&req, plane, MODESET_PROP_CRTC_H, cursor->buf.height) < 0)
+        return -EINVAL;
+
+    ret = modeset_req_commit(cursor->fd, &req, 0, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "cannot show cursor on crtc %u (%d): %m\n", cursor->crtc_id, errno);
+        return -errno;
+    }
+
+    cursor->visible = true;
+    cursor->dirty = false;
+    return 0;
+}
+
+int modeset_cursor_add_position(struct modeset_cursor *cursor, struct modeset_req *req)
+{
+    if (modeset_req_add(req, &cursor->plane, MODESET_PROP_CRTC_X, (int64_t)(cursor->x - cursor->hot_x)) < 0 ||
+        modeset_req_add(req, &cursor->plane, MODESET_PROP_CRTC_Y, (int64_t)(cursor->y - cursor->hot_y)) < 0)
+        return -ENOSPC;
+
+    cursor->dirty = false;
+    return 0;
+}
+
+int modeset_cursor_move(struct modeset_cursor *cursor, int32_t x, int32_t y, bool busy)
+{
+    cursor->x = x;
+    cursor->y = y;
+    cursor->dirty = true;
+    if (!cursor->visible || busy)
+        return MODESET_CURSOR_QUEUED;
+
+    modeset_req_set(&cursor->move_req, cursor->move_x_slot, (int64_t)(x - cursor->hot_x));
+    modeset_req_set(&cursor->move_req, cursor->move_y_slot, (int64_t)(y - cursor->hot_y));
+    if (modeset_req_commit(cursor->fd, &cursor->move_req, cursor->blocking ? 0 : DRM_MODE_ATOMIC_NONBLOCK, NULL) < 0)
+        return errno == EBUSY ? MODESET_CURSOR_QUEUED : -errno;
+
+    cursor->dirty = false;
+    return 0;
+}
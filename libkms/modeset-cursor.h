@@ -0,0 +1,55 @@
+#ifndef MODESET_CURSOR_H
+#define MODESET_CURSOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "modeset-buf.h"
+#include "modeset-req.h"
+#include "modeset-topo.h"
+
+/*
+ * Hardware cursor on a CRTC's cursor plane. The image is uploaded once
+ * into a premultiplied ARGB8888 buffer of the size the driver reports
+ * (DRM_CAP_CURSOR_WIDTH/HEIGHT), and moving it patches CRTC_X/CRTC_Y of a
+ * prebuilt request, so the primary framebuffer is never repainted. While
+ * a page flip is in flight on the CRTC a nonblocking commit would fail
+ * with EBUSY, so the caller passes busy and appends the new position to
+ * its next flip request with modeset_cursor_add_position instead.
+ *
+ * modeset_cursor_move returns 0 once the position is committed and
+ * MODESET_CURSOR_QUEUED when it is left dirty for the next flip, either
+ * because the caller said busy or because the kernel answered EBUSY.
+ * With blocking set the move is a blocking commit, which waits for the
+ * previous one instead of failing.
+ */
+#define MODESET_CURSOR_QUEUED 1
+
+struct modeset_cursor {
+    int fd;
+    uint32_t crtc_id;
+    int plane_index;
+    struct drm_object plane;
+    struct modeset_buf buf;
+
+    int32_t hot_x, hot_y;
+    int32_t x, y;
+    bool visible;
+    bool dirty;
+    bool blocking;
+
+    struct modeset_req move_req;
+    int move_x_slot;
+    int move_y_slot;
+};
+
+int modeset_cursor_init(struct modeset_cursor *cursor, int fd, const struct modeset_topo *topo, unsigned int crtc,
+                        uint64_t used);
+void modeset_cursor_fini(struct modeset_cursor *cursor);
+int modeset_cursor_set_image(struct modeset_cursor *cursor, const uint32_t *argb, uint32_t width, uint32_t height,
+                             int32_t hot_x, int32_t hot_y);
+int modeset_cursor_show(struct modeset_cursor *cursor);
+int modeset_cursor_add_position(struct modeset_cursor *cursor, struct modeset_req *req);
+int modeset_cursor_move(struct modeset_cursor *cursor, int32_t x, int32_t y, bool busy);
+
+#endif
@@ -0,0 +1,104 @@
+#define _GNU_SOURCE
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "modeset-damage.h"
+#include "modeset-util.h"
+
+int modeset_damage_enabled(uint32_t connector_id)
+{
+    return modeset_env_match("MODESET_DAMAGE", connector_id);
+}
+
+void modeset_damage_reset(struct modeset_damage *damage)
+{
+    damage->count = 0;
+}
+
+static void modeset_damage_add_rect(struct modeset_damage *damage, const struct drm_mode_rect *rect)
+{
+    struct drm_mode_rect *last;
+    unsigned int i;
+
+    if (rect->x1 >= rect->x2 || rect->y1 >= rect->y2)
+        return;
+
+    /* already covered by an existing rect */
+    for (i = 0; i < damage->count; ++i) {
+        if (damage->rects[i].x1 <= rect->x1 && damage->rects[i].y1 <= rect->y1 &&
+            damage->rects[i].x2 >= rect->x2 && damage->rects[i].y2 >= rect->y2)
+            return;
+    }
+
+    if (damage->count < MODESET_DAMAGE_MAX_RECTS) {
+        damage->rects[damage->count++] = *rect;
+        return;
+    }
+
+    last = &damage->rects[damage->count - 1];
+    if (rect->x1 < last->x1)
+        last->x1 = rect->x1;
+    if (rect->y1 < last->y1)
+        last->y1 = rect->y1;
+    if (rect->x2 > last->x2)
+        last->x2 = rect->x2;
+    if (rect->y2 > last->y2)
+        last->y2 = rect->y2;
+}
+
+void modeset_damage_add(struct modeset_damage *damage, int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    struct drm_mode_rect rect = {
+        .x1 = x,
+        .y1 = y,
+        .x2 = x + w,
+        .y2 = y + h,
+    };
+
+    modeset_damage_add_rect(damage, &rect);
+}
+
+void modeset_damage_merge(struct modeset_damage *damage, const struct modeset_damage *other)
+{
+    unsigned int i;
+
+    for (i = 0; i < other->count; ++i)
+        modeset_damage_add_rect(damage, &other->rects[i]);
+}
+
+int modeset_damage_create_blob(int fd, const struct modeset_damage *damage, uint32_t *blob_id)
+{
+    int ret;
+
+    ret = drmModeCreatePropertyBlob(fd, damage->rects, damage->count * sizeof(damage->rects[0]), blob_id);
+    if (ret) {
+        fprintf(stderr, "cannot create damage blob (%d): %m\n", errno);
+        return -errno;
+    }
+
+    return 0;
+}
+
+int modeset_damage_dirtyfb(int fd, uint32_t fb, const struct modeset_damage *damage)
+{
+    drmModeClip clips[MODESET_DAMAGE_MAX_RECTS];
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < damage->count; ++i) {
+        clips[i].x1 = damage->rects[i].x1;
+        clips[i].y1 = damage->rects[i].y1;
+        clips[i].x2 = damage->rects[i].x2;
+        clips[i].y2 = damage->rects[i].y2;
+    }
+
+    ret = drmModeDirtyFB(fd, fb, clips, damage->count);
+    /* drivers that scan out straight from memory do not implement DIRTYFB */
+    if (ret && errno != ENOSYS)
+        return -errno;
+
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef MODESET_DAMAGE_H
+#define MODESET_DAMAGE_H
+
+#include <stdint.h>
+#include <xf86drm.h>
+
+/*
+ * Accumulated dirty rectangles in framebuffer coordinates (x2/y2 exclusive).
+ * Once MODESET_DAMAGE_MAX_RECTS is reached further rects are folded into
+ * the bounding box of the last one, which keeps the list bounded without
+ * ever losing damage.
+ */
+#define MODESET_DAMAGE_MAX_RECTS 8
+
+struct modeset_damage {
+    unsigned int count;
+    struct drm_mode_rect rects[MODESET_DAMAGE_MAX_RECTS];
+};
+
+int modeset_damage_enabled(uint32_t connector_id);
+
+void modeset_damage_reset(struct modeset_damage *damage);
+void modeset_damage_add(struct modeset_damage *damage, int32_t x, int32_t y, int32_t w, int32_t h);
+void modeset_damage_merge(struct modeset_damage *damage, const struct modeset_damage *other);
+
+int modeset_damage_create_blob(int fd, const struct modeset_damage *damage, uint32_t *blob_id);
+int modeset_damage_dirtyfb(int fd, uint32_t fb, const struct modeset_damage *damage);
+
+#endif
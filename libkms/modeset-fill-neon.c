@@ -0,0 +1,138 @@
+#if defined(__aarch64__)
+#include <stdint.h>
+#include <arm_neon.h>
+
+#include "modeset-fill.h"
+
+static void neon_fill_row(uint32_t *dst, uint32_t color, uint32_t count)
+{
+    uint32x4_t v = vdupq_n_u32(color);
+
+    for (; count >= 16; count -= 16, dst += 16) {
+        vst1q_u32(dst, v);
+        vst1q_u32(dst + 4, v);
+        vst1q_u32(dst + 8, v);
+        vst1q_u32(dst + 12, v);
+    }
+
+    for (; count >= 4; count -= 4, dst += 4)
+        vst1q_u32(dst, v);
+
+    while (count--)
+        *dst++ = color;
+}
+
+static void neon_copy_row(uint32_t *dst, const uint32_t *src, uint32_t count)
+{
+    for (; count >= 16; count -= 16, dst += 16, src += 16) {
+        uint32x4_t a = vld1q_u32(src);
+        uint32x4_t b = vld1q_u32(src + 4);
+        uint32x4_t c = vld1q_u32(src + 8);
+        uint32x4_t d = vld1q_u32(src + 12);
+        vst1q_u32(dst, a);
+        vst1q_u32(dst + 4, b);
+        vst1q_u32(dst + 8, c);
+        vst1q_u32(dst + 12, d);
+    }
+
+    while (count--)
+        *dst++ = *src++;
+}
+
+static void neon_stream_fill_row(uint32_t *dst, uint32_t color, uint32_t count)
+{
+    uint32x4_t v = vdupq_n_u32(color);
+
+    while (count && ((uintptr_t)dst & 63)) {
+        *dst++ = color;
+        --count;
+    }
+
+    for (; count >= 16; count -= 16, dst += 16) {
+        __asm__ volatile("stnp %q[v], %q[v], [%[p]]\n\t"
+                         "stnp %q[v], %q[v], [%[p], #32]"
+                         : : [v] "w"(v), [p] "r"(dst) : "memory");
+    }
+
+    while (count--)
+        *dst++ = color;
+}
+
+static void neon_stream_copy_row(uint32_t *dst, const uint32_t *src, uint32_t count)
+{
+    while (count && ((uintptr_t)dst & 63)) {
+        *dst++ = *src++;
+        --count;
+    }
+
+    for (; count >= 16; count -= 16, dst += 16, src += 16) {
+        uint32x4_t a = vld1q_u32(src);
+        uint32x4_t b = vld1q_u32(src + 4);
+        uint32x4_t c = vld1q_u32(src + 8);
+        uint32x4_t d = vld1q_u32(src + 12);
+        __asm__ volatile("stnp %q[a], %q[b], [%[p]]\n\t"
+                         "stnp %q[c], %q[d], [%[p], #32]"
+                         : : [a] "w"(a), [b] "w"(b), [c] "w"(c), [d] "w"(d), [p] "r"(dst) : "memory");
+    }
+
+    while (count--)
+        *dst++ = *src++;
+}
+
+/* 4 pixels, see scalar_over; vrsra + vrshrn is (x + ((x + 128) >> 8) + 128) >> 8 */
+static inline uint8x16_t neon_over(uint8x16_t d, uint8x16_t s)
+{
+    uint8x16_t ia = vmvnq_u8(vreinterpretq_u8_u32(vmulq_n_u32(vshrq_n_u32(vreinterpretq_u32_u8(s), 24), 0x01010101)));
+    uint16x8_t lo = vmull_u8(vget_low_u8(d), vget_low_u8(ia));
+    uint16x8_t hi = vmull_u8(vget_high_u8(d), vget_high_u8(ia));
+
+    lo = vrsraq_n_u16(lo, lo, 8);
+    hi = vrsraq_n_u16(hi, hi, 8);
+    return vaddq_u8(s, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+}
+
+static void neon_blend_row(uint32_t *dst, const uint32_t *src, uint32_t count)
+{
+    uint32x4_t s;
+
+    for (; count >= 4; count -= 4, dst += 4, src += 4) {
+        s = vld1q_u32(src);
+        if (vminvq_u32(s) >= 0xff000000) {
+            vst1q_u32(dst, s);
+            continue;
+        }
+        if (!vmaxvq_u32(s))
+            continue;
+        vst1q_u32(dst, vreinterpretq_u32_u8(neon_over(vreinterpretq_u8_u32(vld1q_u32(dst)),
+                                                       vreinterpretq_u8_u32(s))));
+    }
+
+    modeset_fill_scalar_ops.blend_row(dst, src, count);
+}
+
+static void neon_blend_solid_row(uint32_t *dst, uint32_t color, uint32_t count)
+{
+    uint8x16_t s = vreinterpretq_u8_u32(vdupq_n_u32(color));
+
+    for (; count >= 4; count -= 4, dst += 4)
+        vst1q_u32(dst, vreinterpretq_u32_u8(neon_over(vreinterpretq_u8_u32(vld1q_u32(dst)), s)));
+
+    modeset_fill_scalar_ops.blend_solid_row(dst, color, count);
+}
+
+static void neon_stream_fence(void)
+{
+    __asm__ volatile("dsb st" : : : "memory");
+}
+
+const struct modeset_fill_ops modeset_fill_neon_ops = {
+    .name = "neon",
+    .fill_row = neon_fill_row,
+    .copy_row = neon_copy_row,
+    .stream_fill_row = neon_stream_fill_row,
+    .stream_copy_row = neon_stream_copy_row,
+    .stream_fence = neon_stream_fence,
+    .blend_row = neon_blend_row,
+    .blend_solid_row = neon_blend_solid_row,
+};
+#endif
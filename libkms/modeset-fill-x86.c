@@ -0,0 +1,310 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "modeset-fill.h"
+
+__attribute__((target("sse2")))
+static void sse2_fill_row(uint32_t *dst, uint32_t color, uint32_t count)
+{
+    __m128i v = _mm_set1_epi32(color);
+
+    while (count && ((uintptr_t)dst & 15)) {
+        *dst++ = color;
+        --count;
+    }
+
+    for (; count >= 16; count -= 16, dst += 16) {
+        _mm_store_si128((__m128i *)dst, v);
+        _mm_store_si128((__m128i *)(dst + 4), v);
+        _mm_store_si128((__m128i *)(dst + 8), v);
+        _mm_store_si128((__m128i *)(dst + 12), v);
+    }
+
+    for (; count >= 4; count -= 4, dst += 4)
+        _mm_store_si128((__m128i *)dst, v);
+
+    while (count--)
+        *dst++ = color;
+}
+
+__attribute__((target("sse2")))
+static void sse2_copy_row(uint32_t *dst, const uint32_t *src, uint32_t count)
+{
+    while (count && ((uintptr_t)dst & 15)) {
+        *dst++ = *src++;
+        --count;
+    }
+
+    for (; count >= 8; count -= 8, dst += 8, src += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)src);
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 4));
+        _mm_store_si128((__m128i *)dst, a);
+        _mm_store_si128((__m128i *)(dst + 4), b);
+    }
+
+    while (count--)
+        *dst++ = *src++;
+}
+
+__attribute__((target("avx2")))
+static void avx2_fill_row(uint32_t *dst, uint32_t color, uint32_t count)
+{
+    __m256i v = _mm256_set1_epi32(color);
+
+    while (count && ((uintptr_t)dst & 31)) {
+        *dst++ = color;
+        --count;
+    }
+
+    for (; count >= 32; count -= 32, dst += 32) {
+        _mm256_store_si256((__m256i *)dst, v);
+        _mm256_store_si256((__m256i *)(dst + 8), v);
+        _mm256_store_si256((__m256i *)(dst + 16), v);
+        _mm256_store_si256((__m256i *)(dst + 24), v);
+    }
+
+    for (; count >= 8; count -= 8, dst += 8)
+        _mm256_store_si256((__m256i *)dst, v);
+
+    while (count--)
+        *dst++ = color;
+}
+
+__attribute__((target("avx2")))
+static void avx2_copy_row(uint32_t *dst, const uint32_t *src, uint32_t count)
+{
+    while (count && ((uintptr_t)dst & 31)) {
+        *dst++ = *src++;
+        --count;
+    }
+
+    for (; count >= 16; count -= 16, dst += 16, src += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)src);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + 8));
+        _mm256_store_si256((__m256i *)dst, a);
+        _mm256_store_si256((__m256i *)(dst + 8), b);
+    }
+
+    while (count--)
+        *dst++ = *src++;
+}
+
+__attribute__((target("sse2")))
+static void sse2_stream_fill_row(uint32_t *dst, uint32_t color, uint32_t count)
+{
+    __m128i v = _mm_set1_epi32(color);
+
+    while (count && ((uintptr_t)dst & 63)) {
+        *dst++ = color;
+        --count;
+    }
+
+    for (; count >= 16; count -= 16, dst += 16) {
+        _mm_stream_si128((__m128i *)dst, v);
+        _mm_stream_si128((__m128i *)(dst + 4), v);
+        _mm_stream_si128((__m128i *)(dst + 8), v);
+        _mm_stream_si128((__m128i *)(dst + 12), v);
+    }
+
+    while (count--)
+        *dst++ = color;
+}
+
+__attribute__((target("sse2")))
+static void sse2_stream_copy_row(uint32_t *dst, const uint32_t *src, uint32_t count)
+{
+    while (count && ((uintptr_t)dst & 63)) {
+        *dst++ = *src++;
+        --count;
+    }
+
+    for (; count >= 16; count -= 16, dst += 16, src += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)src);
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 4));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + 8));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + 12));
+        _mm_stream_si128((__m128i *)dst, a);
+        _mm_stream_si128((__m128i *)(dst + 4), b);
+        _mm_stream_si128((__m128i *)(dst + 8), c);
+        _mm_stream_si128((__m128i *)(dst + 12), d);
+    }
+
+    while (count--)
+        *dst++ = *src++;
+}
+
+__attribute__((target("avx2")))
+static void avx2_stream_fill_row(uint32_t *dst, uint32_t color, uint32_t count)
+{
+    __m256i v = _mm256_set1_epi32(color);
+
+    while (count && ((uintptr_t)dst & 63)) {
+        *dst++ = color;
+        --count;
+    }
+
+    for (; count >= 16; count -= 16, dst += 16) {
+        _mm256_stream_si256((__m256i *)dst, v);
+        _mm256_stream_si256((__m256i *)(dst + 8), v);
+    }
+
+    while (count--)
+        *dst++ = color;
+}
+
+__attribute__((target("avx2")))
+static void avx2_stream_copy_row(uint32_t *dst, const uint32_t *src, uint32_t count)
+{
+    while (count && ((uintptr_t)dst & 63)) {
+        *dst++ = *src++;
+        --count;
+    }
+
+    for (; count >= 16; count -= 16, dst += 16, src += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)src);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + 8));
+        _mm256_stream_si256((__m256i *)dst, a);
+        _mm256_stream_si256((__m256i *)(dst + 8), b);
+    }
+
+    while (count--)
+        *dst++ = *src++;
+}
+
+/* 4 pixels widened to 16 bits per channel, see scalar_over for the rounding */
+__attribute__((target("sse2")))
+static inline __m128i sse2_over_half(__m128i d, __m128i s)
+{
+    __m128i a, t;
+
+    a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    t = _mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), a));
+    t = _mm_add_epi16(t, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_over(__m128i d, __m128i s)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = sse2_over_half(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero));
+    __m128i hi = sse2_over_half(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero));
+
+    return _mm_add_epi8(s, _mm_packus_epi16(lo, hi));
+}
+
+__attribute__((target("sse2")))
+static void sse2_blend_row(uint32_t *dst, const uint32_t *src, uint32_t count)
+{
+    const __m128i opaque = _mm_set1_epi32(0xff000000);
+    __m128i s, a;
+
+    for (; count >= 4; count -= 4, dst += 4, src += 4) {
+        s = _mm_loadu_si128((const __m128i *)src);
+        a = _mm_cmpeq_epi32(_mm_and_si128(s, opaque), opaque);
+        if (_mm_movemask_epi8(a) == 0xffff) {
+            _mm_storeu_si128((__m128i *)dst, s);
+            continue;
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, _mm_setzero_si128())) == 0xffff)
+            continue;
+        _mm_storeu_si128((__m128i *)dst, sse2_over(_mm_loadu_si128((const __m128i *)dst), s));
+    }
+
+    modeset_fill_scalar_ops.blend_row(dst, src, count);
+}
+
+__attribute__((target("sse2")))
+static void sse2_blend_solid_row(uint32_t *dst, uint32_t color, uint32_t count)
+{
+    __m128i s = _mm_set1_epi32(color);
+
+    for (; count >= 4; count -= 4, dst += 4)
+        _mm_storeu_si128((__m128i *)dst, sse2_over(_mm_loadu_si128((const __m128i *)dst), s));
+
+    modeset_fill_scalar_ops.blend_solid_row(dst, color, count);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_over_half(__m256i d, __m256i s)
+{
+    __m256i a, t;
+
+    a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    t = _mm256_mullo_epi16(d, _mm256_sub_epi16(_mm256_set1_epi16(255), a));
+    t = _mm256_add_epi16(t, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+/* unpack and pack both work within 128-bit lanes, so pixel order survives */
+__attribute__((target("avx2")))
+static inline __m256i avx2_over(__m256i d, __m256i s)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo = avx2_over_half(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(s, zero));
+    __m256i hi = avx2_over_half(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(s, zero));
+
+    return _mm256_add_epi8(s, _mm256_packus_epi16(lo, hi));
+}
+
+__attribute__((target("avx2")))
+static void avx2_blend_row(uint32_t *dst, const uint32_t *src, uint32_t count)
+{
+    const __m256i opaque = _mm256_set1_epi32(0xff000000);
+    __m256i s, a;
+
+    for (; count >= 8; count -= 8, dst += 8, src += 8) {
+        s = _mm256_loadu_si256((const __m256i *)src);
+        a = _mm256_cmpeq_epi32(_mm256_and_si256(s, opaque), opaque);
+        if (_mm256_movemask_epi8(a) == -1) {
+            _mm256_storeu_si256((__m256i *)dst, s);
+            continue;
+        }
+        if (_mm256_testz_si256(s, s))
+            continue;
+        _mm256_storeu_si256((__m256i *)dst, avx2_over(_mm256_loadu_si256((const __m256i *)dst), s));
+    }
+
+    modeset_fill_scalar_ops.blend_row(dst, src, count);
+}
+
+__attribute__((target("avx2")))
+static void avx2_blend_solid_row(uint32_t *dst, uint32_t color, uint32_t count)
+{
+    __m256i s = _mm256_set1_epi32(color);
+
+    for (; count >= 8; count -= 8, dst += 8)
+        _mm256_storeu_si256((__m256i *)dst, avx2_over(_mm256_loadu_si256((const __m256i *)dst), s));
+
+    modeset_fill_scalar_ops.blend_solid_row(dst, color, count);
+}
+
+__attribute__((target("sse2")))
+static void x86_stream_fence(void)
+{
+    _mm_sfence();
+}
+
+const struct modeset_fill_ops modeset_fill_sse2_ops = {
+    .name = "sse2",
+    .fill_row = sse2_fill_row,
+    .copy_row = sse2_copy_row,
+    .stream_fill_row = sse2_stream_fill_row,
+    .stream_copy_row = sse2_stream_copy_row,
+    .stream_fence = x86_stream_fence,
+    .blend_row = sse2_blend_row,
+    .blend_solid_row = sse2_blend_solid_row,
+};
+
+const struct modeset_fill_ops modeset_fill_avx2_ops = {
+    .name = "avx2",
+    .fill_row = avx2_fill_row,
+    .copy_row = avx2_copy_row,
+    .stream_fill_row = avx2_stream_fill_row,
+    .stream_copy_row = avx2_stream_copy_row,
+    .stream_fence = x86_stream_fence,
+    .blend_row = avx2_blend_row,
+    .blend_solid_row = avx2_blend_solid_row,
+};
+#endif
@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#endif
+
+#include "modeset-fill.h"
+#include "modeset-util.h"
+
+static void scalar_fill_row(uint32_t *dst, uint32_t color, uint32_t count)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; ++i)
+        dst[i] = color;
+}
+
+static void scalar_copy_row(uint32_t *dst, const uint32_t *src, uint32_t count)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; ++i)
+        dst[i] = src[i];
+}
+
+static void scalar_stream_fence(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/* two channels per multiply, (x + 128 + ((x + 128) >> 8)) >> 8 divides by 255 exactly */
+static inline uint32_t scalar_over(uint32_t d, uint32_t s)
+{
+    uint32_t ia = 255 - (s >> 24);
+    uint32_t rb = (d & 0x00ff00ff) * ia + 0x00800080;
+    uint32_t ag = ((d >> 8) & 0x00ff00ff) * ia + 0x00800080;
+
+    rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+    ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+    return s + (rb | ag);
+}
+
+static void scalar_blend_row(uint32_t *dst, const uint32_t *src, uint32_t count)
+{
+    uint32_t i, a;
+
+    for (i = 0; i < count; ++i) {
+        a = src[i] >> 24;
+        if (a == 255)
+            dst[i] = src[i];
+        else if (src[i])
+            dst[i] = scalar_over(dst[i], src[i]);
+    }
+}
+
+static void scalar_blend_solid_row(uint32_t *dst, uint32_t color, uint32_t count)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; ++i)
+        dst[i] = scalar_over(dst[i], color);
+}
+
+const struct modeset_fill_ops modeset_fill_scalar_ops = {
+    .name = "scalar",
+    .fill_row = scalar_fill_row,
+    .copy_row = scalar_copy_row,
+    .stream_fill_row = scalar_fill_row,
+    .stream_copy_row = scalar_copy_row,
+    .stream_fence = scalar_stream_fence,
+    .blend_row = scalar_blend_row,
+    .blend_solid_row = scalar_blend_solid_row,
+};
+
+static const struct modeset_fill_ops *modeset_fill_ops;
+
+/* kernels usable on this CPU, best first; the scalar ops are always last */
+unsigned int modeset_fill_get_supported(const struct modeset_fill_ops **ops)
+{
+    unsigned int count = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        ops[count++] = &modeset_fill_avx2_ops;
+    if (__builtin_cpu_supports("sse2"))
+        ops[count++] = &modeset_fill_sse2_ops;
+#endif
+#if defined(__aarch64__)
+    if (getauxval(AT_HWCAP) & HWCAP_ASIMD)
+        ops[count++] = &modeset_fill_neon_ops;
+#endif
+    ops[count++] = &modeset_fill_scalar_ops;
+
+    return count;
+}
+
+static const struct modeset_fill_ops *modeset_fill_select(void)
+{
+    const struct modeset_fill_ops *candidates[MODESET_FILL_MAX_OPS];
+    const char *force;
+    int i, count;
+
+    count = modeset_fill_get_supported(candidates);
+
+    force = getenv("MODESET_FILL");
+    if (force) {
+        for (i = 0; i < count; ++i) {
+            if (!strcmp(candidates[i]->name, force))
+                return candidates[i];
+        }
+        fprintf(stderr, "fill kernel '%s' not supported, using '%s'\n", force, candidates[0]->name);
+    }
+
+    return candidates[0];
+}
+
+const struct modeset_fill_ops *modeset_fill_get_ops(void)
+{
+    if (!modeset_fill_ops)
+        modeset_fill_ops = modeset_fill_select();
+
+    return modeset_fill_ops;
+}
+
+void modeset_fill_rect(struct modeset_buf *buf, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color)
+{
+    const struct modeset_fill_ops *ops = modeset_fill_get_ops();
+    uint8_t *row;
+    uint32_t j;
+
+    row = buf->map + buf->stride * y + x * 4;
+    for (j = 0; j < h; ++j) {
+        ops->fill_row((uint32_t *)row, color, w);
+        row += buf->stride;
+    }
+}
+
+void modeset_fill(struct modeset_buf *buf, uint32_t color)
+{
+    modeset_fill_rect(buf, 0, 0, buf->width, buf->height, color);
+}
+
+void modeset_blit(struct modeset_buf *dst, uint32_t x, uint32_t y, const uint8_t *src, uint32_t src_stride,
+                  uint32_t w, uint32_t h)
+{
+    const struct modeset_fill_ops *ops = modeset_fill_get_ops();
+    uint8_t *row;
+    uint32_t j;
+
+    row = dst->map + dst->stride * y + x * 4;
+    for (j = 0; j < h; ++j) {
+        ops->copy_row((uint32_t *)row, (const uint32_t *)src, w);
+        row += dst->stride;
+        src += src_stride;
+    }
+}
+
+int modeset_stream_enabled(uint32_t connector_id)
+{
+    return modeset_env_match("MODESET_STREAM", connector_id);
+}
+
+void modeset_stream_fill_rect(struct modeset_buf *buf, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color)
+{
+    const struct modeset_fill_ops *ops = modeset_fill_get_ops();
+    uint8_t *row;
+    uint32_t j;
+
+    row = buf->map + buf->stride * y + x * 4;
+    for (j = 0; j < h; ++j) {
+        ops->stream_fill_row((uint32_t *)row, color, w);
+        row += buf->stride;
+    }
+}
+
+void modeset_stream_fill(struct modeset_buf *buf, uint32_t color)
+{
+    modeset_stream_fill_rect(buf, 0, 0, buf->width, buf->height, color);
+}
+
+void modeset_stream_blit(struct modeset_buf *dst, uint32_t x, uint32_t y, const uint8_t *src, uint32_t src_stride,
+                         uint32_t w, uint32_t h)
+{
+    const struct modeset_fill_ops *ops = modeset_fill_get_ops();
+    uint8_t *row;
+    uint32_t j;
+
+    row = dst->map + dst->stride * y + x * 4;
+    for (j = 0; j < h; ++j) {
+        ops->stream_copy_row((uint32_t *)row, (const uint32_t *)src, w);
+        row += dst->stride;
+        src += src_stride;
+    }
+}
+
+void modeset_stream_fence(void)
+{
+    modeset_fill_get_ops()->stream_fence();
+}
@@ -0,0 +1,61 @@
+#ifndef MODESET_FILL_H
+#define MODESET_FILL_H
+
+#include <stdint.h>
+
+#include "modeset-buf.h"
+
+/*
+ * Row kernels for 32bpp framebuffers. The variant is picked once from the
+ * CPU features (AVX2, SSE2, NEON) and can be forced with the MODESET_FILL
+ * environment variable ("scalar", "sse2", "avx2", "neon"). The scalar ops
+ * stay available as the reference implementation.
+ *
+ * The stream_* kernels write whole 64-byte lines with non-temporal stores
+ * (movntdq, stnp) for write-combined dumb buffer mappings, where partial
+ * lines and read-modify-write are expensive. They are weakly ordered:
+ * call modeset_stream_fence() after painting and before the commit.
+ * Outputs listed in MODESET_STREAM use them (see modeset_env_match).
+ *
+ * blend_row and blend_solid_row composite premultiplied ARGB8888 over the
+ * destination, d = s + d * (255 - sa) / 255 with exact rounding, so every
+ * variant produces the same pixels as the scalar one.
+ */
+struct modeset_fill_ops {
+    const char *name;
+    void (*fill_row)(uint32_t *dst, uint32_t color, uint32_t count);
+    void (*copy_row)(uint32_t *dst, const uint32_t *src, uint32_t count);
+    void (*stream_fill_row)(uint32_t *dst, uint32_t color, uint32_t count);
+    void (*stream_copy_row)(uint32_t *dst, const uint32_t *src, uint32_t count);
+    void (*stream_fence)(void);
+    void (*blend_row)(uint32_t *dst, const uint32_t *src, uint32_t count);
+    void (*blend_solid_row)(uint32_t *dst, uint32_t color, uint32_t count);
+};
+
+extern const struct modeset_fill_ops modeset_fill_scalar_ops;
+#if defined(__x86_64__) || defined(__i386__)
+extern const struct modeset_fill_ops modeset_fill_sse2_ops;
+extern const struct modeset_fill_ops modeset_fill_avx2_ops;
+#endif
+#if defined(__aarch64__)
+extern const struct modeset_fill_ops modeset_fill_neon_ops;
+#endif
+
+#define MODESET_FILL_MAX_OPS 4
+
+unsigned int modeset_fill_get_supported(const struct modeset_fill_ops **ops);
+const struct modeset_fill_ops *modeset_fill_get_ops(void);
+
+void modeset_fill(struct modeset_buf *buf, uint32_t color);
+void modeset_fill_rect(struct modeset_buf *buf, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color);
+void modeset_blit(struct modeset_buf *dst, uint32_t x, uint32_t y, const uint8_t *src, uint32_t src_stride,
+                  uint32_t w, uint32_t h);
+
+int modeset_stream_enabled(uint32_t connector_id);
+void modeset_stream_fill(struct modeset_buf *buf, uint32_t color);
+void modeset_stream_fill_rect(struct modeset_buf *buf, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color);
+void modeset_stream_blit(struct modeset_buf *dst, uint32_t x, uint32_t y, const uint8_t *src, uint32_t src_stride,
+                         uint32_t w, uint32_t h);
+void modeset_stream_fence(void);
+
+#endif
@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "modeset-loop.h"
+
+int modeset_loop_init(struct modeset_loop *loop)
+{
+    memset(loop, 0, sizeof(*loop));
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        fprintf(stderr, "cannot create epoll instance (%d): %m\n", errno);
+        return -errno;
+    }
+
+    return 0;
+}
+
+void modeset_loop_fini(struct modeset_loop *loop)
+{
+    int i;
+
+    for (i = 0; i < MODESET_LOOP_MAX_SOURCES; ++i)
+        modeset_loop_remove(loop, i);
+
+    close(loop->epfd);
+}
+
+static int modeset_loop_add(struct modeset_loop *loop, enum modeset_loop_type type, int fd,
+                            modeset_loop_cb cb, void *data)
+{
+    struct epoll_event ev;
+    int i;
+
+    for (i = 0; i < MODESET_LOOP_MAX_SOURCES; ++i) {
+        if (loop->sources[i].type == MODESET_LOOP_NONE)
+            break;
+    }
+    if (i == MODESET_LOOP_MAX_SOURCES)
+        return -ENOSPC;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &loop->sources[i];
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+        fprintf(stderr, "cannot watch fd %d (%d): %m\n", fd, errno);
+        return -errno;
+    }
+
+    loop->sources[i].type = type;
+    loop->sources[i].fd = fd;
+    loop->sources[i].cb = cb;
+    loop->sources[i].data = data;
+    return i;
+}
+
+int modeset_loop_add_fd(struct modeset_loop *loop, int fd, modeset_loop_cb cb, void *data)
+{
+    return modeset_loop_add(loop, MODESET_LOOP_FD, fd, cb, data);
+}
+
+int modeset_loop_add_timer(struct modeset_loop *loop, modeset_loop_cb cb, void *data)
+{
+    int fd, ret;
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "cannot create timerfd (%d): %m\n", errno);
+        return -errno;
+    }
+
+    ret = modeset_loop_add(loop, MODESET_LOOP_TIMER, fd, cb, data);
+    if (ret < 0)
+        close(fd);
+    return ret;
+}
+
+int modeset_loop_add_signal(struct modeset_loop *loop, int signo, modeset_loop_cb cb, void *data)
+{
+    sigset_t mask, old;
+    int fd, ret;
+
+    /* the signal is only delivered through the signalfd from now on */
+    sigemptyset(&mask);
+    sigaddset(&mask, signo);
+    sigprocmask(SIG_BLOCK, &mask, &old);
+
+    fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "cannot create signalfd (%d): %m\n", errno);
+        ret = -errno;
+        goto err_mask;
+    }
+
+    ret = modeset_loop_add(loop, MODESET_LOOP_SIGNAL, fd, cb, data);
+    if (ret < 0) {
+        close(fd);
+        goto err_mask;
+    }
+
+    loop->sources[ret].signo = signo;
+    loop->sources[ret].unblock = !sigismember(&old, signo);
+    return ret;
+
+err_mask:
+    if (!sigismember(&old, signo))
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    return ret;
+}
+
+static void modeset_loop_drain(struct modeset_loop_source *src)
+{
+    struct signalfd_siginfo info;
+    uint64_t expirations;
+
+    if (src->type == MODESET_LOOP_TIMER)
+        while (read(src->fd, &expirations, sizeof(expirations)) > 0);
+    else if (src->type == MODESET_LOOP_SIGNAL)
+        while (read(src->fd, &info, sizeof(info)) > 0);
+}
+
+void modeset_loop_remove(struct modeset_loop *loop, int id)
+{
+    struct modeset_loop_source *src = &loop->sources[id];
+    sigset_t mask;
+
+    if (src->type == MODESET_LOOP_NONE)
+        return;
+
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+    if (src->type == MODESET_LOOP_SIGNAL && src->unblock) {
+        /* a signal still queued for the loop would hit the default action once unblocked */
+        modeset_loop_drain(src);
+        sigemptyset(&mask);
+        sigaddset(&mask, src->signo);
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    }
+    if (src->type != MODESET_LOOP_FD)
+        close(src->fd);
+
+    memset(src, 0, sizeof(*src));
+}
+
+int modeset_loop_arm_timer(struct modeset_loop *loop, int id, uint64_t deadline_ns, uint64_t interval_ns)
+{
+    struct itimerspec its;
+
+    /* a zero it_value would disarm the timer, an expired deadline fires at once */
+    if (!deadline_ns)
+        deadline_ns = 1;
+
+    its.it_value.tv_sec = deadline_ns / 1000000000ull;
+    its.it_value.tv_nsec = deadline_ns % 1000000000ull;
+    its.it_interval.tv_sec = interval_ns / 1000000000ull;
+    its.it_interval.tv_nsec = interval_ns % 1000000000ull;
+
+    if (timerfd_settime(loop->sources[id].fd, TFD_TIMER_ABSTIME, &its, NULL))
+        return -errno;
+
+    return 0;
+}
+
+int modeset_loop_disarm_timer(struct modeset_loop *loop, int id)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if (timerfd_settime(loop->sources[id].fd, 0, &its, NULL))
+        return -errno;
+
+    return 0;
+}
+
+int modeset_loop_dispatch(struct modeset_loop *loop, int timeout_ms)
+{
+    struct epoll_event events[MODESET_LOOP_MAX_SOURCES];
+    struct modeset_loop_source *src;
+    int i, count;
+
+    count = epoll_wait(loop->epfd, events, MODESET_LOOP_MAX_SOURCES, timeout_ms);
+    if (count < 0) {
+        if (errno == EINTR)
+            return 0;
+        fprintf(stderr, "epoll_wait() failed with %d: %m\n", errno);
+        return -errno;
+    }
+
+    for (i = 0; i < count; ++i) {
+        src = events[i].data.ptr;
+        /* removed by an earlier callback of this batch */
+        if (src->type == MODESET_LOOP_NONE)
+            continue;
+
+        modeset_loop_drain(src);
+        src->cb(loop, src->fd, src->data);
+    }
+
+    return count;
+}
+
+void modeset_loop_set_idle(struct modeset_loop *loop, modeset_loop_cb cb, void *data)
+{
+    loop->idle_cb = cb;
+    loop->idle_data = data;
+}
+
+int modeset_loop_run(struct modeset_loop *loop)
+{
+    int ret;
+
+    loop->quit = 0;
+    while (!loop->quit) {
+        ret = modeset_loop_dispatch(loop, loop->idle_cb ? 0 : -1);
+        if (ret < 0)
+            return ret;
+        if (loop->idle_cb && !loop->quit)
+            loop->idle_cb(loop, -1, loop->idle_data);
+    }
+
+    return 0;
+}
+
+void modeset_loop_quit(struct modeset_loop *loop)
+{
+    loop->quit = 1;
+}
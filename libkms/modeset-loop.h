@@ -0,0 +1,63 @@
+#ifndef MODESET_LOOP_H
+#define MODESET_LOOP_H
+
+#include <stdint.h>
+
+/*
+ * epoll based event loop. File descriptors, timers (timerfd on
+ * CLOCK_MONOTONIC, so deadlines compare directly with modeset_now_ns and
+ * page-flip timestamps) and signals (signalfd) are registered with a
+ * callback and identified by the returned source id. Callbacks must not
+ * block; a delay is a timer, not a sleep. An idle callback turns the
+ * loop into a polling one: it runs after every dispatch, which never waits.
+ */
+#define MODESET_LOOP_MAX_SOURCES 16
+
+struct modeset_loop;
+
+typedef void (*modeset_loop_cb)(struct modeset_loop *loop, int fd, void *data);
+
+enum modeset_loop_type {
+    MODESET_LOOP_NONE,
+    MODESET_LOOP_FD,
+    MODESET_LOOP_TIMER,
+    MODESET_LOOP_SIGNAL,
+};
+
+struct modeset_loop_source {
+    enum modeset_loop_type type;
+    int fd;
+    modeset_loop_cb cb;
+    void *data;
+
+    /* signal sources: unblocked again on removal unless it was blocked before */
+    int signo;
+    int unblock;
+};
+
+struct modeset_loop {
+    int epfd;
+    int quit;
+    struct modeset_loop_source sources[MODESET_LOOP_MAX_SOURCES];
+
+    modeset_loop_cb idle_cb;
+    void *idle_data;
+};
+
+int modeset_loop_init(struct modeset_loop *loop);
+void modeset_loop_fini(struct modeset_loop *loop);
+
+int modeset_loop_add_fd(struct modeset_loop *loop, int fd, modeset_loop_cb cb, void *data);
+int modeset_loop_add_timer(struct modeset_loop *loop, modeset_loop_cb cb, void *data);
+int modeset_loop_add_signal(struct modeset_loop *loop, int signo, modeset_loop_cb cb, void *data);
+void modeset_loop_remove(struct modeset_loop *loop, int id);
+void modeset_loop_set_idle(struct modeset_loop *loop, modeset_loop_cb cb, void *data);
+
+int modeset_loop_arm_timer(struct modeset_loop *loop, int id, uint64_t deadline_ns, uint64_t interval_ns);
+int modeset_loop_disarm_timer(struct modeset_loop *loop, int id);
+
+int modeset_loop_dispatch(struct modeset_loop *loop, int timeout_ms);
+int modeset_loop_run(struct modeset_loop *loop);
+void modeset_loop_quit(struct modeset_loop *loop);
+
+#endif
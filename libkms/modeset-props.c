@@ -0,0 +1,94 @@
+#define _GNU_SOURCE
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "modeset-props.h"
+
+static const char *const modeset_prop_names[MODESET_PROP_COUNT] = {
+    [MODESET_PROP_CRTC_ID] = "CRTC_ID",
+    [MODESET_PROP_FB_ID] = "FB_ID",
+    [MODESET_PROP_SRC_X] = "SRC_X",
+    [MODESET_PROP_SRC_Y] = "SRC_Y",
+    [MODESET_PROP_SRC_W] = "SRC_W",
+    [MODESET_PROP_SRC_H] = "SRC_H",
+    [MODESET_PROP_CRTC_X] = "CRTC_X",
+    [MODESET_PROP_CRTC_Y] = "CRTC_Y",
+    [MODESET_PROP_CRTC_W] = "CRTC_W",
+    [MODESET_PROP_CRTC_H] = "CRTC_H",
+    [MODESET_PROP_TYPE] = "type",
+    [MODESET_PROP_ZPOS] = "zpos",
+    [MODESET_PROP_FB_DAMAGE_CLIPS] = "FB_DAMAGE_CLIPS",
+    [MODESET_PROP_MODE_ID] = "MODE_ID",
+    [MODESET_PROP_ACTIVE] = "ACTIVE",
+    [MODESET_PROP_EDID] = "EDID",
+};
+
+const char *modeset_prop_name(enum modeset_prop prop)
+{
+    return modeset_prop_names[prop];
+}
+
+int modeset_get_object_properties(int fd, struct drm_object *obj, uint32_t type)
+{
+    drmModeObjectProperties *props;
+    drmModePropertyRes *info;
+    const char *type_str;
+    unsigned int i, j;
+    int ret;
+
+    memset(obj->prop_ids, 0, sizeof(obj->prop_ids));
+    memset(obj->prop_values, 0, sizeof(obj->prop_values));
+
+    props = drmModeObjectGetProperties(fd, obj->id, type);
+    if (!props) {
+        ret = -errno;
+        switch (type) {
+            case DRM_MODE_OBJECT_CONNECTOR:
+                type_str = "connector";
+                break;
+            case DRM_MODE_OBJECT_PLANE:
+                type_str = "plane";
+                break;
+            case DRM_MODE_OBJECT_CRTC:
+                type_str = "CRTC";
+                break;
+            default:
+                type_str = "unknown type";
+                break;
+        }
+        fprintf(stderr, "cannot get %s %d properties: %s\n", type_str, obj->id, strerror(-ret));
+        return ret;
+    }
+
+    for (i = 0; i < props->count_props; ++i) {
+        info = drmModeGetProperty(fd, props->props[i]);
+        if (!info)
+            continue;
+
+        for (j = 0; j < MODESET_PROP_COUNT; ++j) {
+            if (!strcmp(info->name, modeset_prop_names[j])) {
+                obj->prop_ids[j] = info->prop_id;
+                obj->prop_values[j] = props->prop_values[i];
+                break;
+            }
+        }
+
+        drmModeFreeProperty(info);
+    }
+
+    drmModeFreeObjectProperties(props);
+    return 0;
+}
+
+int set_drm_object_property(drmModeAtomicReq *req, struct drm_object *obj, enum modeset_prop prop, uint64_t value)
+{
+    if (obj->prop_ids[prop] == 0) {
+        fprintf(stderr, "no object property: %s\n", modeset_prop_names[prop]);
+        return -EINVAL;
+    }
+
+    return drmModeAtomicAddProperty(req, obj->id, obj->prop_ids[prop], value);
+}
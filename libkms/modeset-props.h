@@ -0,0 +1,42 @@
+#ifndef MODESET_PROPS_H
+#define MODESET_PROPS_H
+
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+/*
+ * Well-known KMS property names, resolved to IDs once per object so the
+ * per-frame commit path can index them directly instead of comparing strings.
+ */
+enum modeset_prop {
+    MODESET_PROP_CRTC_ID,
+    MODESET_PROP_FB_ID,
+    MODESET_PROP_SRC_X,
+    MODESET_PROP_SRC_Y,
+    MODESET_PROP_SRC_W,
+    MODESET_PROP_SRC_H,
+    MODESET_PROP_CRTC_X,
+    MODESET_PROP_CRTC_Y,
+    MODESET_PROP_CRTC_W,
+    MODESET_PROP_CRTC_H,
+    MODESET_PROP_TYPE,
+    MODESET_PROP_ZPOS,
+    MODESET_PROP_FB_DAMAGE_CLIPS,
+    MODESET_PROP_MODE_ID,
+    MODESET_PROP_ACTIVE,
+    MODESET_PROP_EDID,
+    MODESET_PROP_COUNT
+};
+
+struct drm_object {
+    uint32_t id;
+    uint32_t prop_ids[MODESET_PROP_COUNT];
+    uint64_t prop_values[MODESET_PROP_COUNT];
+};
+
+const char *modeset_prop_name(enum modeset_prop prop);
+
+int modeset_get_object_properties(int fd, struct drm_object *obj, uint32_t type);
+int set_drm_object_property(drmModeAtomicReq *req, struct drm_object *obj, enum modeset_prop prop, uint64_t value);
+
+#endif
@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "modeset-req.h"
+
+void modeset_req_init(struct modeset_req *req)
+{
+    req->count_objs = 0;
+    req->count_props = 0;
+}
+
+/* returns the slot of the new property, to be patched with modeset_req_set */
+int modeset_req_add(struct modeset_req *req, struct drm_object *obj, enum modeset_prop prop, uint64_t value)
+{
+    uint32_t slot;
+
+    if (obj->prop_ids[prop] == 0) {
+        fprintf(stderr, "no object property: %s\n", modeset_prop_name(prop));
+        return -EINVAL;
+    }
+
+    if (req->count_props == MODESET_REQ_MAX_PROPS)
+        return -ENOSPC;
+
+    /* properties must be grouped by object, start a new group on change */
+    if (!req->count_objs || req->objs[req->count_objs - 1] != obj->id) {
+        if (req->count_objs == MODESET_REQ_MAX_OBJS)
+            return -ENOSPC;
+        req->objs[req->count_objs] = obj->id;
+        req->count_obj_props[req->count_objs] = 0;
+        ++req->count_objs;
+    }
+
+    slot = req->count_props++;
+    req->props[slot] = obj->prop_ids[prop];
+    req->values[slot] = value;
+    ++req->count_obj_props[req->count_objs - 1];
+
+    return slot;
+}
+
+void modeset_req_set(struct modeset_req *req, int slot, uint64_t value)
+{
+    req->values[slot] = value;
+}
+
+int modeset_req_get_cursor(struct modeset_req *req)
+{
+    return req->count_props;
+}
+
+void modeset_req_set_cursor(struct modeset_req *req, int cursor)
+{
+    uint32_t i, count = 0;
+
+    for (i = 0; i < req->count_objs; ++i) {
+        if (count + req->count_obj_props[i] >= (uint32_t)cursor) {
+            req->count_obj_props[i] = cursor - count;
+            req->count_objs = req->count_obj_props[i] ? i + 1 : i;
+            break;
+        }
+        count += req->count_obj_props[i];
+    }
+
+    req->count_props = cursor;
+}
+
+/* concatenate src onto req, e.g. the flip templates of several CRTCs into one commit */
+int modeset_req_append(struct modeset_req *req, const struct modeset_req *src)
+{
+    uint32_t i, count;
+
+    if (req->count_props + src->count_props > MODESET_REQ_MAX_PROPS ||
+        req->count_objs + src->count_objs > MODESET_REQ_MAX_OBJS)
+        return -ENOSPC;
+
+    memcpy(req->props + req->count_props, src->props, src->count_props * sizeof(req->props[0]));
+    memcpy(req->values + req->count_props, src->values, src->count_props * sizeof(req->values[0]));
+    req->count_props += src->count_props;
+
+    for (i = 0; i < src->count_objs; ++i) {
+        count = src->count_obj_props[i];
+        if (!count)
+            continue;
+        if (req->count_objs && req->objs[req->count_objs - 1] == src->objs[i]) {
+            req->count_obj_props[req->count_objs - 1] += count;
+            continue;
+        }
+        req->objs[req->count_objs] = src->objs[i];
+        req->count_obj_props[req->count_objs] = count;
+        ++req->count_objs;
+    }
+
+    return 0;
+}
+
+int modeset_req_commit(int fd, struct modeset_req *req, uint32_t flags, void *user_data)
+{
+    struct drm_mode_atomic atomic;
+
+    memset(&atomic, 0, sizeof(atomic));
+    atomic.flags = flags;
+    atomic.count_objs = req->count_objs;
+    atomic.objs_ptr = (uintptr_t)req->objs;
+    atomic.count_props_ptr = (uintptr_t)req->count_obj_props;
+    atomic.props_ptr = (uintptr_t)req->props;
+    atomic.prop_values_ptr = (uintptr_t)req->values;
+    atomic.user_data = (uintptr_t)user_data;
+
+    /* -errno like drmModeAtomicCommit, errno stays set for the callers that print it */
+    if (drmIoctl(fd, DRM_IOCTL_MODE_ATOMIC, &atomic))
+        return -errno;
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef MODESET_REQ_H
+#define MODESET_REQ_H
+
+#include <stdint.h>
+
+#include "modeset-props.h"
+#include "modeset-topo.h"
+
+/*
+ * Preallocated atomic request. Unlike drmModeAtomicReq it is committed
+ * straight through DRM_IOCTL_MODE_ATOMIC, so a prebuilt request can be
+ * patched in place with modeset_req_set and committed every frame without
+ * any heap allocation. The cursor marks a rollback point: properties added
+ * after it (e.g. per-frame damage) are dropped by modeset_req_set_cursor.
+ *
+ * One output's flip is at most a primary plane with damage and a cursor
+ * plane; a request has room for that on every CRTC a device can have, so
+ * the flips of a whole card fit into one batched commit.
+ */
+#define MODESET_REQ_OUTPUT_OBJS 4
+#define MODESET_REQ_OUTPUT_PROPS 16
+#define MODESET_REQ_MAX_OBJS (MODESET_TOPO_MAX_CRTCS * MODESET_REQ_OUTPUT_OBJS)
+#define MODESET_REQ_MAX_PROPS (MODESET_TOPO_MAX_CRTCS * MODESET_REQ_OUTPUT_PROPS)
+
+struct modeset_req {
+    uint32_t count_objs;
+    uint32_t count_props;
+    uint32_t objs[MODESET_REQ_MAX_OBJS];
+    uint32_t count_obj_props[MODESET_REQ_MAX_OBJS];
+    uint32_t props[MODESET_REQ_MAX_PROPS];
+    uint64_t values[MODESET_REQ_MAX_PROPS];
+};
+
+void modeset_req_init(struct modeset_req *req);
+int modeset_req_add(struct modeset_req *req, struct drm_object *obj, enum modeset_prop prop, uint64_t value);
+void modeset_req_set(struct modeset_req *req, int slot, uint64_t value);
+int modeset_req_get_cursor(struct modeset_req *req);
+void modeset_req_set_cursor(struct modeset_req *req, int cursor);
+int modeset_req_append(struct modeset_req *req, const struct modeset_req *src);
+int modeset_req_commit(int fd, struct modeset_req *req, uint32_t flags, void *user_data);
+
+#endif
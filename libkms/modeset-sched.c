@@ -0,0 +1,88 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modeset-sched.h"
+
+/* MODESET_DEADLINE_MARGIN_US sets the smallest safety margin, 500 us by default */
+uint64_t modeset_sched_margin(void)
+{
+    const char *env = getenv("MODESET_DEADLINE_MARGIN_US");
+
+    if (!env)
+        return 500000;
+
+    return strtoull(env, NULL, 10) * 1000;
+}
+
+void modeset_sched_init(struct modeset_sched *sched, uint64_t period_ns, uint64_t margin_ns)
+{
+    memset(sched, 0, sizeof(*sched));
+    sched->period_ns = period_ns;
+    /* the late path caps the margin at half a period, the floor must not lie above it */
+    if (period_ns && margin_ns > period_ns / 2)
+        margin_ns = period_ns / 2;
+    sched->min_margin_ns = margin_ns;
+    sched->margin_ns = margin_ns;
+}
+
+void modeset_sched_vblank(struct modeset_sched *sched, unsigned int sec, unsigned int usec)
+{
+    uint64_t now = (uint64_t)sec * 1000000000ull + (uint64_t)usec * 1000ull;
+
+    sched->vblank_ns = now;
+    if (!sched->target_ns)
+        return;
+
+    ++sched->frames;
+    if (now > sched->target_ns + sched->period_ns / 2) {
+        ++sched->late;
+        sched->margin_ns = sched->margin_ns ? sched->margin_ns * 2 : sched->period_ns / 16;
+        if (sched->margin_ns > sched->period_ns / 2)
+            sched->margin_ns = sched->period_ns / 2;
+    }
+    else if (sched->margin_ns > sched->min_margin_ns) {
+        sched->margin_ns -= (sched->margin_ns - sched->min_margin_ns) / 16;
+    }
+    sched->target_ns = 0;
+}
+
+/* when to start painting the frame for the next vblank that can still be made */
+uint64_t modeset_sched_deadline(struct modeset_sched *sched, uint64_t now)
+{
+    uint64_t lead, vblank;
+
+    if (!sched->vblank_ns || !sched->period_ns)
+        return now;
+
+    lead = sched->paint_ns + 2 * sched->paint_dev_ns + sched->margin_ns;
+    vblank = sched->vblank_ns + sched->period_ns;
+    if (vblank < now + lead)
+        vblank += (now + lead - vblank + sched->period_ns - 1) / sched->period_ns * sched->period_ns;
+
+    sched->target_ns = vblank;
+    return vblank - lead;
+}
+
+void modeset_sched_paint(struct modeset_sched *sched, uint64_t paint_ns)
+{
+    uint64_t dev;
+
+    if (!sched->paint_ns) {
+        sched->paint_ns = paint_ns;
+        return;
+    }
+
+    dev = paint_ns > sched->paint_ns ? paint_ns - sched->paint_ns : sched->paint_ns - paint_ns;
+    sched->paint_dev_ns = sched->paint_dev_ns - sched->paint_dev_ns / 4 + dev / 4;
+    sched->paint_ns = sched->paint_ns - sched->paint_ns / 8 + paint_ns / 8;
+}
+
+void modeset_sched_print(const struct modeset_sched *sched, uint32_t crtc_id)
+{
+    fprintf(stderr, "crtc %u: paint %llu us +- %llu us, margin %llu us, %llu of %llu frames late\n", crtc_id,
+            (unsigned long long)(sched->paint_ns / 1000), (unsigned long long)(sched->paint_dev_ns / 1000),
+            (unsigned long long)(sched->margin_ns / 1000), (unsigned long long)sched->late,
+            (unsigned long long)sched->frames);
+}
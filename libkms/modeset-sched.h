@@ -0,0 +1,37 @@
+#ifndef MODESET_SCHED_H
+#define MODESET_SCHED_H
+
+#include <stdint.h>
+
+/*
+ * Just-in-time paint scheduling for one CRTC. The next vblank is
+ * predicted from the last page-flip timestamp and the mode's refresh
+ * period, and painting starts that vblank minus the expected paint time
+ * minus a safety margin. The paint estimate is a running mean plus twice
+ * the mean deviation of measured paint durations; the margin starts at
+ * MODESET_DEADLINE_MARGIN_US, doubles when a frame lands late and decays
+ * back while frames make their vblank.
+ */
+struct modeset_sched {
+    uint64_t period_ns;
+    uint64_t vblank_ns;
+    uint64_t target_ns;
+
+    uint64_t paint_ns;
+    uint64_t paint_dev_ns;
+    uint64_t min_margin_ns;
+    uint64_t margin_ns;
+
+    uint64_t frames;
+    uint64_t late;
+};
+
+uint64_t modeset_sched_margin(void);
+
+void modeset_sched_init(struct modeset_sched *sched, uint64_t period_ns, uint64_t margin_ns);
+void modeset_sched_vblank(struct modeset_sched *sched, unsigned int sec, unsigned int usec);
+uint64_t modeset_sched_deadline(struct modeset_sched *sched, uint64_t now);
+void modeset_sched_paint(struct modeset_sched *sched, uint64_t paint_ns);
+void modeset_sched_print(const struct modeset_sched *sched, uint32_t crtc_id);
+
+#endif
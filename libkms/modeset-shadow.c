@@ -0,0 +1,81 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modeset-fill.h"
+#include "modeset-shadow.h"
+#include "modeset-util.h"
+
+int modeset_shadow_enabled(uint32_t connector_id)
+{
+    return modeset_env_match("MODESET_SHADOW", connector_id);
+}
+
+int modeset_shadow_init(struct modeset_shadow *shadow, uint32_t width, uint32_t height)
+{
+    unsigned int i;
+
+    memset(shadow, 0, sizeof(*shadow));
+    shadow->buf.width = width;
+    shadow->buf.height = height;
+    shadow->buf.stride = (width * 4 + 63) & ~63u;
+    shadow->buf.size = shadow->buf.stride * height;
+
+    shadow->buf.map = aligned_alloc(64, shadow->buf.size);
+    if (!shadow->buf.map)
+        return -ENOMEM;
+    memset(shadow->buf.map, 0, shadow->buf.size);
+
+    /* every target starts out fully stale */
+    for (i = 0; i < MODESET_SHADOW_MAX_BUFS; ++i) {
+        shadow->pending[i].y1 = 0;
+        shadow->pending[i].y2 = height;
+    }
+
+    return 0;
+}
+
+void modeset_shadow_fini(struct modeset_shadow *shadow)
+{
+    free(shadow->buf.map);
+    shadow->buf.map = NULL;
+}
+
+void modeset_shadow_damage(struct modeset_shadow *shadow, uint32_t y, uint32_t h)
+{
+    unsigned int i;
+
+    for (i = 0; i < MODESET_SHADOW_MAX_BUFS; ++i) {
+        if (shadow->pending[i].y1 == shadow->pending[i].y2) {
+            shadow->pending[i].y1 = y;
+            shadow->pending[i].y2 = y + h;
+            continue;
+        }
+        if (y < shadow->pending[i].y1)
+            shadow->pending[i].y1 = y;
+        if (y + h > shadow->pending[i].y2)
+            shadow->pending[i].y2 = y + h;
+    }
+}
+
+void modeset_shadow_flush(struct modeset_shadow *shadow, unsigned int slot, struct modeset_buf *buf, int stream)
+{
+    uint32_t y1 = shadow->pending[slot].y1;
+    uint32_t y2 = shadow->pending[slot].y2;
+    const uint8_t *src;
+
+    if (y1 == y2)
+        return;
+
+    src = shadow->buf.map + shadow->buf.stride * y1;
+    if (stream) {
+        modeset_stream_blit(buf, 0, y1, src, shadow->buf.stride, buf->width, y2 - y1);
+        modeset_stream_fence();
+    }
+    else {
+        modeset_blit(buf, 0, y1, src, shadow->buf.stride, buf->width, y2 - y1);
+    }
+
+    shadow->pending[slot].y1 = shadow->pending[slot].y2 = 0;
+}
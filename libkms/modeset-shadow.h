@@ -0,0 +1,31 @@
+#ifndef MODESET_SHADOW_H
+#define MODESET_SHADOW_H
+
+#include <stdint.h>
+
+#include "modeset-buf.h"
+
+/*
+ * Cached system-memory copy of an output's image. Painting (and reading
+ * back the previous frame) happens in the shadow; modeset_shadow_flush
+ * then copies only the rows changed since the given scanout buffer was
+ * last flushed. Each scanout buffer slot tracks its own pending rows since
+ * a double-buffered target is one frame behind the other.
+ */
+#define MODESET_SHADOW_MAX_BUFS 4
+
+struct modeset_shadow {
+    struct modeset_buf buf;
+    struct {
+        uint32_t y1, y2;
+    } pending[MODESET_SHADOW_MAX_BUFS];
+};
+
+int modeset_shadow_enabled(uint32_t connector_id);
+
+int modeset_shadow_init(struct modeset_shadow *shadow, uint32_t width, uint32_t height);
+void modeset_shadow_fini(struct modeset_shadow *shadow);
+void modeset_shadow_damage(struct modeset_shadow *shadow, uint32_t y, uint32_t h);
+void modeset_shadow_flush(struct modeset_shadow *shadow, unsigned int slot, struct modeset_buf *buf, int stream);
+
+#endif
@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modeset-stats.h"
+#include "modeset-util.h"
+
+struct modeset_stats_summary {
+    double fps;
+    double mean_us;
+    uint32_t jitter_us[4];
+    uint32_t latency_us[4];
+};
+
+static const unsigned int modeset_stats_pct[4] = { 50, 90, 99, 100 };
+
+uint64_t modeset_mode_period_ns(const drmModeModeInfo *mode)
+{
+    if (!mode->clock)
+        return 0;
+
+    /* clock is in kHz */
+    return (uint64_t)mode->htotal * mode->vtotal * 1000000ull / mode->clock;
+}
+
+void modeset_stats_init(struct modeset_stats *stats, uint32_t crtc_id, uint64_t period_ns)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->crtc_id = crtc_id;
+    stats->period_ns = period_ns;
+}
+
+void modeset_stats_submit(struct modeset_stats *stats)
+{
+    stats->submit_ns = modeset_now_ns();
+}
+
+void modeset_stats_flip(struct modeset_stats *stats, unsigned int frame, unsigned int sec, unsigned int usec)
+{
+    uint64_t now = (uint64_t)sec * 1000000000ull + (uint64_t)usec * 1000ull;
+    uint64_t interval_us, latency_us, period_us = stats->period_ns / 1000, jitter_us;
+
+    if (stats->submit_ns) {
+        latency_us = (modeset_now_ns() - stats->submit_ns) / 1000;
+        if (latency_us > UINT32_MAX)
+            latency_us = UINT32_MAX;
+        if (latency_us > stats->max_latency)
+            stats->max_latency = latency_us;
+        stats->latency[stats->count_latency++ % MODESET_STATS_MAX_SAMPLES] = latency_us;
+        stats->submit_ns = 0;
+    }
+
+    if (stats->flips++ == 0) {
+        stats->first_ns = now;
+        stats->last_ns = now;
+        stats->last_frame = frame;
+        return;
+    }
+
+    /* a flip that took more than one vblank skipped the ones in between */
+    if (frame - stats->last_frame > 1)
+        stats->missed += frame - stats->last_frame - 1;
+
+    interval_us = (now - stats->last_ns) / 1000;
+    if (interval_us / 1000 < MODESET_STATS_BUCKETS)
+        ++stats->hist[interval_us / 1000];
+    else
+        ++stats->hist[MODESET_STATS_BUCKETS];
+
+    if (interval_us > UINT32_MAX)
+        interval_us = UINT32_MAX;
+    stats->samples[stats->count_samples++ % MODESET_STATS_MAX_SAMPLES] = interval_us;
+
+    jitter_us = interval_us > period_us ? interval_us - period_us : period_us - interval_us;
+    if (jitter_us > stats->max_jitter)
+        stats->max_jitter = jitter_us;
+
+    stats->last_ns = now;
+    stats->last_frame = frame;
+}
+
+static int modeset_stats_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* samples held by a ring that has seen count of them */
+static unsigned int modeset_stats_window(uint64_t count)
+{
+    return count < MODESET_STATS_MAX_SAMPLES ? count : MODESET_STATS_MAX_SAMPLES;
+}
+
+static void modeset_stats_percentiles(const uint32_t *samples, unsigned int n, uint32_t *out)
+{
+    uint32_t *sorted;
+    unsigned int i;
+
+    if (!n)
+        return;
+
+    sorted = malloc(n * sizeof(*sorted));
+    if (!sorted)
+        return;
+
+    memcpy(sorted, samples, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), modeset_stats_cmp);
+
+    for (i = 0; i < 4; ++i)
+        out[i] = sorted[(n - 1) * modeset_stats_pct[i] / 100];
+
+    free(sorted);
+}
+
+static void modeset_stats_summarize(const struct modeset_stats *stats, struct modeset_stats_summary *sum)
+{
+    uint32_t *jitter;
+    uint32_t period_us = stats->period_ns / 1000;
+    unsigned int i, n = modeset_stats_window(stats->count_samples);
+
+    memset(sum, 0, sizeof(*sum));
+    modeset_stats_percentiles(stats->latency, modeset_stats_window(stats->count_latency), sum->latency_us);
+    sum->latency_us[3] = stats->max_latency;
+    if (stats->flips < 2 || !n)
+        return;
+
+    sum->fps = (double)(stats->flips - 1) * 1e9 / (stats->last_ns - stats->first_ns);
+    sum->mean_us = (double)(stats->last_ns - stats->first_ns) / 1000.0 / (stats->flips - 1);
+
+    jitter = malloc(n * sizeof(*jitter));
+    if (!jitter)
+        return;
+
+    /* jitter is the distance from the nominal refresh period */
+    for (i = 0; i < n; ++i)
+        jitter[i] = stats->samples[i] > period_us ? stats->samples[i] - period_us : period_us - stats->samples[i];
+    modeset_stats_percentiles(jitter, n, sum->jitter_us);
+    sum->jitter_us[3] = stats->max_jitter;
+
+    free(jitter);
+}
+
+void modeset_stats_print(const struct modeset_stats *stats)
+{
+    struct modeset_stats_summary sum;
+    unsigned int i;
+
+    modeset_stats_summarize(stats, &sum);
+
+    fprintf(stderr, "crtc %u: %llu flips, %.2f fps, mean interval %.1f us (nominal %llu us), %llu missed vblanks\n",
+            stats->crtc_id, (unsigned long long)stats->flips, sum.fps, sum.mean_us,
+            (unsigned long long)(stats->period_ns / 1000), (unsigned long long)stats->missed);
+    fprintf(stderr, "crtc %u: jitter p50 %u us, p90 %u us, p99 %u us, max %u us\n", stats->crtc_id,
+            sum.jitter_us[0], sum.jitter_us[1], sum.jitter_us[2], sum.jitter_us[3]);
+    if (stats->count_samples > MODESET_STATS_MAX_SAMPLES)
+        fprintf(stderr, "crtc %u: percentiles over the last %u of %llu intervals\n", stats->crtc_id,
+                MODESET_STATS_MAX_SAMPLES, (unsigned long long)stats->count_samples);
+    if (stats->count_latency)
+        fprintf(stderr, "crtc %u: flip latency p50 %u us, p90 %u us, p99 %u us, max %u us\n", stats->crtc_id,
+                sum.latency_us[0], sum.latency_us[1], sum.latency_us[2], sum.latency_us[3]);
+
+    for (i = 0; i <= MODESET_STATS_BUCKETS; ++i) {
+        if (!stats->hist[i])
+            continue;
+        if (i < MODESET_STATS_BUCKETS)
+            fprintf(stderr, "  %2u-%2u ms: %llu\n", i, i + 1, (unsigned long long)stats->hist[i]);
+        else
+            fprintf(stderr, "  >=%u ms: %llu\n", i, (unsigned long long)stats->hist[i]);
+    }
+}
+
+int modeset_stats_write_json(const char *path, struct modeset_stats *const *stats, unsigned int count)
+{
+    struct modeset_stats_summary sum;
+    unsigned int i, j;
+    FILE *f;
+
+    f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "cannot open '%s': %m\n", path);
+        return -errno;
+    }
+
+    fprintf(f, "[\n");
+    for (i = 0; i < count; ++i) {
+        modeset_stats_summarize(stats[i], &sum);
+
+        fprintf(f, "  {\"crtc\": %u, \"flips\": %llu, \"fps\": %.3f, \"period_us\": %llu, "
+                "\"mean_interval_us\": %.1f, \"missed_vblanks\": %llu,\n",
+                stats[i]->crtc_id, (unsigned long long)stats[i]->flips, sum.fps,
+                (unsigned long long)(stats[i]->period_ns / 1000), sum.mean_us,
+                (unsigned long long)stats[i]->missed);
+        fprintf(f, "   \"jitter_us\": {\"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u},\n",
+                sum.jitter_us[0], sum.jitter_us[1], sum.jitter_us[2], sum.jitter_us[3]);
+        fprintf(f, "   \"percentile_samples\": %u, \"intervals\": %llu,\n",
+                modeset_stats_window(stats[i]->count_samples), (unsigned long long)stats[i]->count_samples);
+        fprintf(f, "   \"latency_us\": {\"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u},\n",
+                sum.latency_us[0], sum.latency_us[1], sum.latency_us[2], sum.latency_us[3]);
+        fprintf(f, "   \"histogram_ms\": [");
+        for (j = 0; j <= MODESET_STATS_BUCKETS; ++j)
+            fprintf(f, "%s%llu", j ? ", " : "", (unsigned long long)stats[i]->hist[j]);
+        fprintf(f, "]}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(f, "]\n");
+
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef MODESET_STATS_H
+#define MODESET_STATS_H
+
+#include <stdint.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+/*
+ * Frame pacing of one CRTC, fed from page-flip event timestamps. Intervals
+ * go into a 1 ms histogram and a ring of the last MODESET_STATS_MAX_SAMPLES
+ * for the jitter percentiles; gaps in the vblank sequence count as missed
+ * vblanks. When a flip is submitted through modeset_stats_submit(), the
+ * time until its event is delivered is kept as the flip latency, in a
+ * ring of the same size. The maxima cover the whole run, the other
+ * percentiles the flips still in the ring.
+ */
+#define MODESET_STATS_BUCKETS 50
+#define MODESET_STATS_MAX_SAMPLES 8192
+
+struct modeset_stats {
+    uint32_t crtc_id;
+    uint64_t period_ns;
+
+    uint64_t flips;
+    uint64_t missed;
+    uint64_t first_ns;
+    uint64_t last_ns;
+    unsigned int last_frame;
+
+    uint64_t hist[MODESET_STATS_BUCKETS + 1];
+    uint64_t count_samples;
+    uint32_t max_jitter;
+    uint32_t samples[MODESET_STATS_MAX_SAMPLES];
+
+    uint64_t submit_ns;
+    uint64_t count_latency;
+    uint32_t max_latency;
+    uint32_t latency[MODESET_STATS_MAX_SAMPLES];
+};
+
+uint64_t modeset_mode_period_ns(const drmModeModeInfo *mode);
+
+void modeset_stats_init(struct modeset_stats *stats, uint32_t crtc_id, uint64_t period_ns);
+void modeset_stats_submit(struct modeset_stats *stats);
+void modeset_stats_flip(struct modeset_stats *stats, unsigned int frame, unsigned int sec, unsigned int usec);
+void modeset_stats_print(const struct modeset_stats *stats);
+int modeset_stats_write_json(const char *path, struct modeset_stats *const *stats, unsigned int count);
+
+#endif
@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modeset-swapchain.h"
+
+/* MODESET_BUFFERS selects the swapchain length, defaulting to double buffering */
+unsigned int modeset_swapchain_count(void)
+{
+    const char *env = getenv("MODESET_BUFFERS");
+    unsigned long count;
+
+    if (!env)
+        return 2;
+
+    count = strtoul(env, NULL, 10);
+    if (count < 2)
+        return 2;
+    if (count > MODESET_SWAPCHAIN_MAX_BUFS)
+        return MODESET_SWAPCHAIN_MAX_BUFS;
+    return count;
+}
+
+int modeset_swapchain_init(struct modeset_swapchain *sc, struct modeset_pool *pool,
+                           uint32_t width, uint32_t height, unsigned int count)
+{
+    unsigned int i;
+    int ret;
+
+    if (count < 2 || count > MODESET_SWAPCHAIN_MAX_BUFS)
+        return -EINVAL;
+
+    memset(sc, 0, sizeof(*sc));
+    sc->queued = -1;
+    sc->scanout = -1;
+
+    for (i = 0; i < count; ++i) {
+        sc->bufs[i].width = width;
+        sc->bufs[i].height = height;
+
+        ret = modeset_pool_get(pool, &sc->bufs[i]);
+        if (ret) {
+            modeset_swapchain_fini(sc, pool);
+            return ret;
+        }
+        ++sc->count;
+    }
+
+    return 0;
+}
+
+void modeset_swapchain_fini(struct modeset_swapchain *sc, struct modeset_pool *pool)
+{
+    while (sc->count)
+        modeset_pool_put(pool, &sc->bufs[--sc->count]);
+}
+
+int modeset_swapchain_acquire(struct modeset_swapchain *sc)
+{
+    unsigned int i;
+    int idx = -1;
+
+    for (i = 0; i < sc->count; ++i) {
+        if (sc->state[i] == MODESET_BUF_FREE) {
+            sc->state[i] = MODESET_BUF_ACQUIRED;
+            return i;
+        }
+    }
+
+    if (!sc->mailbox)
+        return -1;
+
+    /* overwrite the stalest finished frame, it would never be shown anyway */
+    for (i = 0; i < sc->count; ++i) {
+        if (sc->state[i] == MODESET_BUF_READY && (idx < 0 || sc->seq[i] < sc->seq[idx]))
+            idx = i;
+    }
+    if (idx >= 0)
+        sc->state[idx] = MODESET_BUF_ACQUIRED;
+
+    return idx;
+}
+
+void modeset_swapchain_submit(struct modeset_swapchain *sc, int idx)
+{
+    sc->state[idx] = MODESET_BUF_READY;
+    sc->seq[idx] = sc->next_seq++;
+}
+
+int modeset_swapchain_next(struct modeset_swapchain *sc)
+{
+    unsigned int i;
+    int idx = -1;
+
+    for (i = 0; i < sc->count; ++i) {
+        if (sc->state[i] != MODESET_BUF_READY)
+            continue;
+        if (idx < 0 || (sc->mailbox ? sc->seq[i] > sc->seq[idx] : sc->seq[i] < sc->seq[idx]))
+            idx = i;
+    }
+
+    return idx;
+}
+
+/* also accepts an ACQUIRED buffer that is shown by a synchronous modeset */
+void modeset_swapchain_queue(struct modeset_swapchain *sc, int idx)
+{
+    unsigned int i;
+
+    /* frames older than the one going out are dropped in mailbox mode */
+    for (i = 0; sc->mailbox && i < sc->count; ++i) {
+        if (sc->state[i] == MODESET_BUF_READY && sc->seq[i] < sc->seq[idx])
+            sc->state[i] = MODESET_BUF_FREE;
+    }
+
+    sc->state[idx] = MODESET_BUF_QUEUED;
+    sc->queued = idx;
+}
+
+void modeset_swapchain_flip_done(struct modeset_swapchain *sc)
+{
+    if (sc->queued < 0)
+        return;
+
+    if (sc->scanout >= 0)
+        sc->state[sc->scanout] = MODESET_BUF_FREE;
+    sc->state[sc->queued] = MODESET_BUF_SCANOUT;
+    sc->scanout = sc->queued;
+    sc->queued = -1;
+}
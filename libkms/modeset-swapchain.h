@@ -0,0 +1,55 @@
+#ifndef MODESET_SWAPCHAIN_H
+#define MODESET_SWAPCHAIN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "modeset-buf.h"
+
+/*
+ * Ring of 2-4 scanout buffers with an explicit state per buffer. A buffer
+ * moves FREE -> ACQUIRED (painting) -> READY -> QUEUED (flip submitted)
+ * -> SCANOUT and back to FREE when the next flip completes, so with three
+ * or more buffers the next frame can be painted while a flip is pending.
+ * READY buffers are handed out for flipping in the order they were
+ * submitted.
+ *
+ * In mailbox mode the newest READY buffer is flipped and the older ones
+ * go back to FREE when it is queued, and acquire takes the oldest READY
+ * buffer when nothing is free, so a renderer with three or more buffers
+ * never waits for scanout.
+ */
+#define MODESET_SWAPCHAIN_MAX_BUFS 4
+
+enum modeset_buf_state {
+    MODESET_BUF_FREE,
+    MODESET_BUF_ACQUIRED,
+    MODESET_BUF_READY,
+    MODESET_BUF_QUEUED,
+    MODESET_BUF_SCANOUT,
+};
+
+struct modeset_swapchain {
+    unsigned int count;
+    struct modeset_buf bufs[MODESET_SWAPCHAIN_MAX_BUFS];
+    enum modeset_buf_state state[MODESET_SWAPCHAIN_MAX_BUFS];
+    uint64_t seq[MODESET_SWAPCHAIN_MAX_BUFS];
+    uint64_t next_seq;
+    int queued;
+    int scanout;
+    bool mailbox;
+};
+
+unsigned int modeset_swapchain_count(void);
+
+int modeset_swapchain_init(struct modeset_swapchain *sc, struct modeset_pool *pool,
+                           uint32_t width, uint32_t height, unsigned int count);
+void modeset_swapchain_fini(struct modeset_swapchain *sc, struct modeset_pool *pool);
+
+int modeset_swapchain_acquire(struct modeset_swapchain *sc);
+void modeset_swapchain_submit(struct modeset_swapchain *sc, int idx);
+int modeset_swapchain_next(struct modeset_swapchain *sc);
+void modeset_swapchain_queue(struct modeset_swapchain *sc, int idx);
+void modeset_swapchain_flip_done(struct modeset_swapchain *sc);
+
+#endif
@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modeset-topo.h"
+
+/* property id -> enum modeset_prop, or -1 for properties we do not use */
+struct modeset_topo_props {
+    unsigned int count;
+    uint32_t ids[MODESET_TOPO_MAX_PROPS];
+    int index[MODESET_TOPO_MAX_PROPS];
+};
+
+static int modeset_topo_prop_index(int fd, struct modeset_topo_props *cache, uint32_t prop_id)
+{
+    drmModePropertyRes *info;
+    unsigned int i;
+    int idx = -1;
+
+    for (i = 0; i < cache->count; ++i) {
+        if (cache->ids[i] == prop_id)
+            return cache->index[i];
+    }
+
+    info = drmModeGetProperty(fd, prop_id);
+    if (!info)
+        return -1;
+
+    for (i = 0; i < MODESET_PROP_COUNT; ++i) {
+        if (!strcmp(info->name, modeset_prop_name(i))) {
+            idx = i;
+            break;
+        }
+    }
+    drmModeFreeProperty(info);
+
+    if (cache->count < MODESET_TOPO_MAX_PROPS) {
+        cache->ids[cache->count] = prop_id;
+        cache->index[cache->count++] = idx;
+    }
+
+    return idx;
+}
+
+static int modeset_topo_get_properties(int fd, struct modeset_topo_props *cache, struct drm_object *obj, uint32_t type)
+{
+    drmModeObjectProperties *props;
+    unsigned int i;
+    int idx;
+
+    memset(obj->prop_ids, 0, sizeof(obj->prop_ids));
+    memset(obj->prop_values, 0, sizeof(obj->prop_values));
+
+    props = drmModeObjectGetProperties(fd, obj->id, type);
+    if (!props)
+        return -errno;
+
+    for (i = 0; i < props->count_props; ++i) {
+        idx = modeset_topo_prop_index(fd, cache, props->props[i]);
+        if (idx < 0)
+            continue;
+
+        obj->prop_ids[idx] = props->props[i];
+        obj->prop_values[idx] = props->prop_values[i];
+    }
+
+    drmModeFreeObjectProperties(props);
+    return 0;
+}
+
+static void modeset_topo_get_zpos(int fd, struct modeset_topo_plane *tp)
+{
+    drmModePropertyRes *info;
+
+    tp->zpos_known = false;
+    tp->zpos_min = tp->zpos_max = 0;
+    if (!tp->obj.prop_ids[MODESET_PROP_ZPOS])
+        return;
+
+    info = drmModeGetProperty(fd, tp->obj.prop_ids[MODESET_PROP_ZPOS]);
+    if (!info)
+        return;
+
+    tp->zpos_known = true;
+    if (info->flags & DRM_MODE_PROP_IMMUTABLE || !(info->flags & DRM_MODE_PROP_RANGE) || info->count_values < 2) {
+        tp->zpos_min = tp->zpos_max = tp->obj.prop_values[MODESET_PROP_ZPOS];
+    }
+    else {
+        tp->zpos_min = info->values[0];
+        tp->zpos_max = info->values[1];
+    }
+    drmModeFreeProperty(info);
+}
+
+static int modeset_topo_encoder_index(const struct modeset_topo *topo, uint32_t encoder_id)
+{
+    unsigned int i;
+
+    for (i = 0; i < topo->count_encoders; ++i) {
+        if (topo->encoders[i].id == encoder_id)
+            return i;
+    }
+
+    return -1;
+}
+
+int modeset_topo_crtc_index(const struct modeset_topo *topo, uint32_t crtc_id)
+{
+    unsigned int i;
+
+    for (i = 0; i < topo->count_crtcs; ++i) {
+        if (topo->crtcs[i].obj.id == crtc_id)
+            return i;
+    }
+
+    return -1;
+}
+
+static void modeset_topo_probe_crtcs(int fd, struct modeset_topo_props *cache, struct modeset_topo *topo, drmModeRes *res)
+{
+    struct modeset_topo_crtc *tc;
+    drmModeCrtc *crtc;
+    int i;
+
+    for (i = 0; i < res->count_crtcs && topo->count_crtcs < MODESET_TOPO_MAX_CRTCS; ++i) {
+        tc = &topo->crtcs[topo->count_crtcs++];
+        tc->obj.id = res->crtcs[i];
+
+        crtc = drmModeGetCrtc(fd, tc->obj.id);
+        if (crtc) {
+            tc->fb = crtc->buffer_id;
+            tc->mode_valid = crtc->mode_valid;
+            tc->mode = crtc->mode;
+            drmModeFreeCrtc(crtc);
+        }
+
+        modeset_topo_get_properties(fd, cache, &tc->obj, DRM_MODE_OBJECT_CRTC);
+    }
+}
+
+static void modeset_topo_probe_encoders(int fd, struct modeset_topo *topo, drmModeRes *res)
+{
+    struct modeset_topo_encoder *te;
+    drmModeEncoder *enc;
+    int i;
+
+    for (i = 0; i < res->count_encoders && topo->count_encoders < MODESET_TOPO_MAX_ENCODERS; ++i) {
+        enc = drmModeGetEncoder(fd, res->encoders[i]);
+        if (!enc)
+            continue;
+
+        te = &topo->encoders[topo->count_encoders++];
+        te->id = enc->encoder_id;
+        te->possible_crtcs = enc->possible_crtcs;
+        te->crtc = enc->crtc_id ? modeset_topo_crtc_index(topo, enc->crtc_id) : -1;
+        drmModeFreeEncoder(enc);
+    }
+}
+
+static void modeset_topo_fill_connector(int fd, struct modeset_topo_props *cache, struct modeset_topo *topo,
+                                        unsigned int index, drmModeConnector *conn)
+{
+    struct modeset_topo_connector *tc = &topo->connectors[index];
+    int j, enc;
+
+    tc->obj.id = conn->connector_id;
+    tc->connection = conn->connection;
+    tc->count_modes = conn->count_modes;
+    if (conn->count_modes)
+        tc->mode = conn->modes[0];
+
+    tc->crtc = -1;
+    for (j = 0; j < conn->count_encoders; ++j) {
+        enc = modeset_topo_encoder_index(topo, conn->encoders[j]);
+        if (enc >= 0)
+            tc->possible_crtcs |= topo->encoders[enc].possible_crtcs;
+    }
+    if (conn->encoder_id) {
+        enc = modeset_topo_encoder_index(topo, conn->encoder_id);
+        if (enc >= 0)
+            tc->crtc = topo->encoders[enc].crtc;
+    }
+
+    if (conn->connection == DRM_MODE_CONNECTED && conn->count_modes)
+        topo->connected_mask |= 1u << index;
+
+    modeset_topo_get_properties(fd, cache, &tc->obj, DRM_MODE_OBJECT_CONNECTOR);
+}
+
+/* connectors the cached state says nothing about, probed in full by the workers */
+struct modeset_topo_reprobe {
+    int fd;
+    unsigned int count;
+    unsigned int next;
+    pthread_mutex_t lock;
+    uint32_t ids[MODESET_TOPO_MAX_CONNECTORS];
+    unsigned int index[MODESET_TOPO_MAX_CONNECTORS];
+    drmModeConnector *conns[MODESET_TOPO_MAX_CONNECTORS];
+    int errs[MODESET_TOPO_MAX_CONNECTORS];
+    pthread_t threads[MODESET_TOPO_MAX_PROBE_THREADS];
+    unsigned int count_threads;
+};
+
+static void *modeset_topo_reprobe_worker(void *data)
+{
+    struct modeset_topo_reprobe *rp = data;
+    unsigned int i;
+
+    for (;;) {
+        pthread_mutex_lock(&rp->lock);
+        i = rp->next++;
+        pthread_mutex_unlock(&rp->lock);
+        if (i >= rp->count)
+            break;
+
+        rp->conns[i] = drmModeGetConnector(rp->fd, rp->ids[i]);
+        /* errno is per thread, keep it for the report after the join */
+        rp->errs[i] = rp->conns[i] ? 0 : errno;
+    }
+
+    return NULL;
+}
+
+/*
+ * Cached state is enough for a connector the kernel has probed before;
+ * "unknown", or connected without a mode list, means it never was.
+ */
+static bool modeset_topo_need_reprobe(const drmModeConnector *conn)
+{
+    return conn->connection == DRM_MODE_UNKNOWNCONNECTION ||
+           (conn->connection == DRM_MODE_CONNECTED && !conn->count_modes);
+}
+
+/* single connector, for callers that walk the connectors themselves */
+drmModeConnector *modeset_topo_get_connector(int fd, uint32_t connector_id, unsigned int flags)
+{
+    drmModeConnector *conn;
+
+    if (flags & MODESET_TOPO_PROBE_CURRENT) {
+        conn = drmModeGetConnectorCurrent(fd, connector_id);
+        if (conn && !modeset_topo_need_reprobe(conn))
+            return conn;
+        drmModeFreeConnector(conn);
+    }
+
+    return drmModeGetConnector(fd, connector_id);
+}
+
+static void modeset_topo_probe_connectors(int fd, struct modeset_topo_props *cache, struct modeset_topo *topo,
+                                          drmModeRes *res, unsigned int flags, struct modeset_topo_reprobe *rp)
+{
+    drmModeConnector *conn;
+    unsigned int i;
+
+    for (i = 0; i < (unsigned int)res->count_connectors && topo->count_connectors < MODESET_TOPO_MAX_CONNECTORS; ++i) {
+        if (flags & MODESET_TOPO_PROBE_CURRENT) {
+            /* no cached state to go by is no reason to skip the connector, probe it */
+            conn = drmModeGetConnectorCurrent(fd, res->connectors[i]);
+            if (!conn || modeset_topo_need_reprobe(conn)) {
+                drmModeFreeConnector(conn);
+                rp->ids[rp->count] = res->connectors[i];
+                rp->index[rp->count++] = topo->count_connectors++;
+                continue;
+            }
+        }
+        else {
+            conn = drmModeGetConnector(fd, res->connectors[i]);
+        }
+
+        if (!conn) {
+            fprintf(stderr, "cannot retrieve DRM connector %u:%u (%d): %m\n", i, res->connectors[i], errno);
+            continue;
+        }
+
+        modeset_topo_fill_connector(fd, cache, topo, topo->count_connectors++, conn);
+        drmModeFreeConnector(conn);
+    }
+
+    /* the rest of the probe carries on while the workers read EDIDs */
+    if (!(flags & MODESET_TOPO_PROBE_PARALLEL))
+        return;
+
+    pthread_mutex_init(&rp->lock, NULL);
+    for (i = 0; i < rp->count && i < MODESET_TOPO_MAX_PROBE_THREADS; ++i) {
+        if (pthread_create(&rp->threads[rp->count_threads], NULL, modeset_topo_reprobe_worker, rp))
+            break;
+        ++rp->count_threads;
+    }
+}
+
+static void modeset_topo_finish_connectors(int fd, struct modeset_topo_props *cache, struct modeset_topo *topo,
+                                           struct modeset_topo_reprobe *rp)
+{
+    unsigned int i;
+
+    for (i = 0; i < rp->count_threads; ++i)
+        pthread_join(rp->threads[i], NULL);
+    if (rp->count_threads)
+        pthread_mutex_destroy(&rp->lock);
+
+    for (i = 0; i < rp->count; ++i) {
+        if (!rp->count_threads) {
+            rp->conns[i] = drmModeGetConnector(fd, rp->ids[i]);
+            rp->errs[i] = errno;
+        }
+        if (!rp->conns[i]) {
+            fprintf(stderr, "cannot retrieve DRM connector %u (%d): %s\n", rp->ids[i], rp->errs[i],
+                    strerror(rp->errs[i]));
+            topo->connectors[rp->index[i]].obj.id = rp->ids[i];
+            topo->connectors[rp->index[i]].crtc = -1;
+            continue;
+        }
+
+        modeset_topo_fill_connector(fd, cache, topo, rp->index[i], rp->conns[i]);
+        drmModeFreeConnector(rp->conns[i]);
+    }
+}
+
+static void modeset_topo_probe_planes(int fd, struct modeset_topo_props *cache, struct modeset_topo *topo)
+{
+    struct modeset_topo_plane *tp;
+    drmModePlaneRes *plane_res;
+    drmModePlane *plane;
+    unsigned int i;
+
+    plane_res = drmModeGetPlaneResources(fd);
+    if (!plane_res) {
+        fprintf(stderr, "drmModeGetPlaneResources failed: %s\n", strerror(errno));
+        return;
+    }
+
+    for (i = 0; i < plane_res->count_planes && topo->count_planes < MODESET_TOPO_MAX_PLANES; ++i) {
+        plane = drmModeGetPlane(fd, plane_res->planes[i]);
+        if (!plane) {
+            fprintf(stderr, "drmModeGetPlane(%u) failed: %s\n", plane_res->planes[i], strerror(errno));
+            continue;
+        }
+
+        tp = &topo->planes[topo->count_planes];
+        tp->obj.id = plane->plane_id;
+        tp->possible_crtcs = plane->possible_crtcs;
+        drmModeFreePlane(plane);
+
+        modeset_topo_get_properties(fd, cache, &tp->obj, DRM_MODE_OBJECT_PLANE);
+        modeset_topo_get_zpos(fd, tp);
+        tp->type = tp->obj.prop_values[MODESET_PROP_TYPE];
+        switch (tp->type) {
+            case DRM_PLANE_TYPE_PRIMARY:
+                topo->primary_mask |= 1ull << topo->count_planes;
+                break;
+            case DRM_PLANE_TYPE_CURSOR:
+                topo->cursor_mask |= 1ull << topo->count_planes;
+                break;
+            default:
+                topo->overlay_mask |= 1ull << topo->count_planes;
+                break;
+        }
+        ++topo->count_planes;
+    }
+
+    drmModeFreePlaneResources(plane_res);
+}
+
+unsigned int modeset_topo_probe_env(void)
+{
+    const char *env = getenv("MODESET_FAST_PROBE");
+
+    if (!env || !strcmp(env, "0"))
+        return 0;
+    if (!strcmp(env, "parallel"))
+        return MODESET_TOPO_PROBE_CURRENT | MODESET_TOPO_PROBE_PARALLEL;
+    return MODESET_TOPO_PROBE_CURRENT;
+}
+
+int modeset_topo_probe(int fd, struct modeset_topo *topo)
+{
+    return modeset_topo_probe_flags(fd, topo, modeset_topo_probe_env());
+}
+
+int modeset_topo_probe_flags(int fd, struct modeset_topo *topo, unsigned int flags)
+{
+    struct modeset_topo_reprobe rp;
+    struct modeset_topo_props cache;
+    drmModeRes *res;
+
+    memset(topo, 0, sizeof(*topo));
+    cache.count = 0;
+    rp.fd = fd;
+    rp.count = 0;
+    rp.next = 0;
+    rp.count_threads = 0;
+
+    res = drmModeGetResources(fd);
+    if (!res) {
+        fprintf(stderr, "cannot retrieve DRM resources (%d): %m\n", errno);
+        return -errno;
+    }
+
+    topo->max_width = res->max_width;
+    topo->max_height = res->max_height;
+
+    /* CRTCs first: encoders and connectors refer to them by index */
+    modeset_topo_probe_crtcs(fd, &cache, topo, res);
+    modeset_topo_probe_encoders(fd, topo, res);
+    modeset_topo_probe_connectors(fd, &cache, topo, res, flags, &rp);
+    modeset_topo_probe_planes(fd, &cache, topo);
+    modeset_topo_finish_connectors(fd, &cache, topo, &rp);
+
+    drmModeFreeResources(res);
+    return 0;
+}
+
+/* first plane of the given types usable on the CRTC and not in @used */
+int modeset_topo_find_plane(const struct modeset_topo *topo, unsigned int crtc, uint64_t type_mask, uint64_t used)
+{
+    unsigned int i;
+
+    for (i = 0; i < topo->count_planes; ++i) {
+        if (!(type_mask & ~used & (1ull << i)))
+            continue;
+        if (topo->planes[i].possible_crtcs & (1u << crtc))
+            return i;
+    }
+
+    return -1;
+}
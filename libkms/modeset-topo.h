@@ -0,0 +1,92 @@
+#ifndef MODESET_TOPO_H
+#define MODESET_TOPO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+#include "modeset-props.h"
+
+/*
+ * One-shot snapshot of a device's KMS objects in flat arrays. CRTCs are
+ * referred to by index, so encoder and plane possible_crtcs masks apply
+ * directly and connector/plane matching needs no further ioctls.
+ * Property names are resolved once per property id, not once per object.
+ */
+#define MODESET_TOPO_MAX_CONNECTORS 32
+#define MODESET_TOPO_MAX_ENCODERS 32
+#define MODESET_TOPO_MAX_CRTCS 32
+#define MODESET_TOPO_MAX_PLANES 64
+#define MODESET_TOPO_MAX_PROPS 256
+#define MODESET_TOPO_MAX_PROBE_THREADS 8
+
+/*
+ * drmModeGetConnector forces a full probe of every connector, EDID reads
+ * over DDC included. PROBE_CURRENT takes the state the kernel already has
+ * and fully probes only connectors it knows nothing about; PROBE_PARALLEL
+ * runs those probes in worker threads while the planes are probed. The
+ * kernel serializes probes of one device, so the workers mostly overlap
+ * probing with the rest of the startup. MODESET_FAST_PROBE=1 (or
+ * "parallel") selects them for modeset_topo_probe.
+ */
+#define MODESET_TOPO_PROBE_CURRENT (1u << 0)
+#define MODESET_TOPO_PROBE_PARALLEL (1u << 1)
+
+struct modeset_topo_connector {
+    struct drm_object obj;
+    uint32_t connection;
+    uint32_t count_modes;
+    drmModeModeInfo mode;
+    /* union over the connector's encoders, in CRTC indices */
+    uint32_t possible_crtcs;
+    int crtc;
+};
+
+struct modeset_topo_encoder {
+    uint32_t id;
+    uint32_t possible_crtcs;
+    int crtc;
+};
+
+struct modeset_topo_crtc {
+    struct drm_object obj;
+    uint32_t fb;
+    int mode_valid;
+    drmModeModeInfo mode;
+};
+
+struct modeset_topo_plane {
+    struct drm_object obj;
+    uint32_t possible_crtcs;
+    uint32_t type;
+    /* zpos range; an immutable zpos has min == max, no zpos property leaves zpos_known false */
+    bool zpos_known;
+    uint64_t zpos_min, zpos_max;
+};
+
+struct modeset_topo {
+    unsigned int count_connectors;
+    unsigned int count_encoders;
+    unsigned int count_crtcs;
+    unsigned int count_planes;
+    struct modeset_topo_connector connectors[MODESET_TOPO_MAX_CONNECTORS];
+    struct modeset_topo_encoder encoders[MODESET_TOPO_MAX_ENCODERS];
+    struct modeset_topo_crtc crtcs[MODESET_TOPO_MAX_CRTCS];
+    struct modeset_topo_plane planes[MODESET_TOPO_MAX_PLANES];
+
+    uint32_t max_width, max_height;
+    uint32_t connected_mask;
+    uint64_t primary_mask;
+    uint64_t overlay_mask;
+    uint64_t cursor_mask;
+};
+
+int modeset_topo_probe(int fd, struct modeset_topo *topo);
+int modeset_topo_probe_flags(int fd, struct modeset_topo *topo, unsigned int flags);
+unsigned int modeset_topo_probe_env(void);
+drmModeConnector *modeset_topo_get_connector(int fd, uint32_t connector_id, unsigned int flags);
+
+int modeset_topo_crtc_index(const struct modeset_topo *topo, uint32_t crtc_id);
+int modeset_topo_find_plane(const struct modeset_topo *topo, unsigned int crtc, uint64_t type_mask, uint64_t used);
+
+#endif
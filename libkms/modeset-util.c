@@ -0,0 +1,39 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "modeset-util.h"
+
+uint64_t modeset_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Per-output switches are passed through the environment: the variable
+ * is either "all" or a comma separated list of connector ids.
+ */
+int modeset_env_match(const char *name, uint32_t connector_id)
+{
+    const char *env = getenv(name);
+    char *end;
+
+    if (!env)
+        return 0;
+    if (!strcmp(env, "all"))
+        return 1;
+
+    while (*env) {
+        if (strtoul(env, &end, 10) == connector_id && end != env)
+            return 1;
+        if (*end != ',')
+            break;
+        env = end + 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef MODESET_UTIL_H
+#define MODESET_UTIL_H
+
+#include <stdint.h>
+
+uint64_t modeset_now_ns(void);
+int modeset_env_match(const char *name, uint32_t connector_id);
+
+#endif
@@ -0,0 +1,266 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "modeset-buf.h"
+#include "modeset-props.h"
+#include "modeset-req.h"
+
+#define BENCH_ITERATIONS 10000
+
+struct modeset_buf buf[2];
+struct drm_object conn_obj, crtc_obj, plane_obj;
+
+static uint64_t bench_now(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int add_plane_state(drmModeAtomicReq *req, struct modeset_buf *bo)
+{
+    set_drm_object_property(req, &plane_obj, MODESET_PROP_FB_ID, bo->fb);
+    set_drm_object_property(req, &plane_obj, MODESET_PROP_CRTC_ID, crtc_obj.id);
+    set_drm_object_property(req, &plane_obj, MODESET_PROP_SRC_X, 0);
+    set_drm_object_property(req, &plane_obj, MODESET_PROP_SRC_Y, 0);
+    set_drm_object_property(req, &plane_obj, MODESET_PROP_SRC_W, bo->width << 16);
+    set_drm_object_property(req, &plane_obj, MODESET_PROP_SRC_H, bo->height << 16);
+    set_drm_object_property(req, &plane_obj, MODESET_PROP_CRTC_X, 0);
+    set_drm_object_property(req, &plane_obj, MODESET_PROP_CRTC_Y, 0);
+    set_drm_object_property(req, &plane_obj, MODESET_PROP_CRTC_W, bo->width);
+    return set_drm_object_property(req, &plane_obj, MODESET_PROP_CRTC_H, bo->height);
+}
+
+static void bench_report(const char *name, uint64_t wall, uint64_t cpu)
+{
+    printf("%-28s %10.1f ns/flip wall %10.1f ns/flip cpu\n", name,
+           (double)wall / BENCH_ITERATIONS, (double)cpu / BENCH_ITERATIONS);
+}
+
+/* per-flip cost of the old path: allocate, rebuild every property, commit, free */
+static void bench_alloc_path(int fd, uint32_t flags, const char *name)
+{
+    drmModeAtomicReq *req;
+    uint64_t wall, cpu;
+    int i;
+
+    wall = bench_now(CLOCK_MONOTONIC);
+    cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID);
+    for (i = 0; i < BENCH_ITERATIONS; ++i) {
+        req = drmModeAtomicAlloc();
+        add_plane_state(req, &buf[i & 1]);
+        if (flags)
+            drmModeAtomicCommit(fd, req, flags, NULL);
+        drmModeAtomicFree(req);
+    }
+    cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    wall = bench_now(CLOCK_MONOTONIC) - wall;
+
+    bench_report(name, wall, cpu);
+}
+
+/* per-flip cost of the prebuilt template: patch FB_ID in place and commit */
+static void bench_template_path(int fd, uint32_t flags, const char *name)
+{
+    struct modeset_req req;
+    uint64_t wall, cpu;
+    int i, slot;
+
+    modeset_req_init(&req);
+    slot = modeset_req_add(&req, &plane_obj, MODESET_PROP_FB_ID, buf[0].fb);
+    modeset_req_add(&req, &plane_obj, MODESET_PROP_CRTC_ID, crtc_obj.id);
+    modeset_req_add(&req, &plane_obj, MODESET_PROP_SRC_X, 0);
+    modeset_req_add(&req, &plane_obj, MODESET_PROP_SRC_Y, 0);
+    modeset_req_add(&req, &plane_obj, MODESET_PROP_SRC_W, buf[0].width << 16);
+    modeset_req_add(&req, &plane_obj, MODESET_PROP_SRC_H, buf[0].height << 16);
+    modeset_req_add(&req, &plane_obj, MODESET_PROP_CRTC_X, 0);
+    modeset_req_add(&req, &plane_obj, MODESET_PROP_CRTC_Y, 0);
+    modeset_req_add(&req, &plane_obj, MODESET_PROP_CRTC_W, buf[0].width);
+    modeset_req_add(&req, &plane_obj, MODESET_PROP_CRTC_H, buf[0].height);
+
+    wall = bench_now(CLOCK_MONOTONIC);
+    cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID);
+    for (i = 0; i < BENCH_ITERATIONS; ++i) {
+        modeset_req_set(&req, slot, buf[i & 1].fb);
+        if (flags)
+            modeset_req_commit(fd, &req, flags, NULL);
+    }
+    cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    wall = bench_now(CLOCK_MONOTONIC) - wall;
+
+    bench_report(name, wall, cpu);
+}
+
+static int find_primary_plane(int fd, drmModeRes *res)
+{
+    drmModePlaneRes *plane_res;
+    drmModePlane *plane;
+    uint32_t i, crtc_index = 0;
+
+    for (i = 0; i < res->count_crtcs; ++i) {
+        if (res->crtcs[i] == crtc_obj.id)
+            crtc_index = i;
+    }
+
+    plane_res = drmModeGetPlaneResources(fd);
+    if (!plane_res)
+        return -ENOENT;
+
+    for (i = 0; i < plane_res->count_planes; ++i) {
+        plane = drmModeGetPlane(fd, plane_res->planes[i]);
+        if (!plane)
+            continue;
+
+        if (plane->possible_crtcs & (1 << crtc_index)) {
+            plane_obj.id = plane->plane_id;
+            modeset_get_object_properties(fd, &plane_obj, DRM_MODE_OBJECT_PLANE);
+            if (plane_obj.prop_values[MODESET_PROP_TYPE] == DRM_PLANE_TYPE_PRIMARY) {
+                drmModeFreePlane(plane);
+                drmModeFreePlaneResources(plane_res);
+                return 0;
+            }
+        }
+        drmModeFreePlane(plane);
+    }
+
+    drmModeFreePlaneResources(plane_res);
+    return -ENOENT;
+}
+
+int main(int argc, char **argv)
+{
+    int fd, i, nbufs = 0, ret = 1;
+    const char *card;
+    drmModeConnector *conn = NULL;
+    drmModeEncoder *enc;
+    drmModeRes *res;
+    drmModeAtomicReq *req;
+    uint32_t blob_id = 0;
+
+    if (argc > 1)
+        card = argv[1];
+    else
+        card = "/dev/dri/card0";
+
+    fd = open(card, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open '%s': %m\n", card);
+        return 1;
+    }
+
+    drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+    if (drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1)) {
+        fprintf(stderr, "drm device '%s' does not support atomic KMS\n", card);
+        close(fd);
+        return 1;
+    }
+
+    res = drmModeGetResources(fd);
+    if (!res) {
+        fprintf(stderr, "cannot retrieve DRM resources (%d): %m\n", errno);
+        close(fd);
+        return 1;
+    }
+
+    for (i = 0; i < res->count_connectors; ++i) {
+        conn = drmModeGetConnector(fd, res->connectors[i]);
+        if (!conn) {
+            fprintf(stderr, "cannot retrieve DRM connector %u:%u (%d): %m\n", i, res->connectors[i], errno);
+            continue;
+        }
+        if (conn->connection == DRM_MODE_CONNECTED && conn->count_modes && conn->count_encoders)
+            break;
+        drmModeFreeConnector(conn);
+        conn = NULL;
+    }
+    if (!conn) {
+        fprintf(stderr, "no connected connector\n");
+        goto out_res;
+    }
+
+    enc = drmModeGetEncoder(fd, conn->encoders[0]);
+    if (!enc) {
+        fprintf(stderr, "cannot retrieve encoder %u (%d): %m\n", conn->encoders[0], errno);
+        goto out_conn;
+    }
+    for (i = 0; i < res->count_crtcs; ++i) {
+        if (enc->possible_crtcs & (1 << i)) {
+            crtc_obj.id = res->crtcs[i];
+            break;
+        }
+    }
+    drmModeFreeEncoder(enc);
+    if (!crtc_obj.id) {
+        fprintf(stderr, "no crtc for connector %u\n", conn->connector_id);
+        goto out_conn;
+    }
+
+    conn_obj.id = conn->connector_id;
+    if (modeset_get_object_properties(fd, &conn_obj, DRM_MODE_OBJECT_CONNECTOR) ||
+        modeset_get_object_properties(fd, &crtc_obj, DRM_MODE_OBJECT_CRTC)) {
+        fprintf(stderr, "cannot retrieve connector and crtc properties\n");
+        goto out_conn;
+    }
+    if (find_primary_plane(fd, res)) {
+        fprintf(stderr, "couldn't find a primary plane\n");
+        goto out_conn;
+    }
+
+    for (; nbufs < 2; ++nbufs) {
+        buf[nbufs].width = conn->modes[0].hdisplay;
+        buf[nbufs].height = conn->modes[0].vdisplay;
+        if (modeset_create_fb(fd, &buf[nbufs]))
+            goto out_fb;
+    }
+
+    if (drmModeCreatePropertyBlob(fd, &conn->modes[0], sizeof(conn->modes[0]), &blob_id)) {
+        fprintf(stderr, "couldn't create a blob property\n");
+        goto out_fb;
+    }
+
+    req = drmModeAtomicAlloc();
+    if (!req)
+        goto out_blob;
+    set_drm_object_property(req, &conn_obj, MODESET_PROP_CRTC_ID, crtc_obj.id);
+    set_drm_object_property(req, &crtc_obj, MODESET_PROP_MODE_ID, blob_id);
+    set_drm_object_property(req, &crtc_obj, MODESET_PROP_ACTIVE, 1);
+    add_plane_state(req, &buf[0]);
+    i = drmModeAtomicCommit(fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+    drmModeAtomicFree(req);
+    if (i) {
+        fprintf(stderr, "modeset atomic commit failed, %d\n", -i);
+        goto out_blob;
+    }
+
+    printf("%ux%u, %d flips per run\n", buf[0].width, buf[0].height, BENCH_ITERATIONS);
+
+    bench_alloc_path(fd, 0, "alloc+build");
+    bench_template_path(fd, 0, "template patch");
+    bench_alloc_path(fd, DRM_MODE_ATOMIC_TEST_ONLY, "alloc+build+test-commit");
+    bench_template_path(fd, DRM_MODE_ATOMIC_TEST_ONLY, "template+test-commit");
+    ret = 0;
+
+out_blob:
+    if (blob_id)
+        drmModeDestroyPropertyBlob(fd, blob_id);
+out_fb:
+    while (nbufs--)
+        modeset_destroy_fb(fd, &buf[nbufs]);
+out_conn:
+    drmModeFreeConnector(conn);
+out_res:
+    drmModeFreeResources(res);
+    close(fd);
+
+    return ret;
+}
@@ -3,177 +3,174 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
-struct buffer_object {
-    uint32_t width;
-    uint32_t height;
-    uint32_t pitch;
-    uint32_t handle;
-    uint32_t size;
-    uint8_t *vaddr;
-    uint32_t fb_id;
-};
+#include "modeset-assign.h"
+#include "modeset-buf.h"
+#include "modeset-comp.h"
+#include "modeset-cursor.h"
+#include "modeset-fill.h"
+#include "modeset-req.h"
+#include "modeset-topo.h"
+#include "modeset-util.h"
 
-struct buffer_object buf;
+#define LAYER_COUNT 4
+#define LAYER_SIZE 320
+#define CURSOR_SIZE 16
+#define CURSOR_MOVES 500
 
-static int modeset_create_fb(int fd, struct buffer_object *bo)
-{
-    struct drm_mode_create_dumb create = {};
-    struct drm_mode_map_dumb map = {};
-
-    create.width = bo->width;
-    create.height = bo->height;
-    create.bpp = 32;
-    drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create);
-
-    bo->pitch = create.pitch;
-    bo->size = create.size;
-    bo->handle = create.handle;
-    drmModeAddFB(fd, bo->width, bo->height, 24, 32, bo->pitch, bo->handle, &bo->fb_id);
-
-    map.handle = create.handle;
-    drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map);
-
-    bo->vaddr = mmap(0, create.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map.offset);
+struct modeset_buf buf;
+struct modeset_buf layer_buf[LAYER_COUNT];
 
-    memset(bo->vaddr, 0xff, bo->size);
+static struct modeset_topo topo;
+static struct modeset_assign assign;
+static struct modeset_comp comp;
+static struct modeset_cursor cursor;
 
-    return 0;
-}
+static const uint32_t layer_colors[LAYER_COUNT] = { 0xff0000, 0x00ff00, 0x0000ff, 0xffff00 };
 
-static void modeset_destroy_fb(int fd, struct buffer_object *bo)
+static int add_primary_state(struct modeset_req *req, struct drm_object *plane, uint32_t crtc_id)
 {
-    struct drm_mode_destroy_dumb destroy = {};
-
-    drmModeRmFB(fd, bo->fb_id);
-
-    munmap(bo->vaddr, bo->size);
-
-    destroy.handle = bo->handle;
-    drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
-}
-
-static uint32_t get_property_id(int fd, drmModeObjectProperties *props, const char *name)
-{
-    drmModePropertyPtr property;
-    uint32_t i, id = 0;
-
-    for (i = 0; i < props->count_props; ++i) {
-        property = drmModeGetProperty(fd, props->props[i]);
-        if (!strcmp(property->name, name))
-            id = property->prop_id;
-        drmModeFreeProperty(property);
-
-        if (id)
-            break;
-    }
-
-    return id;
+    modeset_req_add(req, plane, MODESET_PROP_FB_ID, buf.fb);
+    modeset_req_add(req, plane, MODESET_PROP_CRTC_ID, crtc_id);
+    modeset_req_add(req, plane, MODESET_PROP_SRC_X, 0);
+    modeset_req_add(req, plane, MODESET_PROP_SRC_Y, 0);
+    modeset_req_add(req, plane, MODESET_PROP_SRC_W, buf.width << 16);
+    modeset_req_add(req, plane, MODESET_PROP_SRC_H, buf.height << 16);
+    modeset_req_add(req, plane, MODESET_PROP_CRTC_X, 0);
+    modeset_req_add(req, plane, MODESET_PROP_CRTC_Y, 0);
+    modeset_req_add(req, plane, MODESET_PROP_CRTC_W, buf.width);
+    return modeset_req_add(req, plane, MODESET_PROP_CRTC_H, buf.height);
 }
 
 int main(int argc, char **argv)
 {
-    int fd;
-    drmModeConnector *conn;
-    drmModeRes *res;
-    drmModePlaneRes *plane_res;
-    drmModeObjectProperties *props;
-    drmModeAtomicReq *req;
-    uint32_t conn_id;
-    uint32_t crtc_id;
-    uint32_t plane_id;
+    int fd, crtc = -1, primary, i;
+    struct modeset_topo_connector *conn = NULL;
+    struct drm_object *crtc_obj, *plane_obj;
+    struct drm_mode_rect src, dst;
+    struct modeset_req req;
     uint32_t blob_id;
-    uint32_t property_crtc_id;
-    uint32_t property_mode_id;
-    uint32_t property_active;
-    uint32_t property_fb_id;
-    uint32_t property_crtc_x;
-    uint32_t property_crtc_y;
-    uint32_t property_crtc_w;
-    uint32_t property_crtc_h;
-    uint32_t property_src_x;
-    uint32_t property_src_y;
-    uint32_t property_src_w;
-    uint32_t property_src_h;
 
     fd = open("/dev/dri/card0", O_RDWR | O_CLOEXEC);
 
-    res = drmModeGetResources(fd);
-    crtc_id = res->crtcs[0];
-    conn_id = res->connectors[0];
-
     drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
-    plane_res = drmModeGetPlaneResources(fd);
-    plane_id = plane_res->planes[0];
-
-    conn = drmModeGetConnector(fd, conn_id);
-    buf.width = conn->modes[0].hdisplay;
-    buf.height = conn->modes[0].vdisplay;
+    drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1);
 
-    modeset_create_fb(fd, &buf);
+    if (modeset_topo_probe(fd, &topo)) {
+        close(fd);
+        return 1;
+    }
+    modeset_assign_solve(&topo, topo.connected_mask, &assign);
 
-    drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1);
+    for (i = 0; i < (int)topo.count_connectors; ++i) {
+        if (assign.conn_crtc[i] >= 0) {
+            conn = &topo.connectors[i];
+            crtc = assign.conn_crtc[i];
+            break;
+        }
+    }
+    if (!conn || assign.crtc_primary[crtc] < 0) {
+        fprintf(stderr, "no connector with a crtc and primary plane\n");
+        close(fd);
+        return 1;
+    }
+    primary = assign.crtc_primary[crtc];
+    crtc_obj = &topo.crtcs[crtc].obj;
+    plane_obj = &topo.planes[primary].obj;
 
-    props = drmModeObjectGetProperties(fd, conn_id, DRM_MODE_OBJECT_CONNECTOR);
-    property_crtc_id = get_property_id(fd, props, "CRTC_ID");
-    drmModeFreeObjectProperties(props);
+    buf.width = conn->mode.hdisplay;
+    buf.height = conn->mode.vdisplay;
 
-    props = drmModeObjectGetProperties(fd, crtc_id, DRM_MODE_OBJECT_CRTC);
-    property_active = get_property_id(fd, props, "ACTIVE");
-    property_mode_id = get_property_id(fd, props, "MODE_ID");
-    drmModeFreeObjectProperties(props);
+    modeset_create_fb(fd, &buf);
+    memset(buf.map, 0xff, buf.size);
 
-    drmModeCreatePropertyBlob(fd, &conn->modes[0], sizeof(conn->modes[0]), &blob_id);
+    drmModeCreatePropertyBlob(fd, &conn->mode, sizeof(conn->mode), &blob_id);
 
-    req = drmModeAtomicAlloc();
-    drmModeAtomicAddProperty(req, crtc_id, property_active, 1);
-    drmModeAtomicAddProperty(req, crtc_id, property_mode_id, blob_id);
-    drmModeAtomicAddProperty(req, conn_id, property_crtc_id, crtc_id);
-    drmModeAtomicCommit(fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
-    drmModeAtomicFree(req);
+    modeset_req_init(&req);
+    modeset_req_add(&req, &conn->obj, MODESET_PROP_CRTC_ID, crtc_obj->id);
+    modeset_req_add(&req, crtc_obj, MODESET_PROP_MODE_ID, blob_id);
+    modeset_req_add(&req, crtc_obj, MODESET_PROP_ACTIVE, 1);
+    add_primary_state(&req, plane_obj, crtc_obj->id);
+    modeset_req_commit(fd, &req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
 
     printf("drmModeAtomicCommit SetCrtc\n");
     getchar();
 
-    props = drmModeObjectGetProperties(fd, plane_id, DRM_MODE_OBJECT_PLANE);
-    property_crtc_id = get_property_id(fd, props, "CRTC_ID");
-    property_fb_id = get_property_id(fd, props, "FB_ID");
-    property_crtc_x = get_property_id(fd, props, "CRTC_X");
-    property_crtc_y = get_property_id(fd, props, "CRTC_Y");
-    property_crtc_w = get_property_id(fd, props, "CRTC_W");
-    property_crtc_h = get_property_id(fd, props, "CRTC_H");
-    property_src_x = get_property_id(fd, props, "SRC_X");
-    property_src_y = get_property_id(fd, props, "SRC_Y");
-    property_src_w = get_property_id(fd, props, "SRC_W");
-    property_src_h = get_property_id(fd, props, "SRC_H");
-    drmModeFreeObjectProperties(props);
-
-    req = drmModeAtomicAlloc();
-    drmModeAtomicAddProperty(req, plane_id, property_crtc_id, crtc_id);
-    drmModeAtomicAddProperty(req, plane_id, property_fb_id, buf.fb_id);
-    drmModeAtomicAddProperty(req, plane_id, property_crtc_x, 50);
-    drmModeAtomicAddProperty(req, plane_id, property_crtc_y, 50);
-    drmModeAtomicAddProperty(req, plane_id, property_crtc_w, 320);
-    drmModeAtomicAddProperty(req, plane_id, property_crtc_h, 320);
-    drmModeAtomicAddProperty(req, plane_id, property_src_x, 0);
-    drmModeAtomicAddProperty(req, plane_id, property_src_y, 0);
-    drmModeAtomicAddProperty(req, plane_id, property_src_w, 320 << 16);
-    drmModeAtomicAddProperty(req, plane_id, property_src_h, 320 << 16);
-    drmModeAtomicCommit(fd, req, 0, NULL);
-    drmModeAtomicFree(req);
+    /* overlapping layers, each one above the previous */
+    modeset_comp_init(&comp, fd, &topo, crtc_obj->id, modeset_assign_overlays(&assign, crtc));
+    for (i = 0; i < LAYER_COUNT; ++i) {
+        layer_buf[i].width = LAYER_SIZE;
+        layer_buf[i].height = LAYER_SIZE;
+        if (modeset_create_fb(fd, &layer_buf[i]))
+            break;
+        modeset_fill(&layer_buf[i], layer_colors[i]);
+
+        src.x1 = 0;
+        src.y1 = 0;
+        src.x2 = LAYER_SIZE;
+        src.y2 = LAYER_SIZE;
+        dst.x1 = 50 + i * LAYER_SIZE / 2;
+        dst.y1 = 50 + i * LAYER_SIZE / 3;
+        dst.x2 = dst.x1 + LAYER_SIZE;
+        dst.y2 = dst.y1 + LAYER_SIZE;
+        modeset_comp_add_layer(&comp, &layer_buf[i], &src, &dst, i);
+    }
+
+    modeset_req_init(&req);
+    add_primary_state(&req, plane_obj, crtc_obj->id);
+    if (modeset_comp_assign(&comp, &req, 0))
+        modeset_comp_paint(&comp, &buf);
+
+    for (i = 0; i < (int)comp.count_layers; ++i) {
+        if (comp.layers[i].plane >= 0)
+            printf("layer %d on plane %u\n", i, topo.planes[comp.layers[i].plane].obj.id);
+        else
+            printf("layer %d composited by the cpu\n", i);
+    }
+
+    modeset_req_commit(fd, &req, 0, NULL);
 
     printf("drmModeAtomicCommit SetPlane\n");
     getchar();
 
-    modeset_destroy_fb(fd, &buf);
+    /* a cursor sweep commits CRTC_X/CRTC_Y only, the planes below stay untouched */
+    if (!modeset_cursor_init(&cursor, fd, &topo, crtc, comp.planes_used)) {
+        uint32_t image[CURSOR_SIZE * CURSOR_SIZE];
+        uint64_t start, elapsed = 0;
+        int moved = 0;
+
+        for (i = 0; i < CURSOR_SIZE * CURSOR_SIZE; ++i)
+            image[i] = (i % CURSOR_SIZE == CURSOR_SIZE / 2 || i / CURSOR_SIZE == CURSOR_SIZE / 2) ? 0xff000000 : 0;
+        modeset_cursor_set_image(&cursor, image, CURSOR_SIZE, CURSOR_SIZE, CURSOR_SIZE / 2, CURSOR_SIZE / 2);
+        modeset_cursor_show(&cursor);
+
+        /* nothing else flips here, so each move is a blocking commit paced by the vblank */
+        cursor.blocking = true;
+        for (i = 0; i < CURSOR_MOVES; ++i) {
+            start = modeset_now_ns();
+            if (modeset_cursor_move(&cursor, (uint64_t)buf.width * i / CURSOR_MOVES,
+                                    (uint64_t)buf.height * i / CURSOR_MOVES, false))
+                continue;
+            elapsed += modeset_now_ns() - start;
+            ++moved;
+        }
+
+        printf("cursor on plane %u, %d of %d moves committed, %.1f us per position commit\n", cursor.plane.id,
+               moved, CURSOR_MOVES, moved ? (double)elapsed / 1000 / moved : 0.0);
+        getchar();
+
+        modeset_cursor_fini(&cursor);
+    }
 
-    drmModeFreeConnector(conn);
-    drmModeFreePlaneResources(plane_res);
-    drmModeFreeResources(res);
+    for (i = 0; i < LAYER_COUNT; ++i) {
+        if (layer_buf[i].fb)
+            modeset_destroy_fb(fd, &layer_buf[i]);
+    }
+    drmModeDestroyPropertyBlob(fd, blob_id);
+    modeset_destroy_fb(fd, &buf);
 
     close(fd);
 
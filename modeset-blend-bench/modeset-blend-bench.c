@@ -0,0 +1,343 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "modeset-blend.h"
+#include "modeset-buf.h"
+#include "modeset-fill.h"
+#include "modeset-util.h"
+
+/*
+ * CPU composition benchmark: a stack of premultiplied ARGB8888 layers
+ * (blended, copied, one scaled, one translucent fill) is composed into a
+ * destination frame by the naive per-pixel loop, by every fill ops variant
+ * row by row straight into the destination, and by the tiled engine of
+ * modeset_blend. Every result is checked against the naive loop. The
+ * destination is plain memory, or a dumb buffer with -d.
+ */
+
+#define BENCH_MAX_LAYERS 16
+
+static struct modeset_buf dst;
+static uint32_t *dst_init;
+static struct modeset_buf layer_buf[BENCH_MAX_LAYERS];
+static struct modeset_blend_layer layers[BENCH_MAX_LAYERS];
+static unsigned int count_layers = 8;
+
+static uint32_t bench_rand(void)
+{
+    static uint32_t state = 0x12345678;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/* opaque, transparent and translucent runs, like anti-aliased UI content */
+static uint32_t bench_pixel(uint32_t x)
+{
+    uint32_t a, r, g, b, v = bench_rand();
+
+    switch ((x / 64) % 3) {
+        case 0:
+            a = 255;
+            break;
+        case 1:
+            return 0;
+        default:
+            a = v >> 24;
+            break;
+    }
+    r = ((v >> 16) & 0xff) * a / 255;
+    g = ((v >> 8) & 0xff) * a / 255;
+    b = (v & 0xff) * a / 255;
+
+    return a << 24 | r << 16 | g << 8 | b;
+}
+
+static int bench_setup_layers(void)
+{
+    struct modeset_blend_layer *layer;
+    uint32_t i, x, y, w, h;
+
+    for (i = 0; i < count_layers; ++i) {
+        w = 256 + bench_rand() % 512;
+        h = 256 + bench_rand() % 512;
+        if (w > dst.width)
+            w = dst.width;
+        if (h > dst.height)
+            h = dst.height;
+
+        layer_buf[i].width = w;
+        layer_buf[i].height = h;
+        layer_buf[i].stride = w * 4;
+        layer_buf[i].map = malloc(layer_buf[i].stride * h);
+        if (!layer_buf[i].map)
+            return -ENOMEM;
+        for (y = 0; y < h; ++y) {
+            for (x = 0; x < w; ++x)
+                ((uint32_t *)(layer_buf[i].map + layer_buf[i].stride * y))[x] = bench_pixel(x + y);
+        }
+
+        layer = &layers[i];
+        layer->op = i == 0 ? MODESET_BLEND_SRC : MODESET_BLEND_OVER;
+        layer->buf = &layer_buf[i];
+        layer->src.x2 = w;
+        layer->src.y2 = h;
+        layer->dst.x1 = bench_rand() % (dst.width - w + 1);
+        layer->dst.y1 = bench_rand() % (dst.height - h + 1);
+        layer->dst.x2 = layer->dst.x1 + w;
+        layer->dst.y2 = layer->dst.y1 + h;
+
+        /* one layer shown at half size, one translucent fill */
+        if (i == 1) {
+            layer->dst.x2 = layer->dst.x1 + w / 2;
+            layer->dst.y2 = layer->dst.y1 + h / 2;
+        }
+        if (i == 2) {
+            layer->op = MODESET_BLEND_FILL;
+            layer->color = 0x80402010;
+        }
+    }
+
+    return 0;
+}
+
+static void naive_compose(void)
+{
+    const struct modeset_blend_layer *layer;
+    uint32_t i, c, s, d, ia, out;
+    int32_t x, y, sw, sh, dw, dh;
+    uint32_t *row;
+
+    for (i = 0; i < count_layers; ++i) {
+        layer = &layers[i];
+        sw = layer->src.x2 - layer->src.x1;
+        sh = layer->src.y2 - layer->src.y1;
+        dw = layer->dst.x2 - layer->dst.x1;
+        dh = layer->dst.y2 - layer->dst.y1;
+
+        for (y = layer->dst.y1; y < layer->dst.y2; ++y) {
+            row = (uint32_t *)(dst.map + dst.stride * y);
+            for (x = layer->dst.x1; x < layer->dst.x2; ++x) {
+                if (layer->op == MODESET_BLEND_FILL)
+                    s = layer->color;
+                else
+                    s = ((const uint32_t *)(layer->buf->map + layer->buf->stride *
+                         (layer->src.y1 + (int64_t)(y - layer->dst.y1) * sh / dh)))
+                        [layer->src.x1 + (int64_t)(x - layer->dst.x1) * sw / dw];
+
+                if (layer->op == MODESET_BLEND_SRC) {
+                    row[x] = s;
+                    continue;
+                }
+
+                d = row[x];
+                ia = 255 - (s >> 24);
+                out = 0;
+                for (c = 0; c < 32; c += 8)
+                    out |= (((s >> c) & 0xff) + (((d >> c) & 0xff) * ia + 127) / 255) << c;
+                row[x] = out;
+            }
+        }
+    }
+}
+
+static void untiled_compose(const struct modeset_fill_ops *ops)
+{
+    const struct modeset_blend_layer *layer;
+    uint32_t tmp[8192], *out;
+    const uint32_t *src;
+    int32_t x, y, sw, sh, dw, dh;
+    uint32_t i;
+
+    for (i = 0; i < count_layers; ++i) {
+        layer = &layers[i];
+        sw = layer->src.x2 - layer->src.x1;
+        sh = layer->src.y2 - layer->src.y1;
+        dw = layer->dst.x2 - layer->dst.x1;
+        dh = layer->dst.y2 - layer->dst.y1;
+
+        for (y = layer->dst.y1; y < layer->dst.y2; ++y) {
+            out = (uint32_t *)(dst.map + dst.stride * y) + layer->dst.x1;
+            if (layer->op == MODESET_BLEND_FILL) {
+                ops->blend_solid_row(out, layer->color, dw);
+                continue;
+            }
+
+            src = (const uint32_t *)(layer->buf->map + layer->buf->stride *
+                                     (layer->src.y1 + (int64_t)(y - layer->dst.y1) * sh / dh)) + layer->src.x1;
+            if (sw != dw) {
+                for (x = 0; x < dw; ++x)
+                    tmp[x] = src[(int64_t)x * sw / dw];
+                src = tmp;
+            }
+
+            if (layer->op == MODESET_BLEND_SRC)
+                ops->copy_row(out, src, dw);
+            else
+                ops->blend_row(out, src, dw);
+        }
+    }
+}
+
+static uint64_t bench_checksum(void)
+{
+    uint64_t sum = 0;
+    uint32_t x, y;
+
+    for (y = 0; y < dst.height; ++y) {
+        for (x = 0; x < dst.width; ++x)
+            sum = sum * 31 + ((uint32_t *)(dst.map + dst.stride * y))[x];
+    }
+
+    return sum;
+}
+
+static void bench_reset(void)
+{
+    uint32_t y;
+
+    for (y = 0; y < dst.height; ++y)
+        memcpy(dst.map + dst.stride * y, dst_init + dst.width * y, dst.width * 4);
+}
+
+static void bench_run(const char *name, const struct modeset_fill_ops *ops, int tiled, unsigned int reps,
+                      uint64_t *expect)
+{
+    uint64_t start, total = 0, pixels = 0, sum;
+    unsigned int i;
+
+    for (i = 0; i < count_layers; ++i)
+        pixels += (uint64_t)(layers[i].dst.x2 - layers[i].dst.x1) * (layers[i].dst.y2 - layers[i].dst.y1);
+
+    for (i = 0; i < reps; ++i) {
+        bench_reset();
+        start = modeset_now_ns();
+        if (!ops)
+            naive_compose();
+        else if (tiled)
+            modeset_blend_ops(ops, &dst, layers, count_layers, 0);
+        else
+            untiled_compose(ops);
+        total += modeset_now_ns() - start;
+    }
+
+    sum = bench_checksum();
+    if (!ops)
+        *expect = sum;
+
+    printf("  %-20s %10.3f ms/frame %12.0f layers/s %10.1f Mpix/s%s\n", name, total / 1e6 / reps,
+           (double)count_layers * reps * 1e9 / total, (double)pixels * reps * 1e3 / total,
+           sum == *expect ? "" : "  MISMATCH");
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d card] [-s WxH] [-l layers] [-n reps]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    const struct modeset_fill_ops *ops[MODESET_FILL_MAX_OPS];
+    unsigned int i, count_ops, reps = 20;
+    const char *card = NULL;
+    char name[32];
+    uint64_t expect = 0;
+    char *end;
+    int fd = -1, opt;
+
+    dst.width = 1920;
+    dst.height = 1080;
+
+    while ((opt = getopt(argc, argv, "d:s:l:n:h")) != -1) {
+        switch (opt) {
+            case 'd':
+                card = optarg;
+                break;
+            case 's':
+                dst.width = strtoul(optarg, &end, 10);
+                if (*end != 'x' || !dst.width || !(dst.height = strtoul(end + 1, NULL, 10))) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'l':
+                count_layers = strtoul(optarg, NULL, 10);
+                if (!count_layers || count_layers > BENCH_MAX_LAYERS) {
+                    fprintf(stderr, "layer count must be 1-%d\n", BENCH_MAX_LAYERS);
+                    return 1;
+                }
+                break;
+            case 'n':
+                reps = strtoul(optarg, NULL, 10);
+                if (!reps)
+                    reps = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (card) {
+        fd = open(card, O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "cannot open '%s': %m\n", card);
+            return 1;
+        }
+        if (modeset_create_fb(fd, &dst)) {
+            close(fd);
+            return 1;
+        }
+    }
+    else {
+        dst.stride = dst.width * 4;
+        dst.map = aligned_alloc(64, ((size_t)dst.stride * dst.height + 63) & ~(size_t)63);
+        if (!dst.map)
+            return 1;
+    }
+
+    dst_init = malloc((size_t)dst.width * dst.height * 4);
+    if (!dst_init || bench_setup_layers()) {
+        fprintf(stderr, "cannot allocate layers\n");
+        return 1;
+    }
+    for (i = 0; i < dst.width * dst.height; ++i)
+        dst_init[i] = 0xff000000 | bench_rand();
+
+    printf("%ux%u %s, %u layers, %u reps\n", dst.width, dst.height, card ? "dumb buffer" : "system memory",
+           count_layers, reps);
+
+    bench_run("naive", NULL, 0, reps, &expect);
+
+    count_ops = modeset_fill_get_supported(ops);
+    for (i = 0; i < count_ops; ++i) {
+        snprintf(name, sizeof(name), "%s-rows", ops[i]->name);
+        bench_run(name, ops[i], 0, reps, &expect);
+        snprintf(name, sizeof(name), "%s-tiled", ops[i]->name);
+        bench_run(name, ops[i], 1, reps, &expect);
+    }
+
+    for (i = 0; i < count_layers; ++i)
+        free(layer_buf[i].map);
+    free(dst_init);
+    if (fd >= 0) {
+        modeset_destroy_fb(fd, &dst);
+        close(fd);
+    }
+    else {
+        free(dst.map);
+    }
+
+    return 0;
+}
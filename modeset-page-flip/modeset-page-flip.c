@@ -2,79 +2,44 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <stdint.h>
-#include <sys/mman.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
-struct buffer_object {
-    uint32_t width;
-    uint32_t height;
-    uint32_t pitch;
-    uint32_t handle;
-    uint32_t size;
-    uint32_t *vaddr;
-    uint32_t fb_id;
-};
+#include "modeset-buf.h"
+#include "modeset-fill.h"
+#include "modeset-loop.h"
+#include "modeset-util.h"
 
-struct buffer_object buf[2];
-static int terminate;
+struct modeset_buf buf[2];
+static struct modeset_loop loop;
+static int flip_timer;
+static int drm_fd;
 
-static int modeset_create_fb(int fd, struct buffer_object *bo, uint32_t color)
-{
-    struct drm_mode_create_dumb create = {};
-    struct drm_mode_map_dumb map = {};
-    uint32_t i;
-
-    create.width = bo->width;
-    create.height = bo->height;
-    create.bpp = 32;
-    drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create);
-
-    bo->pitch = create.pitch;
-    bo->size = create.size;
-    bo->handle = create.handle;
-    drmModeAddFB(fd, bo->width, bo->height, 24, 32, bo->pitch, bo->handle, &bo->fb_id);
-
-    map.handle = create.handle;
-    drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map);
-
-    bo->vaddr = mmap(0, create.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map.offset);
-
-    for (i = 0; i < (bo->size / 4); ++i) {
-        bo->vaddr[i] = color;
-    }
-
-    return 0;
-}
-
-static void modeset_destroy_fb(int fd, struct buffer_object *bo)
+static void modeset_page_flip_handler(int fd, uint32_t frame, uint32_t sec, uint32_t usec, void *data)
 {
-    struct drm_mode_destroy_dumb destroy = {};
-
-    drmModeRmFB(fd, bo->fb_id);
-
-    munmap(bo->vaddr, bo->size);
-
-    destroy.handle = bo->handle;
-    drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+    /* hold each buffer on screen for half a second without blocking the loop */
+    modeset_loop_arm_timer(&loop, flip_timer, modeset_now_ns() + 500000000ull, 0);
 }
 
-static void modeset_page_flip_handler(int fd, uint32_t frame, uint32_t sec, uint32_t usec, void *data)
+static void modeset_flip_timer(struct modeset_loop *loop, int fd, void *data)
 {
     static int i = 0;
     uint32_t crtc_id = *(uint32_t *)data;
 
     i ^= 1;
 
-    drmModePageFlip(fd, crtc_id, buf[i].fb_id, DRM_MODE_PAGE_FLIP_EVENT, data);
+    drmModePageFlip(drm_fd, crtc_id, buf[i].fb, DRM_MODE_PAGE_FLIP_EVENT, data);
+}
 
-    usleep(500000);
+static void modeset_drm_event(struct modeset_loop *loop, int fd, void *data)
+{
+    drmHandleEvent(fd, data);
 }
 
-static void sigint_handler(int arg)
+static void sigint_handler(struct modeset_loop *loop, int fd, void *data)
 {
-    terminate = 1;
+    modeset_loop_quit(loop);
 }
 
 int main(int argc, char **argv)
@@ -86,12 +51,11 @@ int main(int argc, char **argv)
     uint32_t conn_id;
     uint32_t crtc_id;
 
-    signal(SIGINT, sigint_handler);
-
     ev.version = DRM_EVENT_CONTEXT_VERSION;
     ev.page_flip_handler = modeset_page_flip_handler;
 
     fd = open("/dev/dri/card0", O_RDWR | O_CLOEXEC);
+    drm_fd = fd;
 
     res = drmModeGetResources(fd);
     crtc_id = res->crtcs[0];
@@ -103,16 +67,22 @@ int main(int argc, char **argv)
     buf[1].width = conn->modes[0].hdisplay;
     buf[1].height = conn->modes[0].vdisplay;
 
-    modeset_create_fb(fd, &buf[0], 0xff0000);
-    modeset_create_fb(fd, &buf[1], 0x0000ff);
+    modeset_create_fb(fd, &buf[0]);
+    modeset_fill(&buf[0], 0xff0000);
+    modeset_create_fb(fd, &buf[1]);
+    modeset_fill(&buf[1], 0x0000ff);
+
+    drmModeSetCrtc(fd, crtc_id, buf[0].fb, 0, 0, &conn_id, 1, &conn->modes[0]);
 
-    drmModeSetCrtc(fd, crtc_id, buf[0].fb_id, 0, 0, &conn_id, 1, &conn->modes[0]);
+    modeset_loop_init(&loop);
+    modeset_loop_add_fd(&loop, fd, modeset_drm_event, &ev);
+    modeset_loop_add_signal(&loop, SIGINT, sigint_handler, NULL);
+    flip_timer = modeset_loop_add_timer(&loop, modeset_flip_timer, &crtc_id);
 
-    drmModePageFlip(fd, crtc_id, buf[0].fb_id, DRM_MODE_PAGE_FLIP_EVENT, &crtc_id);
+    drmModePageFlip(fd, crtc_id, buf[0].fb, DRM_MODE_PAGE_FLIP_EVENT, &crtc_id);
 
-    while (!terminate) {
-        drmHandleEvent(fd, &ev);
-    }
+    modeset_loop_run(&loop);
+    modeset_loop_fini(&loop);
 
     modeset_destroy_fb(fd, &buf[1]);
     modeset_destroy_fb(fd, &buf[0]);
@@ -3,60 +3,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
-struct buffer_object {
-    uint32_t width;
-    uint32_t height;
-    uint32_t pitch;
-    uint32_t handle;
-    uint32_t size;
-    uint8_t *vaddr;
-    uint32_t fb_id;
-};
+#include "modeset-buf.h"
 
-struct buffer_object buf;
-
-static int modeset_create_fb(int fd, struct buffer_object *bo)
-{
-    struct drm_mode_create_dumb create = {};
-    struct drm_mode_map_dumb map = {};
-
-    create.width = bo->width;
-    create.height = bo->height;
-    create.bpp = 32;
-    drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create);
-
-    bo->pitch = create.pitch;
-    bo->size = create.size;
-    bo->handle = create.handle;
-    drmModeAddFB(fd, bo->width, bo->height, 24, 32, bo->pitch, bo->handle, &bo->fb_id);
-
-    map.handle = create.handle;
-    drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map);
-
-    bo->vaddr = mmap(0, create.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map.offset);
-
-    memset(bo->vaddr, 0xff, bo->size);
-
-    return 0;
-}
-
-static void modeset_destroy_fb(int fd, struct buffer_object *bo)
-{
-    struct drm_mode_destroy_dumb destroy = {};
-
-    drmModeRmFB(fd, bo->fb_id);
-
-    munmap(bo->vaddr, bo->size);
-
-    destroy.handle = bo->handle;
-
-    drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
-}
+struct modeset_buf buf;
 
 int main(int argc, char **argv)
 {
@@ -83,12 +36,13 @@ int main(int argc, char **argv)
     buf.height = conn->modes[0].vdisplay;
 
     modeset_create_fb(fd, &buf);
+    memset(buf.map, 0xff, buf.size);
 
-    drmModeSetCrtc(fd, crtc_id, buf.fb_id, 0, 0, &conn_id, 1, &conn->modes[0]);
+    drmModeSetCrtc(fd, crtc_id, buf.fb, 0, 0, &conn_id, 1, &conn->modes[0]);
 
     getchar();
 
-    drmModeSetPlane(fd, plane_id, crtc_id, buf.fb_id, 0, 50, 50, 320, 320, 100 << 16, 150 << 16, 320 << 16, 320 << 16);
+    drmModeSetPlane(fd, plane_id, crtc_id, buf.fb, 0, 50, 50, 320, 320, 100 << 16, 150 << 16, 320 << 16, 320 << 16);
 
     getchar();
 
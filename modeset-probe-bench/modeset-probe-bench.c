@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "modeset-assign.h"
+#include "modeset-bringup.h"
+#include "modeset-buf.h"
+#include "modeset-topo.h"
+#include "modeset-util.h"
+
+/*
+ * Startup benchmark: open the device, probe the topology, assign CRTCs,
+ * create one framebuffer per lit connector and bring every output up,
+ * once per probe strategy. The full drmModeGetConnector probe runs
+ * first, so the later strategies see the state a restarted service
+ * would find.
+ *
+ * Like a restarted service, each startup finds the outputs still lit by
+ * the one before: the previous device file drops master but keeps its
+ * framebuffers on screen until the next startup has taken the CRTCs
+ * over (MODESET_TAKEOVER defaults to all), so a rep is not a full
+ * modeset from a dark CRTC. An untimed startup lights the outputs first.
+ */
+
+#define BENCH_MAX_OUTPUTS 8
+
+struct bench_strategy {
+    const char *name;
+    unsigned int flags;
+};
+
+static const struct bench_strategy bench_strategies[] = {
+    { "full", 0 },
+    { "current", MODESET_TOPO_PROBE_CURRENT },
+    { "current+parallel", MODESET_TOPO_PROBE_CURRENT | MODESET_TOPO_PROBE_PARALLEL },
+};
+
+static struct modeset_topo topo;
+static struct modeset_assign assign;
+
+/* the previous startup, still scanning out */
+static int held_fd = -1;
+static unsigned int held_count;
+static struct modeset_buf held_bufs[BENCH_MAX_OUTPUTS];
+
+static void bench_release(void)
+{
+    unsigned int i;
+
+    if (held_fd < 0)
+        return;
+
+    for (i = 0; i < held_count; ++i)
+        modeset_destroy_fb(held_fd, &held_bufs[i]);
+    close(held_fd);
+    held_fd = -1;
+    held_count = 0;
+}
+
+/* open to first frame on screen; probe_ns gets the topology probe alone */
+static int bench_startup(const char *card, unsigned int flags, uint64_t *probe_ns, uint64_t *total_ns,
+                         unsigned int *count_out)
+{
+    struct modeset_bringup outputs[BENCH_MAX_OUTPUTS];
+    struct modeset_buf bufs[BENCH_MAX_OUTPUTS];
+    unsigned int i, count = 0;
+    uint64_t start, probed;
+    bool atomic;
+    int fd, ret;
+
+    /* only one file can be master, the new one takes over what the old one lit */
+    if (held_fd >= 0)
+        drmDropMaster(held_fd);
+
+    start = modeset_now_ns();
+    fd = open(card, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open '%s': %m\n", card);
+        return -errno;
+    }
+
+    ret = modeset_topo_probe_flags(fd, &topo, flags);
+    probed = modeset_now_ns();
+    if (ret)
+        goto out_close;
+
+    modeset_assign_solve(&topo, topo.connected_mask, &assign);
+    memset(bufs, 0, sizeof(bufs));
+    for (i = 0; i < topo.count_connectors && count < BENCH_MAX_OUTPUTS; ++i) {
+        if (assign.conn_crtc[i] < 0)
+            continue;
+
+        bufs[count].width = topo.connectors[i].mode.hdisplay;
+        bufs[count].height = topo.connectors[i].mode.vdisplay;
+        if (modeset_create_fb(fd, &bufs[count]))
+            continue;
+
+        modeset_bringup_set(&outputs[count], topo.connectors[i].obj.id, topo.crtcs[assign.conn_crtc[i]].obj.id,
+                            &bufs[count], &topo.connectors[i].mode);
+        ++count;
+    }
+
+    if (!count) {
+        fprintf(stderr, "no connector to light\n");
+        ret = -ENOENT;
+        goto out_close;
+    }
+
+    ret = modeset_bringup(fd, outputs, count, &atomic);
+    *total_ns = modeset_now_ns() - start;
+    *probe_ns = probed - start;
+    *count_out = count;
+
+    if (ret) {
+        for (i = 0; i < count; ++i)
+            modeset_destroy_fb(fd, &bufs[i]);
+        goto out_close;
+    }
+
+    bench_release();
+    held_fd = fd;
+    held_count = count;
+    memcpy(held_bufs, bufs, sizeof(bufs));
+    return 0;
+
+out_close:
+    close(fd);
+    return ret;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d card] [-n reps]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t probe_ns, total_ns, probe_min, total_min, probe_sum, total_sum;
+    const char *card = "/dev/dri/card0";
+    unsigned int i, j, reps = 10, count = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:h")) != -1) {
+        switch (opt) {
+            case 'd':
+                card = optarg;
+                break;
+            case 'n':
+                reps = strtoul(optarg, NULL, 10);
+                if (!reps)
+                    reps = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    setenv("MODESET_TAKEOVER", "all", 0);
+    if (bench_startup(card, 0, &probe_ns, &total_ns, &count))
+        return 1;
+
+    printf("%s, %u startups per strategy\n", card, reps);
+    printf("  %-20s %12s %12s %14s %14s\n", "probe", "probe ms", "min ms", "1st frame ms", "min ms");
+
+    for (i = 0; i < sizeof(bench_strategies) / sizeof(bench_strategies[0]); ++i) {
+        probe_min = total_min = UINT64_MAX;
+        probe_sum = total_sum = 0;
+
+        for (j = 0; j < reps; ++j) {
+            if (bench_startup(card, bench_strategies[i].flags, &probe_ns, &total_ns, &count)) {
+                bench_release();
+                return 1;
+            }
+
+            probe_sum += probe_ns;
+            total_sum += total_ns;
+            if (probe_ns < probe_min)
+                probe_min = probe_ns;
+            if (total_ns < total_min)
+                total_min = total_ns;
+        }
+
+        printf("  %-20s %12.3f %12.3f %14.3f %14.3f\n", bench_strategies[i].name, probe_sum / 1e6 / reps,
+               probe_min / 1e6, total_sum / 1e6 / reps, total_min / 1e6);
+    }
+    printf("%u outputs lit\n", count);
+    bench_release();
+
+    return 0;
+}